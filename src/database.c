@@ -80,6 +80,9 @@ static const item_list_t g_file_type[] = {
 typedef enum database_stmt {
   STMT_SELECT_FILE_INTERRUP,
   STMT_SELECT_FILE_MTIME,
+  STMT_SELECT_FILE_STATE,
+  STMT_SELECT_FILE_IDENTITY,
+  STMT_SELECT_FILE_SIZE,
   STMT_SELECT_TYPE_ID,
   STMT_SELECT_META_ID,
   STMT_SELECT_DATA_ID,
@@ -102,7 +105,12 @@ typedef enum database_stmt {
   STMT_INSERT_DLCONTEXT,
   STMT_INSERT_ASSOC_FILE_METADATA,
   STMT_INSERT_ASSOC_FILE_GRABBER,
+  STMT_COPY_ASSOC_FILE_METADATA,
+  STMT_COPY_ASSOC_FILE_GRABBER,
   STMT_UPDATE_FILE,
+  STMT_UPDATE_FILE_COPY,
+  STMT_UPDATE_FILE_IDENTITY,
+  STMT_UPDATE_FILE_PATH,
   STMT_UPDATE_ASSOC_FILE_METADATA,
   STMT_UPDATE_ASSOC_FILE_MD_P,
   STMT_UPDATE_ASSOC_FILE_MD_PM,
@@ -124,6 +132,19 @@ typedef enum database_stmt {
   STMT_UPDATE_FILE_INTERRUP_CLEAR,
   STMT_UPDATE_FILE_INTERRUP_FIX,
   STMT_SELECT_FILE_OUTOFPATH_SET,
+  STMT_SELECT_FILE_OFFLINE_SET,
+  STMT_UPDATE_FILE_OFFLINE,
+  STMT_SELECT_FILE_INTERRUP_SET,
+  STMT_SELECT_FILE_TREE,
+  STMT_SELECT_DIRECTORY,
+  STMT_INSERT_DIRECTORY,
+  STMT_UPDATE_DIRECTORY_CHECKED,
+  STMT_UPDATE_DIRECTORY_CHECKED_CLEAR,
+  STMT_UPDATE_FILE_CHECKED_DIR,
+  STMT_DELETE_DIRECTORY_CHECKED,
+  STMT_SELECT_SPILL,
+  STMT_INSERT_SPILL,
+  STMT_DELETE_SPILL,
   STMT_BEGIN_TRANSACTION,
   STMT_END_TRANSACTION,
 } database_stmt_t;
@@ -131,6 +152,9 @@ typedef enum database_stmt {
 static const stmt_list_t g_stmts[] = {
   [STMT_SELECT_FILE_INTERRUP]        = { SELECT_FILE_INTERRUP,        NULL },
   [STMT_SELECT_FILE_MTIME]           = { SELECT_FILE_MTIME,           NULL },
+  [STMT_SELECT_FILE_STATE]           = { SELECT_FILE_STATE,           NULL },
+  [STMT_SELECT_FILE_IDENTITY]        = { SELECT_FILE_IDENTITY,        NULL },
+  [STMT_SELECT_FILE_SIZE]            = { SELECT_FILE_SIZE,            NULL },
   [STMT_SELECT_TYPE_ID]              = { SELECT_TYPE_ID,              NULL },
   [STMT_SELECT_META_ID]              = { SELECT_META_ID,              NULL },
   [STMT_SELECT_DATA_ID]              = { SELECT_DATA_ID,              NULL },
@@ -153,7 +177,12 @@ static const stmt_list_t g_stmts[] = {
   [STMT_INSERT_DLCONTEXT]            = { INSERT_DLCONTEXT,            NULL },
   [STMT_INSERT_ASSOC_FILE_METADATA]  = { INSERT_ASSOC_FILE_METADATA,  NULL },
   [STMT_INSERT_ASSOC_FILE_GRABBER]   = { INSERT_ASSOC_FILE_GRABBER,   NULL },
+  [STMT_COPY_ASSOC_FILE_METADATA]    = { COPY_ASSOC_FILE_METADATA,    NULL },
+  [STMT_COPY_ASSOC_FILE_GRABBER]     = { COPY_ASSOC_FILE_GRABBER,     NULL },
   [STMT_UPDATE_FILE]                 = { UPDATE_FILE,                 NULL },
+  [STMT_UPDATE_FILE_COPY]            = { UPDATE_FILE_COPY,            NULL },
+  [STMT_UPDATE_FILE_IDENTITY]        = { UPDATE_FILE_IDENTITY,        NULL },
+  [STMT_UPDATE_FILE_PATH]            = { UPDATE_FILE_PATH,            NULL },
   [STMT_UPDATE_ASSOC_FILE_METADATA]  = { UPDATE_ASSOC_FILE_METADATA,  NULL },
   [STMT_UPDATE_ASSOC_FILE_MD_P]      = { UPDATE_ASSOC_FILE_MD_P,      NULL },
   [STMT_UPDATE_ASSOC_FILE_MD_PM]     = { UPDATE_ASSOC_FILE_MD_PM,     NULL },
@@ -175,6 +204,20 @@ static const stmt_list_t g_stmts[] = {
   [STMT_UPDATE_FILE_INTERRUP_CLEAR]  = { UPDATE_FILE_INTERRUP_CLEAR,  NULL },
   [STMT_UPDATE_FILE_INTERRUP_FIX]    = { UPDATE_FILE_INTERRUP_FIX,    NULL },
   [STMT_SELECT_FILE_OUTOFPATH_SET]   = { SELECT_FILE_OUTOFPATH_SET,   NULL },
+  [STMT_SELECT_FILE_OFFLINE_SET]     = { SELECT_FILE_OFFLINE_SET,     NULL },
+  [STMT_UPDATE_FILE_OFFLINE]         = { UPDATE_FILE_OFFLINE,         NULL },
+  [STMT_SELECT_FILE_INTERRUP_SET]    = { SELECT_FILE_INTERRUP_SET,    NULL },
+  [STMT_SELECT_FILE_TREE]            = { SELECT_FILE_TREE,            NULL },
+  [STMT_SELECT_DIRECTORY]            = { SELECT_DIRECTORY,            NULL },
+  [STMT_INSERT_DIRECTORY]            = { INSERT_DIRECTORY,            NULL },
+  [STMT_UPDATE_DIRECTORY_CHECKED]    = { UPDATE_DIRECTORY_CHECKED,    NULL },
+  [STMT_UPDATE_DIRECTORY_CHECKED_CLEAR] =
+                                { UPDATE_DIRECTORY_CHECKED_CLEAR,     NULL },
+  [STMT_UPDATE_FILE_CHECKED_DIR]     = { UPDATE_FILE_CHECKED_DIR,     NULL },
+  [STMT_DELETE_DIRECTORY_CHECKED]    = { DELETE_DIRECTORY_CHECKED,    NULL },
+  [STMT_SELECT_SPILL]                = { SELECT_SPILL,                NULL },
+  [STMT_INSERT_SPILL]                = { INSERT_SPILL,                NULL },
+  [STMT_DELETE_SPILL]                = { DELETE_SPILL,                NULL },
   [STMT_BEGIN_TRANSACTION]           = { BEGIN_TRANSACTION,           NULL },
   [STMT_END_TRANSACTION]             = { END_TRANSACTION,             NULL },
 };
@@ -839,6 +882,9 @@ database_file_insert (database_t *database, file_data_t *data)
   VH_DB_BIND_TEXT_OR_GOTO  (stmt, 1, data->file.path,  out);
   VH_DB_BIND_INT64_OR_GOTO (stmt, 2, data->file.mtime, out_clear);
   VH_DB_BIND_INT_OR_GOTO   (stmt, 3, data->outofpath,  out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 4, data->dev,        out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 5, data->ino,        out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 6, data->file.size,  out_clear);
 
   res = sqlite3_step (stmt);
   if (res == SQLITE_DONE)
@@ -864,7 +910,11 @@ database_file_update (database_t *database, file_data_t *data, int64_t type_id)
   if (type_id)
     VH_DB_BIND_INT64_OR_GOTO (stmt, 3, type_id, out_clear);
 
-  VH_DB_BIND_TEXT_OR_GOTO (stmt, 4, data->file.path, out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 4, data->dev,       out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 5, data->ino,       out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 6, data->file.size, out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 7, data->sign,      out_clear);
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 8, data->file.path, out_clear);
 
   res = sqlite3_step (stmt);
   if (res == SQLITE_DONE)
@@ -1074,6 +1124,224 @@ vh_database_file_get_mtime (database_t *database, const char *file)
   return val;
 }
 
+/*
+ * Retrieve the mtime and the interrupted flag with only one query.
+ * -1 is returned if the file is not in the database.
+ */
+int
+vh_database_file_get_state (database_t *database, const char *file,
+                            int64_t *mtime, int *interrupted)
+{
+  int res, err = -1, val = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_STATE);
+
+  if (!file || !mtime || !interrupted)
+    return -1;
+
+  VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, file, out);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_ROW)
+  {
+    *mtime       = sqlite3_column_int64 (stmt, 0);
+    *interrupted = sqlite3_column_int (stmt, 1);
+    val = 0;
+  }
+
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+  err = 0;
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  return val;
+}
+
+void
+vh_database_file_identity (database_t *database, file_data_t *data)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_UPDATE_FILE_IDENTITY);
+
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 1, data->dev,       out);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 2, data->ino,       out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 3, data->file.size, out_clear);
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 4, data->file.path, out_clear);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+ out_clear:
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+static int
+database_file_copy_assoc (database_t *database,
+                          sqlite3_stmt *stmt, int64_t file_id, int64_t src_id)
+{
+  int res, err = -1;
+
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 1, file_id, out);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 2, src_id,  out_clear);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+ out_clear:
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  return err;
+}
+
+/*
+ * Search a file already handled with the same identity (device, inode, size
+ * and mtime), like a hard link or the same file through a bind mount. All
+ * metadata and grabbers are copied from this file to the new one, which is
+ * then considered as fully handled.
+ *
+ * The file must already be in the database. The return value is 0 if the
+ * metadata are copied.
+ */
+int
+vh_database_file_duplicate (database_t *database, file_data_t *data)
+{
+  int res, err = -1;
+  int64_t src_id = 0, file_id;
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_IDENTITY);
+
+  if (!data->ino)
+    return -1;
+
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 1, data->ino,        out);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 2, data->dev,        out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 3, data->file.size,  out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 4, data->file.mtime, out_clear);
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 5, data->file.path,  out_clear);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_ROW)
+    src_id = sqlite3_column_int64 (stmt, 0);
+  if (res == SQLITE_ROW || res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+ out_clear:
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  if (!src_id)
+    return -1;
+
+  file_id = database_table_get_id (database,
+                                   STMT_GET (STMT_SELECT_FILE_ID),
+                                   data->file.path);
+  if (!file_id)
+    return -1;
+
+  if (database_file_copy_assoc (database,
+                                 STMT_GET (STMT_COPY_ASSOC_FILE_METADATA),
+                                 file_id, src_id)
+      || database_file_copy_assoc (database,
+                                   STMT_GET (STMT_COPY_ASSOC_FILE_GRABBER),
+                                   file_id, src_id))
+    return -1;
+
+  err  = -1;
+  stmt = STMT_GET (STMT_UPDATE_FILE_COPY);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 1, data->file.mtime, out_copy);
+  VH_DB_BIND_INT_OR_GOTO   (stmt, 2, data->outofpath,  out_copy_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 3, data->dev,        out_copy_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 4, data->ino,        out_copy_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 5, data->file.size,  out_copy_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 6, src_id,           out_copy_clear);
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 7, data->file.path,  out_copy_clear);
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+ out_copy_clear:
+  sqlite3_clear_bindings (stmt);
+ out_copy:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  return err;
+}
+
+/*
+ * Retrieve all files with this size which are not yet checked with the
+ * current loop (candidates for a move). The query is started when "size"
+ * is not 0, the next files are returned with "size" set to 0. The signature
+ * of each file is returned with "sign".
+ */
+const char *
+vh_database_file_get_size (database_t *database,
+                           int64_t size, int64_t *sign, int rst)
+{
+  int res = SQLITE_DONE, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_SIZE);
+
+  if (size)
+    VH_DB_BIND_INT64_OR_GOTO (stmt, 1, size, out);
+
+  if (!rst)
+  {
+    res = sqlite3_step (stmt);
+    if (res == SQLITE_ROW)
+    {
+      if (sign)
+        *sign = sqlite3_column_int64 (stmt, 1);
+      return (const char *) sqlite3_column_text (stmt, 0);
+    }
+  }
+
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  return NULL;
+}
+
+void
+vh_database_file_move (database_t *database,
+                       const char *from, file_data_t *data)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_UPDATE_FILE_PATH);
+
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 1, data->file.path,  out);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 2, data->file.mtime, out_clear);
+  VH_DB_BIND_INT_OR_GOTO   (stmt, 3, data->outofpath,  out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 4, data->dev,        out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 5, data->ino,        out_clear);
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 6, from,             out_clear);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+ out_clear:
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
 void
 vh_database_file_get_grabber (database_t *database,
                               const char *file, list_t *l)
@@ -1203,6 +1471,26 @@ vh_database_file_get_interrupted (database_t *database, const char *file)
   return val;
 }
 
+const char *
+vh_database_file_get_interrupted_set (database_t *database, int rst)
+{
+  int res = SQLITE_DONE;
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_INTERRUP_SET);
+
+  if (!rst)
+  {
+    res = sqlite3_step (stmt);
+    if (res == SQLITE_ROW)
+      return (const char *) sqlite3_column_text (stmt, 0);
+  }
+
+  sqlite3_reset (stmt);
+  if (res != SQLITE_DONE && res != SQLITE_ROW)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+
+  return NULL;
+}
+
 /******************************************************************************/
 /*                         Outofpath file handling                            */
 /******************************************************************************/
@@ -1227,6 +1515,288 @@ vh_database_file_get_outofpath_set (database_t *database, int rst)
   return NULL;
 }
 
+/******************************************************************************/
+/*                          Offline file handling                             */
+/******************************************************************************/
+
+const char *
+vh_database_file_get_offline_set (database_t *database, int rst)
+{
+  int res = SQLITE_DONE;
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_OFFLINE_SET);
+
+  if (!rst)
+  {
+    res = sqlite3_step (stmt);
+    if (res == SQLITE_ROW)
+      return (const char *) sqlite3_column_text (stmt, 0);
+  }
+
+  sqlite3_reset (stmt);
+  if (res != SQLITE_DONE && res != SQLITE_ROW)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+
+  return NULL;
+}
+
+void
+vh_database_file_offline (database_t *database, const char *file, int offline)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_UPDATE_FILE_OFFLINE);
+
+  if (!file)
+    return;
+
+  VH_DB_BIND_INT_OR_GOTO  (stmt, 1, !!offline, out);
+  VH_DB_BIND_TEXT_OR_GOTO (stmt, 2, file,      out_clear);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+ out_clear:
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+/******************************************************************************/
+/*                           File tree handling                               */
+/******************************************************************************/
+
+/*
+ * Retrieve all files where the path is "path" or where "path" is a parent
+ * directory. The query is started when "path" is not NULL, the next files
+ * are returned with "path" set to NULL.
+ */
+const char *
+vh_database_file_get_tree (database_t *database, const char *path, int rst)
+{
+  int res = SQLITE_DONE, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_FILE_TREE);
+
+  if (path)
+    VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, path, out);
+
+  if (!rst)
+  {
+    res = sqlite3_step (stmt);
+    if (res == SQLITE_ROW)
+      return (const char *) sqlite3_column_text (stmt, 0);
+  }
+
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  return NULL;
+}
+
+/******************************************************************************/
+/*                           Directories handling                             */
+/******************************************************************************/
+
+/*
+ * Retrieve the state of all directories saved by the previous scan. The
+ * query is started with rst = 0 and the row is returned until NULL.
+ */
+const char *
+vh_database_directory_get (database_t *database,
+                           int64_t *mtime, int64_t *hash, int rst)
+{
+  int res = SQLITE_DONE;
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_DIRECTORY);
+
+  if (!rst)
+  {
+    res = sqlite3_step (stmt);
+    if (res == SQLITE_ROW)
+    {
+      *mtime = sqlite3_column_int64 (stmt, 1);
+      *hash  = sqlite3_column_int64 (stmt, 2);
+      return (const char *) sqlite3_column_text (stmt, 0);
+    }
+  }
+
+  sqlite3_reset (stmt);
+  if (res != SQLITE_DONE && res != SQLITE_ROW)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+
+  return NULL;
+}
+
+void
+vh_database_directory_insert (database_t *database,
+                              const char *path, int64_t mtime, int64_t hash)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_INSERT_DIRECTORY);
+
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 1, path,  out);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 2, mtime, out);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 3, hash,  out);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+/*
+ * The directory is unchanged since the previous scan. The directory and all
+ * its files (but not the sub-directories) are marked as checked with only
+ * two statements instead of one by file.
+ */
+void
+vh_database_directory_unchanged (database_t *database, const char *path)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt_dir  = STMT_GET (STMT_UPDATE_DIRECTORY_CHECKED);
+  sqlite3_stmt *stmt_file = STMT_GET (STMT_UPDATE_FILE_CHECKED_DIR);
+
+  VH_DB_BIND_TEXT_OR_GOTO (stmt_dir,  1, path, out);
+  VH_DB_BIND_TEXT_OR_GOTO (stmt_file, 1, path, out);
+
+  res = sqlite3_step (stmt_dir);
+  if (res != SQLITE_DONE)
+    goto out_reset;
+
+  res = sqlite3_step (stmt_file);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+ out_reset:
+  sqlite3_reset (stmt_dir);
+  sqlite3_reset (stmt_file);
+ out:
+  sqlite3_clear_bindings (stmt_dir);
+  sqlite3_clear_bindings (stmt_file);
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+void
+vh_database_directory_checked_clear (database_t *database)
+{
+  int res;
+  sqlite3_stmt *stmt = STMT_GET (STMT_UPDATE_DIRECTORY_CHECKED_CLEAR);
+
+  res = sqlite3_step (stmt);
+
+  sqlite3_reset (stmt);
+  if (res != SQLITE_DONE)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+void
+vh_database_directory_cleanup (database_t *database)
+{
+  int res;
+  sqlite3_stmt *stmt = STMT_GET (STMT_DELETE_DIRECTORY_CHECKED);
+
+  res = sqlite3_step (stmt);
+
+  sqlite3_reset (stmt);
+  if (res != SQLITE_DONE)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+/******************************************************************************/
+/*                             Spilled entries                                */
+/******************************************************************************/
+
+/*
+ * The entries are saved in a temporary table (lost with the connection) and
+ * they are retrieved in the same order. The path returned by
+ * vh_database_spill_get() must be freed by the caller.
+ */
+int
+vh_database_spill_insert (database_t *database, const database_spill_t *spill)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt = STMT_GET (STMT_INSERT_SPILL);
+
+  VH_DB_BIND_INT_OR_GOTO   (stmt, 1, spill->action, out);
+  VH_DB_BIND_TEXT_OR_GOTO  (stmt, 2, spill->path,   out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 3, spill->mtime,  out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 4, spill->size,   out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 5, spill->dev,    out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 6, spill->ino,    out_clear);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 7, spill->hash,   out_clear);
+  VH_DB_BIND_INT_OR_GOTO   (stmt, 8, spill->flag,   out_clear);
+  VH_DB_BIND_INT_OR_GOTO   (stmt, 9, spill->priority, out_clear);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+ out_clear:
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  return err;
+}
+
+int
+vh_database_spill_get (database_t *database, database_spill_t *spill)
+{
+  int res, err = -1;
+  int64_t id;
+  const char *path;
+  sqlite3_stmt *stmt = STMT_GET (STMT_SELECT_SPILL);
+
+  res = sqlite3_step (stmt);
+  if (res != SQLITE_ROW)
+  {
+    sqlite3_reset (stmt);
+    if (res == SQLITE_DONE)
+      return -1; /* empty */
+    goto out;
+  }
+
+  id   = sqlite3_column_int64 (stmt, 0);
+  path = (const char *) sqlite3_column_text (stmt, 2);
+
+  spill->action = sqlite3_column_int   (stmt, 1);
+  spill->path   = path ? strdup (path) : NULL;
+  spill->mtime  = sqlite3_column_int64 (stmt, 3);
+  spill->size   = sqlite3_column_int64 (stmt, 4);
+  spill->dev    = sqlite3_column_int64 (stmt, 5);
+  spill->ino    = sqlite3_column_int64 (stmt, 6);
+  spill->hash   = sqlite3_column_int64 (stmt, 7);
+  spill->flag   = sqlite3_column_int   (stmt, 8);
+  spill->priority = sqlite3_column_int (stmt, 9);
+  sqlite3_reset (stmt);
+
+  stmt = STMT_GET (STMT_DELETE_SPILL);
+  VH_DB_BIND_INT64_OR_GOTO (stmt, 1, id, out);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+ out:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+  return err ? -1 : 0;
+}
+
 /******************************************************************************/
 /*                       Downloader Contexts handling                         */
 /******************************************************************************/
@@ -1374,6 +1944,46 @@ database_info_set (database_t *database, const char *name, const char *value)
     vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
 }
 
+static void
+database_info_del (database_t *database, const char *name)
+{
+  int res, err = -1;
+  sqlite3_stmt *stmt;
+
+  res = sqlite3_prepare_v2 (database->db, DELETE_INFO, -1, &stmt, NULL);
+  if (res != SQLITE_OK)
+    goto out_err;
+
+  VH_DB_BIND_TEXT_OR_GOTO (stmt, 1, name, out_free);
+
+  res = sqlite3_step (stmt);
+  if (res == SQLITE_DONE)
+    err = 0;
+
+ out_free:
+  sqlite3_finalize (stmt);
+ out_err:
+  if (err < 0)
+    vh_log (VALHALLA_MSG_ERROR, "%s", sqlite3_errmsg (database->db));
+}
+
+#define VH_INFO_CHECKPOINT  "vh_scan_checkpoint" /* position of the scanner */
+
+char *
+vh_database_checkpoint_get (database_t *database)
+{
+  return database_info_get (database, VH_INFO_CHECKPOINT);
+}
+
+void
+vh_database_checkpoint_set (database_t *database, const char *value)
+{
+  if (value)
+    database_info_set (database, VH_INFO_CHECKPOINT, value);
+  else
+    database_info_del (database, VH_INFO_CHECKPOINT);
+}
+
 /******************************************************************************/
 /*                               Main Functions                               */
 /******************************************************************************/
@@ -1466,11 +2076,16 @@ database_create_table (database_t *database)
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_DLCONTEXT,           m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_ASSOC_FILE_METADATA, m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_ASSOC_FILE_GRABBER,  m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_DIRECTORY,           m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_TABLE_SPILL,               m, err);
 
   /* Create indexes */
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_CHECKED,             m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_INTERRUPTED,         m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_OUTOFPATH,           m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_OFFLINE,             m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_IDENTITY,            m, err);
+  DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_SIZE,                m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_ASSOC,               m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_FK_FILE,             m, err);
   DB_SQL_EXEC_OR_GOTO (database->db, CREATE_INDEX_FK_ASSOC,            m, err);
@@ -1513,20 +2128,30 @@ database_info (database_t *database)
   {
     char *err = NULL;
 
-    if (ver == 1 && LIBVALHALLA_DB_VERSION == 2)
-    {
-      const char *const up[] = {
-        DB_UPDATER_FROM_1_TO_2_A,
-        DB_UPDATER_FROM_1_TO_2_B,
-      };
-      unsigned int i;
+    /* The updaters are applied one after the other from the version. */
+    static const struct {
+      int from;
+      const char *sql;
+    } up[] = {
+      { 1, DB_UPDATER_FROM_1_TO_2_A },
+      { 1, DB_UPDATER_FROM_1_TO_2_B },
+      { 2, DB_UPDATER_FROM_2_TO_3   },
+      { 3, DB_UPDATER_FROM_3_TO_4_A },
+      { 3, DB_UPDATER_FROM_3_TO_4_B },
+      { 3, DB_UPDATER_FROM_3_TO_4_C },
+      { 4, DB_UPDATER_FROM_4_TO_5   },
+    };
+    unsigned int i;
 
+    if (ver >= 1)
+    {
       vh_log (VALHALLA_MSG_WARNING,
               "Upgrade the database from the version %i to the version %i",
               ver, LIBVALHALLA_DB_VERSION);
 
       for (i = 0; i < ARRAY_NB_ELEMENTS (up) && !err; i++)
-        database_sql_exec (database->db, up[i], NULL, &err);
+        if (up[i].from >= ver)
+          database_sql_exec (database->db, up[i].sql, NULL, &err);
 
       if (!err)
       {
@@ -27,6 +27,18 @@
 
 typedef struct database_s database_t;
 
+typedef struct database_spill_s {
+  int     action;
+  char   *path;
+  int64_t mtime;
+  int64_t size;
+  int64_t dev;
+  int64_t ino;
+  int64_t hash;
+  int     flag;
+  int     priority;
+} database_spill_t;
+
 void vh_database_file_insert (database_t *database, file_data_t *data);
 void vh_database_file_data_update (database_t *database, file_data_t *data);
 void vh_database_file_delete (database_t *database, const char *file);
@@ -35,6 +47,14 @@ void vh_database_file_grab_insert (database_t *database, file_data_t *data);
 void vh_database_file_grab_update (database_t *database, file_data_t *data);
 void vh_database_file_grab_delete (database_t *database, const char *file);
 int64_t vh_database_file_get_mtime (database_t *db, const char *file);
+int vh_database_file_get_state (database_t *database, const char *file,
+                                int64_t *mtime, int *interrupted);
+void vh_database_file_identity (database_t *database, file_data_t *data);
+int vh_database_file_duplicate (database_t *database, file_data_t *data);
+const char *vh_database_file_get_size (database_t *database,
+                                       int64_t size, int64_t *sign, int rst);
+void vh_database_file_move (database_t *database,
+                            const char *from, file_data_t *data);
 void vh_database_file_get_grabber (database_t *database,
                                    const char *file, list_t *l);
 void vh_database_file_insert_dlcontext (database_t *database,
@@ -47,10 +67,33 @@ void vh_database_file_interrupted_clear (database_t *database,
                                          const char *file);
 void vh_database_file_interrupted_fix (database_t *database);
 int vh_database_file_get_interrupted (database_t *database, const char *file);
+const char *vh_database_file_get_interrupted_set (database_t *database,
+                                                  int rst);
 
 void vh_database_file_checked_clear (database_t *database);
 const char *vh_database_file_get_checked_clear (database_t *database, int rst);
 const char *vh_database_file_get_outofpath_set (database_t *database, int rst);
+const char *vh_database_file_get_offline_set (database_t *database, int rst);
+void vh_database_file_offline (database_t *database,
+                               const char *file, int offline);
+const char *vh_database_file_get_tree (database_t *database,
+                                       const char *path, int rst);
+
+const char *vh_database_directory_get (database_t *database,
+                                       int64_t *mtime, int64_t *hash, int rst);
+void vh_database_directory_insert (database_t *database,
+                                   const char *path,
+                                   int64_t mtime, int64_t hash);
+void vh_database_directory_unchanged (database_t *database, const char *path);
+void vh_database_directory_checked_clear (database_t *database);
+void vh_database_directory_cleanup (database_t *database);
+
+int vh_database_spill_insert (database_t *database,
+                              const database_spill_t *spill);
+int vh_database_spill_get (database_t *database, database_spill_t *spill);
+
+char *vh_database_checkpoint_get (database_t *database);
+void vh_database_checkpoint_set (database_t *database, const char *value);
 
 void vh_database_begin_transaction (database_t *database);
 void vh_database_end_transaction (database_t *database);
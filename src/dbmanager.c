@@ -22,8 +22,10 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "valhalla.h"
 #include "valhalla_internals.h"
@@ -36,9 +38,26 @@
 #include "scanner.h"
 #include "dbmanager.h"
 #include "dispatcher.h"
+#include "ondemand.h"
+
+#ifdef USE_GRABBER
+#include "grabber.h"
+#endif /* USE_GRABBER */
 
 #define VH_HANDLE dbmanager->valhalla
 
+/* Max number of entries popped at once. */
+#define DBMANAGER_BATCH 32
+
+/* Initial size of the set of the files in flight (power of 2). */
+#define DBMANAGER_FLIGHT_SIZE 256
+
+typedef struct dbmanager_flight_s {
+  struct dbmanager_flight_s *next;
+  const file_data_t *pdata;
+  uint32_t hash;
+} dbmanager_flight_t;
+
 struct dbmanager_s {
   valhalla_t   *valhalla;
   pthread_t     thread;
@@ -53,12 +72,29 @@ struct dbmanager_s {
 
   database_t   *database;
   unsigned int  commit_int;
+  int           commit_last; /* changes at the last COMMIT */
+
+  /* entries popped but not yet handled */
+  fifo_queue_entry_t batch[DBMANAGER_BATCH];
+  unsigned int  batch_nb;
+  unsigned int  batch_pos;
+
+  int           spill;    /* spill-to-disk mode */
+  unsigned int  spilled;  /* entries in the spill table */
+
+  /* files sent to the dispatcher and not yet ended (dbmanager thread) */
+  dbmanager_flight_t **flight;
+  unsigned int         flight_size;
+  unsigned int         flight_nb;
 
   vh_stats_cnt_t *st_insert;
   vh_stats_cnt_t *st_update;
   vh_stats_cnt_t *st_delete;
   vh_stats_cnt_t *st_nochange;
+  vh_stats_cnt_t *st_duplicate;
+  vh_stats_cnt_t *st_move;
   vh_stats_cnt_t *st_cleanup;
+  vh_stats_cnt_t *st_spill;
 };
 
 #define STATS_GROUP     "dbmanager"
@@ -66,7 +102,10 @@ struct dbmanager_s {
 #define STATS_UPDATE    "update"
 #define STATS_DELETE    "delete"
 #define STATS_NOCHANGE  "nochange"
+#define STATS_DUP       "duplicate"
+#define STATS_MOVE      "move"
 #define STATS_CLEANUP   "cleanup"
+#define STATS_SPILL     "spill"
 
 
 static inline int
@@ -96,6 +135,564 @@ vh_dbmanager_extmd_free (dbmanager_extmd_t *extmd)
   free (extmd);
 }
 
+void
+vh_dbmanager_files_free (dbmanager_files_t *files)
+{
+  unsigned int i;
+
+  if (!files)
+    return;
+
+  for (i = 0; i < files->nb; i++)
+    vh_file_data_free (files->files[i]);
+  free (files);
+}
+
+void
+vh_dbmanager_dir_free (dbmanager_dir_t *dir)
+{
+  if (!dir)
+    return;
+
+  if (dir->path)
+    free (dir->path);
+  free (dir);
+}
+
+/*
+ * A new file can be an old file which is moved or renamed. The entries not
+ * yet found with this loop and with the same size are compared with the
+ * signature of the new file. Only the missing files are considered, not
+ * the files in an unreachable path.
+ */
+static int
+dbmanager_move (dbmanager_t *dbmanager, file_data_t *pdata)
+{
+  int rst = 0, done = 0;
+  int64_t sign = 0;
+  char *from = NULL;
+  const char *file;
+
+  if (pdata->file.size <= 0)
+    return -1;
+
+  for (file = vh_database_file_get_size (dbmanager->database,
+                                         pdata->file.size, &sign, 0);
+       file;
+       file = vh_database_file_get_size (dbmanager->database, 0, &sign, rst))
+  {
+    if (!access (file, F_OK)
+        || vh_scanner_path_offline (VH_HANDLE->scanner, file))
+      continue;
+
+    /* the new file is read only if at least one file is a candidate */
+    if (!done)
+    {
+      pdata->sign = vh_file_signature (pdata->file.path, pdata->file.size);
+      done = 1;
+    }
+
+    if (pdata->sign && pdata->sign == sign)
+    {
+      from = strdup (file);
+      rst = 1;
+    }
+  }
+
+  if (!from)
+    return -1;
+
+  vh_log (VALHALLA_MSG_INFO, "[%s] Moved file : %s -> %s",
+          __FUNCTION__, from, pdata->file.path);
+  vh_database_file_move (dbmanager->database, from, pdata);
+  free (from);
+  return 0;
+}
+
+/*
+ * Set of the files in flight, from their dispatch by dbmanager_newfile()
+ * to their ACTION_DB_END. The entries are the file_data_t in flight.
+ */
+static uint32_t
+dbmanager_flight_hash (const char *path)
+{
+  uint32_t hash = 2166136261U; /* FNV-1a */
+
+  for (; *path; path++)
+    hash = (hash ^ (unsigned char) *path) * 16777619U;
+  return hash;
+}
+
+static const file_data_t *
+dbmanager_flight_get (dbmanager_t *dbmanager, const char *path)
+{
+  uint32_t hash;
+  dbmanager_flight_t *it;
+
+  if (!dbmanager->flight_nb)
+    return NULL;
+
+  hash = dbmanager_flight_hash (path);
+  for (it = dbmanager->flight[hash & (dbmanager->flight_size - 1)];
+       it; it = it->next)
+    if (it->hash == hash && !strcmp (it->pdata->file.path, path))
+      return it->pdata;
+
+  return NULL;
+}
+
+static void
+dbmanager_flight_add (dbmanager_t *dbmanager, const file_data_t *pdata)
+{
+  uint32_t i;
+  dbmanager_flight_t *it;
+
+  /* grow with the number of files, else the chains are only longer */
+  if (dbmanager->flight_nb >= dbmanager->flight_size)
+  {
+    unsigned int size = dbmanager->flight_size
+                        ? 2 * dbmanager->flight_size : DBMANAGER_FLIGHT_SIZE;
+    dbmanager_flight_t **flight = calloc (size, sizeof (*flight));
+
+    if (flight)
+    {
+      for (i = 0; i < dbmanager->flight_size; i++)
+        while ((it = dbmanager->flight[i]))
+        {
+          dbmanager->flight[i] = it->next;
+          it->next = flight[it->hash & (size - 1)];
+          flight[it->hash & (size - 1)] = it;
+        }
+
+      free (dbmanager->flight);
+      dbmanager->flight      = flight;
+      dbmanager->flight_size = size;
+    }
+    else if (!dbmanager->flight_size)
+      return;
+  }
+
+  it = calloc (1, sizeof (dbmanager_flight_t));
+  if (!it)
+    return;
+
+  it->pdata = pdata;
+  it->hash  = dbmanager_flight_hash (pdata->file.path);
+  i = it->hash & (dbmanager->flight_size - 1);
+  it->next = dbmanager->flight[i];
+  dbmanager->flight[i] = it;
+  dbmanager->flight_nb++;
+}
+
+static void
+dbmanager_flight_del (dbmanager_t *dbmanager, const file_data_t *pdata)
+{
+  dbmanager_flight_t *it, **prev;
+
+  if (!dbmanager->flight_nb)
+    return;
+
+  prev = &dbmanager->flight[dbmanager_flight_hash (pdata->file.path)
+                            & (dbmanager->flight_size - 1)];
+  for (it = *prev; it; prev = &it->next, it = it->next)
+    if (it->pdata == pdata)
+    {
+      *prev = it->next;
+      free (it);
+      dbmanager->flight_nb--;
+      return;
+    }
+}
+
+static void
+dbmanager_flight_free (dbmanager_t *dbmanager)
+{
+  unsigned int i;
+  dbmanager_flight_t *it;
+
+  for (i = 0; i < dbmanager->flight_size; i++)
+    while ((it = dbmanager->flight[i]))
+    {
+      dbmanager->flight[i] = it->next;
+      free (it);
+    }
+
+  free (dbmanager->flight);
+  dbmanager->flight      = NULL;
+  dbmanager->flight_size = 0;
+  dbmanager->flight_nb   = 0;
+}
+
+/*
+ * Handle a new file from the scanner (or the ondemand). It returns 1 when
+ * the file is sent to the dispatcher, or 0 if the file is unchanged.
+ */
+static int
+dbmanager_newfile (dbmanager_t *dbmanager, file_data_t *pdata)
+{
+  int interrup = 0;
+  int64_t mtime;
+  const file_data_t *flight;
+
+  /* maybe requested by the ondemand while it was in the queue */
+  vh_ondemand_express (VH_HANDLE->ondemand, pdata);
+
+  /*
+   * The same file is already handled by a stage (an ondemand query while
+   * the file is not in a queue, or an event of the watch mode). This copy
+   * is dropped, the file in flight is in the express lane if necessary and
+   * its ACTION_DB_END ends the ondemand query.
+   */
+  flight = dbmanager_flight_get (dbmanager, pdata->file.path);
+  if (flight && flight->file.mtime == pdata->file.mtime)
+  {
+    vh_log (VALHALLA_MSG_VERBOSE,
+            "[%s] File in flight : %s", __FUNCTION__, pdata->file.path);
+    return 0;
+  }
+
+  mtime = vh_database_file_get_mtime (dbmanager->database, pdata->file.path);
+
+  /*
+   * The metadata, the grabbers and the download contexts are kept with the
+   * entry of a moved file. It is handled like an unchanged file.
+   */
+  if (mtime < 0 && !dbmanager_move (dbmanager, pdata))
+  {
+    VH_STATS_COUNTER_INC (dbmanager->st_move);
+    mtime = pdata->file.mtime;
+  }
+
+  /*
+   * File is parsed only if mtime has changed, if the grabbing/downloading
+   * was interrupted or if it is unexistant in the database.
+   *
+   * 'interrup' takes three possible values.
+   *   0: the file is fully handled (set by ACTION_DB_END).
+   *  -1: the file is only inserted in the DB (set by ACTION_DB_NEWFILE),
+   *      but the data provided by the parser are not available. This
+   *      state is only useful in the case where an ondemand query is
+   *      running for the same file between ACTION_DB_NEWFILE and
+   *      ACTION_DB_INSERT_P.
+   *   1: the data from the parser are in the DB, but the file is not
+   *      fully handled by the grabbers and the downloader (set by
+   *      ACTION_DB_INSERT_P/UPDATE_P).
+   */
+  if (mtime >= 0)
+  {
+    interrup =
+      vh_database_file_get_interrupted (dbmanager->database,
+                                        pdata->file.path);
+    /*
+     * Retrieve the list of all grabbers already handled for this file
+     * and search if there are files to download since the interruption.
+     * But if mtime has changed, the file must be _fully_ updated.
+     */
+    if (interrup == 1 && pdata->file.mtime == mtime)
+    {
+      vh_database_file_get_grabber (dbmanager->database,
+                                    pdata->file.path, pdata->grabber_list);
+      vh_database_file_get_dlcontext (dbmanager->database, pdata->file.path,
+                                      &pdata->list_downloader);
+    }
+    /*
+     * Delete all previous associations on the file because the main
+     * metadata have changed.
+     */
+    else if (pdata->file.mtime != mtime)
+    {
+      vh_database_file_data_delete (dbmanager->database, pdata->file.path);
+      vh_database_file_grab_delete (dbmanager->database, pdata->file.path);
+    }
+
+    if (pdata->file.mtime == mtime)
+      vh_database_file_identity (dbmanager->database, pdata);
+  }
+  else
+  {
+    vh_database_file_insert (dbmanager->database, pdata);
+    VH_STATS_COUNTER_INC (dbmanager->st_insert);
+  }
+
+  /*
+   * The same file can be reachable with several paths (hard links, bind
+   * mounts, ...). The metadata are copied from the file already handled
+   * instead of parsing and grabbing the file again.
+   */
+  if ((mtime < 0 || pdata->file.mtime != mtime)
+      && !vh_database_file_duplicate (dbmanager->database, pdata))
+  {
+    vh_log (VALHALLA_MSG_VERBOSE,
+            "[%s] Duplicate file : %s", __FUNCTION__, pdata->file.path);
+    VH_STATS_COUNTER_INC (dbmanager->st_duplicate);
+    goto out;
+  }
+
+  if (mtime < 0 || pdata->file.mtime != mtime || interrup == 1)
+  {
+    int act = mtime < 0 ? ACTION_DB_INSERT_P : ACTION_DB_UPDATE_P;
+    dbmanager_flight_add (dbmanager, pdata);
+    vh_dispatcher_action_send_wait (VH_HANDLE->dispatcher,
+                                    pdata->priority, act, pdata);
+    return 1;
+  }
+
+  VH_STATS_COUNTER_INC (dbmanager->st_nochange);
+ out:
+  if (pdata->od != OD_TYPE_DEF)
+  {
+    vh_ondemand_express_end (VH_HANDLE->ondemand, pdata->file.path);
+    vh_event_handler_od_send (VH_HANDLE->event_handler,
+                              pdata->file.path,
+                              VALHALLA_EVENTOD_ENDED, NULL, NULL);
+  }
+  return 0;
+}
+
+/*
+ * Spill-to-disk mode. When the queue of the dispatcher is full, the entries
+ * from the scanner are saved in a temporary table instead of waiting. Then
+ * all next entries from the scanner are saved in this table too, in order
+ * to keep the order of the scan (directories and checkpoints after their
+ * files). ACTION_DB_SPILL is queued in order to retrieve the entries one
+ * by one.
+ */
+static int
+dbmanager_spill_insert (dbmanager_t *dbmanager, database_spill_t *spill)
+{
+  if (vh_database_spill_insert (dbmanager->database, spill))
+    return -1;
+
+  /* only one ACTION_DB_SPILL is queued at the same time */
+  if (!dbmanager->spilled++)
+    vh_fifo_queue_push (dbmanager->fifo,
+                        FIFO_QUEUE_PRIORITY_NORMAL, ACTION_DB_SPILL, NULL);
+  VH_STATS_COUNTER_INC (dbmanager->st_spill);
+  return 0;
+}
+
+static void
+dbmanager_spill_file (database_spill_t *spill, file_data_t *pdata)
+{
+  memset (spill, 0, sizeof (*spill));
+  spill->action = ACTION_DB_NEWFILE;
+  spill->path   = (char *) pdata->file.path;
+  spill->mtime  = pdata->file.mtime;
+  spill->size   = pdata->file.size;
+  spill->dev    = pdata->dev;
+  spill->ino    = pdata->ino;
+  spill->flag   = pdata->outofpath;
+  spill->priority = pdata->priority;
+}
+
+/*
+ * Save an entry from the scanner in the spill table. It returns 1 if the
+ * entry is saved (then it is freed), or 0 if it must be handled now.
+ */
+static int
+dbmanager_spill (dbmanager_t *dbmanager, int e, void *data)
+{
+  database_spill_t spill;
+
+  if (!dbmanager->spill)
+    return 0;
+
+  switch (e)
+  {
+  case ACTION_DB_NEWFILE:
+    /* the entries from the ondemand are never delayed */
+    if (!data || ((file_data_t *) data)->od != OD_TYPE_DEF)
+      return 0;
+    /* fall through */
+  case ACTION_DB_NEWFILES:
+  case ACTION_DB_NEXT_LOOP:
+  case ACTION_DB_DELFILE:
+  case ACTION_DB_DIRECTORY:
+  case ACTION_DB_CHECKPOINT:
+    break;
+
+  default:
+    return 0;
+  }
+
+  if (!dbmanager->spilled
+      && !vh_fifo_queue_full (vh_dispatcher_fifo_get (VH_HANDLE->dispatcher)))
+    return 0;
+
+  switch (e)
+  {
+  case ACTION_DB_NEWFILE:
+    dbmanager_spill_file (&spill, data);
+    if (dbmanager_spill_insert (dbmanager, &spill))
+      return 0;
+    vh_file_data_free (data);
+    return 1;
+
+  case ACTION_DB_NEWFILES:
+  {
+    unsigned int i, acks = 0;
+    dbmanager_files_t *files = data;
+
+    if (!files)
+      return 0;
+
+    /* a file is lost for this loop if it can not be saved */
+    for (i = 0; i < files->nb; i++)
+    {
+      dbmanager_spill_file (&spill, files->files[i]);
+      if (dbmanager_spill_insert (dbmanager, &spill))
+        acks++;
+    }
+
+    vh_dbmanager_files_free (files);
+    if (acks)
+      vh_scanner_acknowledge (VH_HANDLE->scanner, acks);
+    return 1;
+  }
+
+  case ACTION_DB_DIRECTORY:
+  {
+    dbmanager_dir_t *dir = data;
+
+    if (!dir)
+      return 0;
+
+    memset (&spill, 0, sizeof (spill));
+    spill.action = e;
+    spill.path   = dir->path;
+    spill.mtime  = dir->mtime;
+    spill.hash   = dir->hash;
+    spill.flag   = dir->unchanged;
+    if (dbmanager_spill_insert (dbmanager, &spill))
+      return 0;
+    vh_dbmanager_dir_free (dir);
+    return 1;
+  }
+
+  default: /* NEXT_LOOP, DELFILE and CHECKPOINT */
+    memset (&spill, 0, sizeof (spill));
+    spill.action = e;
+    spill.path   = data;
+    if (dbmanager_spill_insert (dbmanager, &spill))
+      return 0;
+    if (data)
+      free (data);
+    return 1;
+  }
+}
+
+/*
+ * Retrieve the oldest entry of the spill table. It returns 0 if the entry
+ * can be handled like an entry of the queue.
+ */
+static int
+dbmanager_spill_get (dbmanager_t *dbmanager, int *e, void **data)
+{
+  int res;
+  database_spill_t spill;
+
+  if (!dbmanager->spilled)
+    return -1;
+
+  res = vh_database_spill_get (dbmanager->database, &spill);
+  if (res)
+  {
+    dbmanager->spilled = 0; /* the table is empty or broken */
+    return -1;
+  }
+
+  if (--dbmanager->spilled)
+    vh_fifo_queue_push (dbmanager->fifo,
+                        FIFO_QUEUE_PRIORITY_NORMAL, ACTION_DB_SPILL, NULL);
+
+  *e    = spill.action;
+  *data = spill.path;
+
+  switch (spill.action)
+  {
+  case ACTION_DB_NEWFILE:
+  {
+    struct stat st;
+    file_data_t *pdata;
+    fifo_queue_prio_t prio = FIFO_QUEUE_PRIORITY_NORMAL;
+
+    /* keep the priority given by the scanner (recent files, hints) */
+    if (spill.priority > FIFO_QUEUE_PRIORITY_NORMAL
+        && spill.priority <= FIFO_QUEUE_PRIORITY_HIGH)
+      prio = spill.priority;
+
+    memset (&st, 0, sizeof (st));
+    st.st_mtime = (time_t) spill.mtime;
+    st.st_size  = (off_t)  spill.size;
+    st.st_dev   = (dev_t)  spill.dev;
+    st.st_ino   = (ino_t)  spill.ino;
+
+    pdata = spill.path ? vh_file_data_new (spill.path, &st, spill.flag,
+                                           OD_TYPE_DEF, prio, STEP_PARSING)
+                       : NULL;
+    if (spill.path)
+      free (spill.path);
+    *data = pdata;
+    break;
+  }
+
+  case ACTION_DB_DIRECTORY:
+  {
+    dbmanager_dir_t *dir = calloc (1, sizeof (dbmanager_dir_t));
+
+    if (dir)
+    {
+      dir->path      = spill.path;
+      dir->mtime     = spill.mtime;
+      dir->hash      = spill.hash;
+      dir->unchanged = spill.flag;
+    }
+    else if (spill.path)
+      free (spill.path);
+    *data = dir;
+    break;
+  }
+
+  default:
+    return 0;
+  }
+
+  if (*data)
+    return 0;
+
+  vh_scanner_acknowledge (VH_HANDLE->scanner, 1);
+  return -1;
+}
+
+static int
+dbmanager_changes (dbmanager_t *dbmanager, int grab)
+{
+  int changes;
+
+  changes  = (int) vh_stats_counter_read (dbmanager->st_insert);
+  changes += (int) vh_stats_counter_read (dbmanager->st_update);
+  changes += grab;
+  return changes;
+}
+
+/*
+ * The transaction is committed when at least commit_int changes are done
+ * since the previous COMMIT, because the changes are increased by a whole
+ * batch between two steps.
+ */
+static void
+dbmanager_step_transaction (dbmanager_t *dbmanager, int grab)
+{
+  int changes = dbmanager_changes (dbmanager, grab);
+
+  if (changes - dbmanager->commit_last < (int) dbmanager->commit_int)
+    return;
+
+  dbmanager->commit_last = changes;
+  vh_database_end_transaction (dbmanager->database);
+  vh_database_begin_transaction (dbmanager->database);
+}
+
 static int
 dbmanager_queue (dbmanager_t *dbmanager)
 {
@@ -105,19 +702,47 @@ dbmanager_queue (dbmanager_t *dbmanager)
   void *data = NULL;
   file_data_t *pdata;
 
+  dbmanager->commit_last = dbmanager_changes (dbmanager, grab);
+
   do
   {
-    int interval;
-    e = ACTION_NO_OPERATION;
-    data = NULL;
+    /*
+     * The entries are popped by batches (the remaining entries are kept for
+     * the next call after ACTION_DB_NEXT_LOOP). The transaction is stepped
+     * only between two batches.
+     */
+    if (dbmanager->batch_pos == dbmanager->batch_nb)
+    {
+      res = vh_fifo_queue_pop_many (dbmanager->fifo,
+                                    DBMANAGER_BATCH, dbmanager->batch);
+      dbmanager->batch_nb  = res > 0 ? (unsigned int) res : 0;
+      dbmanager->batch_pos = 0;
+      if (res <= 0)
+        continue;
+
+      /* Manage BEGIN / COMMIT transactions */
+      dbmanager_step_transaction (dbmanager, grab);
+    }
 
-    res = vh_fifo_queue_pop (dbmanager->fifo, &e, &data);
-    if (res || e == ACTION_NO_OPERATION)
+    e    = dbmanager->batch[dbmanager->batch_pos].id;
+    data = dbmanager->batch[dbmanager->batch_pos].data;
+    dbmanager->batch_pos++;
+
+    if (e == ACTION_NO_OPERATION)
       continue;
 
     if (e == ACTION_KILL_THREAD)
       goto out;
 
+    if (e == ACTION_DB_SPILL)
+    {
+      /* the spilled entry is handled like the original entry */
+      if (dbmanager_spill_get (dbmanager, &e, &data))
+        continue;
+    }
+    else if (dbmanager_spill (dbmanager, e, data))
+      continue;
+
     if (e == ACTION_DB_NEXT_LOOP)
     {
       vh_dispatcher_action_send (VH_HANDLE->dispatcher,
@@ -188,13 +813,6 @@ dbmanager_queue (dbmanager_t *dbmanager)
     }
     }
 
-    /* Manage BEGIN / COMMIT transactions */
-    interval  = (int) vh_stats_counter_read (dbmanager->st_insert);
-    interval += (int) vh_stats_counter_read (dbmanager->st_update);
-    interval += grab;
-    vh_database_step_transaction (dbmanager->database,
-                                  dbmanager->commit_int, interval);
-
     pdata = data;
 
     switch (e)
@@ -208,12 +826,17 @@ dbmanager_queue (dbmanager_t *dbmanager)
 
     /* received from the dispatcher */
     case ACTION_DB_END:
+      dbmanager_flight_del (dbmanager, pdata);
       vh_database_file_interrupted_clear (dbmanager->database,
                                           pdata->file.path);
+      vh_ondemand_express (VH_HANDLE->ondemand, pdata);
       if (pdata->od != OD_TYPE_DEF)
+      {
+        vh_ondemand_express_end (VH_HANDLE->ondemand, pdata->file.path);
         vh_event_handler_od_send (VH_HANDLE->event_handler,
                                   pdata->file.path,
                                   VALHALLA_EVENTOD_ENDED, NULL, NULL);
+      }
       break;
 
     /* received from the dispatcher (grabbed data) */
@@ -241,7 +864,22 @@ dbmanager_queue (dbmanager_t *dbmanager)
       pdata->meta_grabber = NULL;
 
       if (pdata->wait)
-        sem_post (&pdata->sem_grabber);
+      {
+#ifdef USE_GRABBER
+        /*
+         * A task of the pool must never wait on the dbmanager, the file is
+         * sent to the grabber only now (see dispatcher_thread).
+         */
+        if (VH_HANDLE->executor)
+        {
+          pdata->wait = 0;
+          vh_grabber_action_send (VH_HANDLE->grabber, pdata->priority,
+                                  e, pdata);
+        }
+        else
+#endif /* USE_GRABBER */
+          sem_post (&pdata->sem_grabber);
+      }
 
       grab++;
       continue;
@@ -262,81 +900,115 @@ dbmanager_queue (dbmanager_t *dbmanager)
                                 &pdata->file, pdata->meta_parser);
       continue;
 
-    /* received from the scanner */
-    case ACTION_DB_NEWFILE:
+    /* received from the scanner (watch mode) */
+    case ACTION_DB_DELFILE:
     {
-      int interrup = 0;
-      int64_t mtime =
-        vh_database_file_get_mtime (dbmanager->database, pdata->file.path);
+      const char *file;
+      char *path = data;
+      int rst = 0, del = 0;
+
+      if (!path)
+        continue;
+
       /*
-       * File is parsed only if mtime has changed, if the grabbing/downloading
-       * was interrupted or if it is unexistant in the database.
-       *
-       * 'interrup' takes three possible values.
-       *   0: the file is fully handled (set by ACTION_DB_END).
-       *  -1: the file is only inserted in the DB (set by ACTION_DB_NEWFILE),
-       *      but the data provided by the parser are not available. This
-       *      state is only useful in the case where an ondemand query is
-       *      running for the same file between ACTION_DB_NEWFILE and
-       *      ACTION_DB_INSERT_P.
-       *   1: the data from the parser are in the DB, but the file is not
-       *      fully handled by the grabbers and the downloader (set by
-       *      ACTION_DB_INSERT_P/UPDATE_P).
+       * The path can be a file or a directory. Only the entries which are
+       * really no longer valid are deleted, because the same path can be
+       * created again between the event and this check.
        */
-      if (mtime >= 0)
+      for (file = vh_database_file_get_tree (dbmanager->database, path, 0);
+           file;
+           file = vh_database_file_get_tree (dbmanager->database, NULL, rst))
       {
-        interrup =
-          vh_database_file_get_interrupted (dbmanager->database,
-                                            pdata->file.path);
-        /*
-         * Retrieve the list of all grabbers already handled for this file
-         * and search if there are files to download since the interruption.
-         * But if mtime has changed, the file must be _fully_ updated.
-         */
-        if (interrup == 1 && pdata->file.mtime == mtime)
-        {
-          vh_database_file_get_grabber (dbmanager->database,
-                                        pdata->file.path, pdata->grabber_list);
-          vh_database_file_get_dlcontext (dbmanager->database, pdata->file.path,
-                                          &pdata->list_downloader);
-        }
-        /*
-         * Delete all previous associations on the file because the main
-         * metadata have changed.
-         */
-        else if (pdata->file.mtime != mtime)
+        if (dbmanager_is_stopped (dbmanager))
+          rst = 1;
+        else if (vh_scanner_path_cmp (VH_HANDLE->scanner, file)
+                 || vh_scanner_suffix_cmp (VH_HANDLE->scanner, file)
+                 || access (file, R_OK))
         {
-          vh_database_file_data_delete (dbmanager->database, pdata->file.path);
-          vh_database_file_grab_delete (dbmanager->database, pdata->file.path);
+          vh_database_file_delete (dbmanager->database, file);
+          del++;
         }
       }
-      else
+
+      if (del)
       {
-        vh_database_file_insert (dbmanager->database, pdata);
-        VH_STATS_COUNTER_INC (dbmanager->st_insert);
+        int val = vh_database_cleanup (dbmanager->database);
+        if (val > 0)
+          VH_STATS_COUNTER_ACC (dbmanager->st_cleanup, (uint64_t) val);
+        VH_STATS_COUNTER_ACC (dbmanager->st_delete, (unsigned) del);
       }
 
-      if (mtime < 0 || pdata->file.mtime != mtime || interrup == 1)
-      {
-        int act = mtime < 0 ? ACTION_DB_INSERT_P : ACTION_DB_UPDATE_P;
-        vh_dispatcher_action_send (VH_HANDLE->dispatcher,
-                                   pdata->priority, act, pdata);
+      free (path);
+      continue;
+    }
+
+    /* received from the scanner (directories pruning) */
+    case ACTION_DB_DIRECTORY:
+    {
+      dbmanager_dir_t *dir = data;
+
+      if (!dir)
         continue;
+
+      if (dir->unchanged)
+        vh_database_directory_unchanged (dbmanager->database, dir->path);
+      else
+        vh_database_directory_insert (dbmanager->database,
+                                      dir->path, dir->mtime, dir->hash);
+      vh_dbmanager_dir_free (dir);
+
+      vh_scanner_acknowledge (VH_HANDLE->scanner, 1);
+      continue;
+    }
+
+    /*
+     * received from the scanner (position in the scan). All files of the
+     * directories before this position are already handled here because
+     * the scanner sends the checkpoint after them in the same queue.
+     */
+    case ACTION_DB_CHECKPOINT:
+      vh_database_checkpoint_set (dbmanager->database, data);
+      if (data)
+        free (data);
+      continue;
+
+    /* received from the scanner */
+    case ACTION_DB_NEWFILE:
+      if (dbmanager_newfile (dbmanager, pdata))
+        continue;
+      break;
+
+    /* received from the scanner (files of a directory) */
+    case ACTION_DB_NEWFILES:
+    {
+      unsigned int i, acks = 0;
+      dbmanager_files_t *files = data;
+
+      if (!files)
+        continue;
+
+      for (i = 0; i < files->nb; i++)
+      {
+        if (i)
+          dbmanager_step_transaction (dbmanager, grab);
+
+        if (dbmanager_newfile (dbmanager, files->files[i]))
+          continue;
+
+        vh_file_data_free (files->files[i]);
+        acks++;
       }
 
-      if (pdata->od != OD_TYPE_DEF)
-        vh_event_handler_od_send (VH_HANDLE->event_handler,
-                                  pdata->file.path,
-                                  VALHALLA_EVENTOD_ENDED, NULL, NULL);
-      VH_STATS_COUNTER_INC (dbmanager->st_nochange);
+      free (files);
+      if (acks)
+        vh_scanner_acknowledge (VH_HANDLE->scanner, acks);
+      continue;
     }
     }
 
     /* Must not come from "On-demand" */
     if (pdata->od == OD_TYPE_DEF || pdata->od == OD_TYPE_UPD)
-      vh_scanner_action_send (VH_HANDLE->scanner,
-                              FIFO_QUEUE_PRIORITY_NORMAL,
-                              ACTION_ACKNOWLEDGE, NULL);
+      vh_scanner_acknowledge (VH_HANDLE->scanner, 1);
     vh_file_data_free (pdata);
   }
   while (!dbmanager_is_stopped (dbmanager));
@@ -379,8 +1051,9 @@ dbmanager_thread (void *arg)
 
     vh_log (VALHALLA_MSG_INFO, "[%s] Begin loop %i", __FUNCTION__, loop);
 
-    /* Clear all checked__ files */
+    /* Clear all checked__ files and directories */
     vh_database_file_checked_clear (dbmanager->database);
+    vh_database_directory_checked_clear (dbmanager->database);
 
     vh_database_begin_transaction (dbmanager->database);
     rc = dbmanager_queue (dbmanager);
@@ -388,7 +1061,8 @@ dbmanager_thread (void *arg)
 
     /*
      * Get all files that have checked__ to 0 and verify if the file is valid.
-     * The entry is deleted otherwise.
+     * The entry is deleted otherwise, or marked offline when the path of the
+     * scanner is unreachable.
      */
     vh_database_begin_transaction (dbmanager->database);
     while ((file =
@@ -404,8 +1078,42 @@ dbmanager_thread (void *arg)
         vh_database_step_transaction (dbmanager->database,
                                       dbmanager->commit_int, stats_delete);
 
-        vh_database_file_delete (dbmanager->database, file);
-        stats_delete++;
+        if (vh_scanner_path_offline (VH_HANDLE->scanner, file))
+          vh_database_file_offline (dbmanager->database, file, 1);
+        else
+        {
+          vh_database_file_delete (dbmanager->database, file);
+          stats_delete++;
+        }
+      }
+    }
+
+    /*
+     * Get all files where offline__ is set to 1. The files are available
+     * again when the path is reachable (unchanged files are not parsed a
+     * second time). The entry is deleted if the file is no longer valid.
+     */
+    rst = 0;
+    while ((file =
+              vh_database_file_get_offline_set (dbmanager->database, rst)))
+    {
+      if (dbmanager_is_stopped (dbmanager))
+        rst = 1;
+      else if (!vh_scanner_path_offline (VH_HANDLE->scanner, file))
+      {
+        /* Manage BEGIN / COMMIT transactions */
+        vh_database_step_transaction (dbmanager->database,
+                                      dbmanager->commit_int, stats_delete);
+
+        if (vh_scanner_path_cmp (VH_HANDLE->scanner, file)
+            || vh_scanner_suffix_cmp (VH_HANDLE->scanner, file)
+            || access (file, R_OK))
+        {
+          vh_database_file_delete (dbmanager->database, file);
+          stats_delete++;
+        }
+        else
+          vh_database_file_offline (dbmanager->database, file, 0);
       }
     }
 
@@ -433,6 +1141,14 @@ dbmanager_thread (void *arg)
 
     VH_STATS_COUNTER_ACC (dbmanager->st_delete, (unsigned) stats_delete);
 
+    /*
+     * Remove the directories no longer found by the scanner. It is useless
+     * when the loop is interrupted because checked__ is cleared again with
+     * the next loop.
+     */
+    if (rc == ACTION_DB_NEXT_LOOP && !dbmanager_is_stopped (dbmanager))
+      vh_database_directory_cleanup (dbmanager->database);
+
     /* Clean all relations */
     stats_update = vh_stats_counter_read (dbmanager->st_update);
     if (stats_update || stats_delete)
@@ -467,6 +1183,7 @@ vh_dbmanager_run (dbmanager_t *dbmanager, int priority)
 
   pthread_attr_init (&attr);
   pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+  vh_thread_stack_set (&attr, VH_HANDLE->stack_size);
 
   res = pthread_create (&dbmanager->thread, &attr, dbmanager_thread, dbmanager);
   if (res)
@@ -556,6 +1273,7 @@ vh_dbmanager_uninit (dbmanager_t *dbmanager)
     vh_database_uninit (dbmanager->database);
 
   vh_fifo_queue_free (dbmanager->fifo);
+  dbmanager_flight_free (dbmanager);
   pthread_mutex_destroy (&dbmanager->mutex_run);
   VH_THREAD_PAUSE_UNINIT (dbmanager)
 
@@ -582,8 +1300,14 @@ dbmanager_stats_dump (vh_stats_t *stats, void *data)
           vh_stats_counter_read (dbmanager->st_delete));
   vh_log (VALHALLA_MSG_INFO, "Files unchanged   | %"PRIu64,
           vh_stats_counter_read (dbmanager->st_nochange));
+  vh_log (VALHALLA_MSG_INFO, "Files duplicated  | %"PRIu64,
+          vh_stats_counter_read (dbmanager->st_duplicate));
+  vh_log (VALHALLA_MSG_INFO, "Files moved       | %"PRIu64,
+          vh_stats_counter_read (dbmanager->st_move));
   vh_log (VALHALLA_MSG_INFO, "Relations cleaned | %"PRIu64,
           vh_stats_counter_read (dbmanager->st_cleanup));
+  vh_log (VALHALLA_MSG_INFO, "Entries spilled   | %"PRIu64,
+          vh_stats_counter_read (dbmanager->st_spill));
 }
 
 dbmanager_t *
@@ -628,8 +1352,14 @@ vh_dbmanager_init (valhalla_t *handle, const char *db, unsigned int commit_int)
     vh_stats_grp_counter_add (handle->stats, STATS_GROUP, STATS_DELETE,   NULL);
   dbmanager->st_nochange =
     vh_stats_grp_counter_add (handle->stats, STATS_GROUP, STATS_NOCHANGE, NULL);
+  dbmanager->st_duplicate =
+    vh_stats_grp_counter_add (handle->stats, STATS_GROUP, STATS_DUP,      NULL);
+  dbmanager->st_move =
+    vh_stats_grp_counter_add (handle->stats, STATS_GROUP, STATS_MOVE,     NULL);
   dbmanager->st_cleanup =
     vh_stats_grp_counter_add (handle->stats, STATS_GROUP, STATS_CLEANUP,  NULL);
+  dbmanager->st_spill =
+    vh_stats_grp_counter_add (handle->stats, STATS_GROUP, STATS_SPILL,    NULL);
 
   return dbmanager;
 
@@ -638,6 +1368,17 @@ vh_dbmanager_init (valhalla_t *handle, const char *db, unsigned int commit_int)
   return NULL;
 }
 
+void
+vh_dbmanager_spill_set (dbmanager_t *dbmanager, int spill)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return;
+
+  dbmanager->spill = !!spill;
+}
+
 void
 vh_dbmanager_action_send (dbmanager_t *dbmanager,
                           fifo_queue_prio_t prio, int action, void *data)
@@ -650,29 +1391,68 @@ vh_dbmanager_action_send (dbmanager_t *dbmanager,
   vh_fifo_queue_push (dbmanager->fifo, prio, action, data);
 }
 
+void
+vh_dbmanager_action_send_wait (dbmanager_t *dbmanager,
+                               fifo_queue_prio_t prio, int action, void *data)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return;
+
+  vh_fifo_queue_push_wait (dbmanager->fifo, prio, action, data);
+}
+
 int
 vh_dbmanager_file_complete (dbmanager_t *dbmanager,
                             const char *file, int64_t mtime)
 {
-  int res;
+  int complete = 0;
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
-  if (!dbmanager || !file)
+  vh_dbmanager_files_complete (dbmanager, &file, &mtime, &complete, 1);
+  return complete;
+}
+
+/*
+ * Check a set of files with only one query by file (mtime and interrupted
+ * flag together). The NULL entries of \p files are ignored. The ENDED event
+ * is sent for each complete file.
+ */
+unsigned int
+vh_dbmanager_files_complete (dbmanager_t *dbmanager, const char **files,
+                             const int64_t *mtime, int *complete,
+                             unsigned int nb)
+{
+  unsigned int i, cnt = 0;
+
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager || !files || !mtime || !complete)
     return 0;
 
-  res = vh_database_file_get_interrupted (dbmanager->database, file);
-  if (!res)
+  for (i = 0; i < nb; i++)
   {
-    int64_t mt = vh_database_file_get_mtime (dbmanager->database, file);
-    if (mt != mtime)
-      res = 1; /* must be updated */
-    else
-      vh_event_handler_od_send (VH_HANDLE->event_handler,
-                                file, VALHALLA_EVENTOD_ENDED, NULL, NULL);
+    int res, interrup;
+    int64_t mt;
+
+    complete[i] = 0;
+    if (!files[i])
+      continue;
+
+    res = vh_database_file_get_state (dbmanager->database,
+                                      files[i], &mt, &interrup);
+    if (res || interrup || mt != mtime[i])
+      continue; /* must be inserted or updated */
+
+    complete[i] = 1;
+    cnt++;
+    vh_event_handler_od_send (VH_HANDLE->event_handler,
+                              files[i], VALHALLA_EVENTOD_ENDED, NULL, NULL);
   }
 
-  return !res;
+  return cnt;
 }
 
 void
@@ -697,6 +1477,40 @@ vh_dbmanager_db_dlcontext_delete (dbmanager_t *dbmanager)
   vh_database_delete_dlcontext (dbmanager->database);
 }
 
+const char *
+vh_dbmanager_db_directory_get (dbmanager_t *dbmanager,
+                               int64_t *mtime, int64_t *hash, int rst)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager || !mtime || !hash)
+    return NULL;
+
+  return vh_database_directory_get (dbmanager->database, mtime, hash, rst);
+}
+
+char *
+vh_dbmanager_db_checkpoint_get (dbmanager_t *dbmanager)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return NULL;
+
+  return vh_database_checkpoint_get (dbmanager->database);
+}
+
+const char *
+vh_dbmanager_db_interrupted_get (dbmanager_t *dbmanager, int rst)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dbmanager)
+    return NULL;
+
+  return vh_database_file_get_interrupted_set (dbmanager->database, rst);
+}
+
 void
 vh_dbmanager_db_begin_transaction (dbmanager_t *dbmanager)
 {
@@ -41,29 +41,59 @@ typedef struct dbmanager_extmd_s {
   valhalla_metadata_pl_t priority;
 } dbmanager_extmd_t;
 
+#define DBMANAGER_FILES_MAX 256
+
+typedef struct dbmanager_files_s {
+  unsigned int nb;
+  file_data_t *files[DBMANAGER_FILES_MAX];
+} dbmanager_files_t;
+
+typedef struct dbmanager_dir_s {
+  char   *path;
+  int64_t mtime;
+  int64_t hash;
+  int     unchanged;
+} dbmanager_dir_t;
+
 #define DBMANAGER_COMMIT_INTERVAL_DEF 128
 
 
 void vh_dbmanager_extmd_free (dbmanager_extmd_t *extmd);
+void vh_dbmanager_files_free (dbmanager_files_t *files);
+void vh_dbmanager_dir_free (dbmanager_dir_t *dir);
 
 int vh_dbmanager_run (dbmanager_t *dbmanager, int priority);
 void vh_dbmanager_pause (dbmanager_t *dbmanager);
 fifo_queue_t *vh_dbmanager_fifo_get (dbmanager_t *dbmanager);
 void vh_dbmanager_wait (dbmanager_t *dbmanager);
 void vh_dbmanager_stop (dbmanager_t *dbmanager, int f);
+void vh_dbmanager_spill_set (dbmanager_t *dbmanager, int spill);
 void vh_dbmanager_uninit (dbmanager_t *dbmanager);
 dbmanager_t *vh_dbmanager_init (valhalla_t *handle,
                                 const char *db, unsigned int commit_int);
 
 void vh_dbmanager_action_send (dbmanager_t *dbmanager,
                                fifo_queue_prio_t prio, int action, void *data);
+void vh_dbmanager_action_send_wait (dbmanager_t *dbmanager,
+                                    fifo_queue_prio_t prio,
+                                    int action, void *data);
 
 int vh_dbmanager_file_complete (dbmanager_t *dbmanager,
                                 const char *file, int64_t mtime);
+unsigned int vh_dbmanager_files_complete (dbmanager_t *dbmanager,
+                                          const char **files,
+                                          const int64_t *mtime, int *complete,
+                                          unsigned int nb);
 
 void vh_dbmanager_db_dlcontext_save (dbmanager_t *dbmanager, file_data_t *data);
 void vh_dbmanager_db_dlcontext_delete (dbmanager_t *dbmanager);
 
+const char *vh_dbmanager_db_directory_get (dbmanager_t *dbmanager,
+                                           int64_t *mtime, int64_t *hash,
+                                           int rst);
+char *vh_dbmanager_db_checkpoint_get (dbmanager_t *dbmanager);
+const char *vh_dbmanager_db_interrupted_get (dbmanager_t *dbmanager, int rst);
+
 void vh_dbmanager_db_begin_transaction (dbmanager_t *dbmanager);
 void vh_dbmanager_db_end_transaction (dbmanager_t *dbmanager);
 
@@ -33,6 +33,7 @@
 #include "parser.h"
 #include "dbmanager.h"
 #include "dispatcher.h"
+#include "ondemand.h"
 
 #ifdef USE_GRABBER
 #include "grabber.h"
@@ -78,7 +79,7 @@ dispatcher_thread (void *arg)
     void *handler;
     void (*fct) (void *handler, fifo_queue_prio_t prio, int action, void *data);
   } send[] = {
-    [STEP_PARSING]      = { NULL, (void *) vh_parser_action_send     },
+    [STEP_PARSING]      = { NULL, (void *) vh_parser_action_send_wait },
 #ifdef USE_GRABBER
     [STEP_GRABBING]     = { NULL, (void *) vh_grabber_action_send    },
     [STEP_DOWNLOADING]  = { NULL, (void *) vh_downloader_action_send },
@@ -137,6 +138,9 @@ dispatcher_thread (void *arg)
     {
       processing_step_t step = pdata->step;
 
+      /* maybe requested by the ondemand while it was in the queue */
+      vh_ondemand_express (VH_HANDLE->ondemand, pdata);
+
       vh_log (VALHALLA_MSG_VERBOSE,
               "[%s] step: %i, file: \"%s\"",
               __FUNCTION__, step, pdata->file.path);
@@ -170,6 +174,8 @@ dispatcher_thread (void *arg)
       if (step == STEP_ENDING)
       {
 #endif /* !USE_GRABBER */
+        if (pdata->priority < pdata->priority_db)
+          pdata->priority_db = pdata->priority;
         vh_dbmanager_action_send (VH_HANDLE->dbmanager,
                                   pdata->priority, e, pdata);
       }
@@ -178,13 +184,31 @@ dispatcher_thread (void *arg)
       {
         e = ACTION_DB_END;
         /*
-         * Force NORMAL priority because the last step must be always
-         * at the end! It prevents to free pdata before the handling
-         * of metadata.
+         * The last step must be always at the end! It prevents to free
+         * pdata before the handling of metadata. An entry is never popped
+         * before an older entry with the same or a higher priority (HIGH
+         * excepted, pushed on the top). The priority of the file can be
+         * raised while it is in flight (ondemand, hints), then END uses
+         * the lowest priority of the entries already sent to the
+         * dbmanager for this file, and never HIGH.
          */
-        pdata->priority = FIFO_QUEUE_PRIORITY_NORMAL;
+        if (pdata->priority > pdata->priority_db)
+          pdata->priority = pdata->priority_db;
+        if (pdata->priority == FIFO_QUEUE_PRIORITY_HIGH)
+          pdata->priority = FIFO_QUEUE_PRIORITY_BROWSED;
       }
 
+#ifdef USE_GRABBER
+      /*
+       * With the pool, a grabber task can not wait on the dbmanager, else
+       * all workers can be blocked while the dbmanager waits on the queues
+       * of the pool. The dbmanager sends the file to the grabber when the
+       * grabbed data are handled.
+       */
+      if (pdata->wait && VH_HANDLE->executor)
+        break;
+#endif /* USE_GRABBER */
+
       /* Proceed to the step */
       send[step].fct (send[step].handler, pdata->priority, e, pdata);
       break;
@@ -215,6 +239,7 @@ vh_dispatcher_run (dispatcher_t *dispatcher, int priority)
 
   pthread_attr_init (&attr);
   pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+  vh_thread_stack_set (&attr, VH_HANDLE->stack_size);
 
   res =
     pthread_create (&dispatcher->thread, &attr, dispatcher_thread, dispatcher);
@@ -332,5 +357,25 @@ vh_dispatcher_action_send (dispatcher_t *dispatcher,
   if (!dispatcher)
     return;
 
+  /* an ondemand file must not wait behind the other files */
+  if (data)
+  {
+    file_data_t *pdata = data;
+    vh_ondemand_express (VH_HANDLE->ondemand, pdata);
+    prio = pdata->priority;
+  }
+
   vh_fifo_queue_push (dispatcher->fifo, prio, action, data);
 }
+
+void
+vh_dispatcher_action_send_wait (dispatcher_t *dispatcher,
+                                fifo_queue_prio_t prio, int action, void *data)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!dispatcher)
+    return;
+
+  vh_fifo_queue_push_wait (dispatcher->fifo, prio, action, data);
+}
@@ -41,5 +41,8 @@ dispatcher_t *vh_dispatcher_init (valhalla_t *handle);
 
 void vh_dispatcher_action_send (dispatcher_t *dispatcher,
                                 fifo_queue_prio_t prio, int action, void *data);
+void vh_dispatcher_action_send_wait (dispatcher_t *dispatcher,
+                                     fifo_queue_prio_t prio,
+                                     int action, void *data);
 
 #endif /* VALHALLA_DISPATCHER_H */
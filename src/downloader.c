@@ -33,6 +33,7 @@
 #include "stats.h"
 #include "thread_utils.h"
 #include "dispatcher.h"
+#include "executor.h"
 #include "downloader.h"
 
 #define VH_HANDLE downloader->valhalla
@@ -74,13 +75,93 @@ downloader_is_stopped (downloader_t *downloader)
   return !run;
 }
 
+static void
+downloader_file (downloader_t *downloader, int e, file_data_t *pdata)
+{
+  int interrup = 0;
+
+  if (pdata->list_downloader)
+  {
+    file_dl_t *it = pdata->list_downloader;
+    for (; it; it = it->next)
+    {
+      char *dest;
+      size_t len;
+      valhalla_dl_t dst = it->dst;
+      int err;
+
+      if (downloader_is_stopped (downloader))
+      {
+        interrup = 1;
+        break;
+      }
+
+      if (!it->url || dst >= VALHALLA_DL_LAST)
+        continue;
+
+      if (!downloader->dl_list[dst] || !downloader->dl_list[dst][0])
+        dst = VALHALLA_DL_DEFAULT;
+
+      if (!downloader->dl_list[dst] || !downloader->dl_list[dst][0])
+        continue;
+
+      len = strlen (downloader->dl_list[dst]) + strlen (it->name) + 2;
+      dest = malloc (len);
+      if (!dest)
+        continue;
+
+      snprintf (dest, len, "%s%s%s",
+                downloader->dl_list[dst],
+                *(strrchr (downloader->dl_list[dst], '\0') - 1) == '/'
+                ? "" : "/",
+                it->name);
+
+      /* no need to download again an already existing file */
+      if (vh_file_exists (dest))
+      {
+        VH_STATS_COUNTER_INC (downloader->st_cnt_skip);
+        free (dest);
+        continue;
+      }
+
+      VH_STATS_TIMER_START (downloader->st_tmr);
+      err = vh_url_save_to_disk (downloader->url_handler, it->url, dest);
+      VH_STATS_TIMER_STOP (downloader->st_tmr);
+      if (!err)
+      {
+        vh_log (VALHALLA_MSG_VERBOSE, "[%s] %s saved to %s",
+                __FUNCTION__, it->url, downloader->dl_list[dst]);
+        VH_STATS_COUNTER_INC (downloader->st_cnt_success);
+      }
+      else
+      {
+        /* download aborted, consider to save the context */
+        if (err == URL_ERROR_ABORT)
+          interrup = 1;
+        VH_STATS_COUNTER_INC (downloader->st_cnt_failure);
+      }
+      free (dest);
+    }
+  }
+
+  if (!interrup)
+    vh_file_data_step_increase (pdata, &e);
+  vh_dispatcher_action_send (VH_HANDLE->dispatcher,
+                             pdata->priority, e, pdata);
+}
+
+static void
+downloader_task (void *arg, vh_unused unsigned int slot, int e, void *data)
+{
+  downloader_file (arg, e, data);
+}
+
 static void *
 downloader_thread (void *arg)
 {
   int res, tid;
   int e;
   void *data = NULL;
-  file_data_t *pdata;
   downloader_t *downloader = arg;
 
   if (!downloader)
@@ -93,8 +174,6 @@ downloader_thread (void *arg)
 
   do
   {
-    int interrup = 0;
-
     e = ACTION_NO_OPERATION;
     data = NULL;
 
@@ -111,76 +190,7 @@ downloader_thread (void *arg)
       continue;
     }
 
-    pdata = data;
-
-    if (pdata->list_downloader)
-    {
-      file_dl_t *it = pdata->list_downloader;
-      for (; it; it = it->next)
-      {
-        char *dest;
-        size_t len;
-        valhalla_dl_t dst = it->dst;
-        int err;
-
-        if (downloader_is_stopped (downloader))
-        {
-          interrup = 1;
-          break;
-        }
-
-        if (!it->url || dst >= VALHALLA_DL_LAST)
-          continue;
-
-        if (!downloader->dl_list[dst] || !downloader->dl_list[dst][0])
-          dst = VALHALLA_DL_DEFAULT;
-
-        if (!downloader->dl_list[dst] || !downloader->dl_list[dst][0])
-          continue;
-
-        len = strlen (downloader->dl_list[dst]) + strlen (it->name) + 2;
-        dest = malloc (len);
-        if (!dest)
-          continue;
-
-        snprintf (dest, len, "%s%s%s",
-                  downloader->dl_list[dst],
-                  *(strrchr (downloader->dl_list[dst], '\0') - 1) == '/'
-                  ? "" : "/",
-                  it->name);
-
-        /* no need to download again an already existing file */
-        if (vh_file_exists (dest))
-        {
-          VH_STATS_COUNTER_INC (downloader->st_cnt_skip);
-          free (dest);
-          continue;
-        }
-
-        VH_STATS_TIMER_START (downloader->st_tmr);
-        err = vh_url_save_to_disk (downloader->url_handler, it->url, dest);
-        VH_STATS_TIMER_STOP (downloader->st_tmr);
-        if (!err)
-        {
-          vh_log (VALHALLA_MSG_VERBOSE, "[%s] %s saved to %s",
-                  __FUNCTION__, it->url, downloader->dl_list[dst]);
-          VH_STATS_COUNTER_INC (downloader->st_cnt_success);
-        }
-        else
-        {
-          /* download aborted, consider to save the context */
-          if (err == URL_ERROR_ABORT)
-            interrup = 1;
-          VH_STATS_COUNTER_INC (downloader->st_cnt_failure);
-        }
-        free (dest);
-      }
-    }
-
-    if (!interrup)
-      vh_file_data_step_increase (pdata, &e);
-    vh_dispatcher_action_send (VH_HANDLE->dispatcher,
-                               pdata->priority, e, pdata);
+    downloader_file (downloader, e, data);
   }
   while (!downloader_is_stopped (downloader));
 
@@ -201,8 +211,18 @@ vh_downloader_run (downloader_t *downloader, int priority)
   downloader->priority = priority;
   downloader->run      = 1;
 
+  /* the files are downloaded by the shared pool of threads */
+  if (VH_HANDLE->executor)
+  {
+    /* only one slot, the URL handler is not shared */
+    vh_executor_stage_set (VH_HANDLE->executor, STEP_DOWNLOADING,
+                           downloader->fifo, 1, downloader_task, downloader);
+    return res;
+  }
+
   pthread_attr_init (&attr);
   pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+  vh_thread_stack_set (&attr, VH_HANDLE->stack_size);
 
   res =
     pthread_create (&downloader->thread, &attr, downloader_thread, downloader);
@@ -235,6 +255,12 @@ vh_downloader_pause (downloader_t *downloader)
   if (!downloader)
     return;
 
+  if (VH_HANDLE->executor)
+  {
+    vh_executor_pause (VH_HANDLE->executor, STEP_DOWNLOADING);
+    return;
+  }
+
   VH_THREAD_PAUSE_FCT (downloader, 1)
 }
 
@@ -252,6 +278,10 @@ vh_downloader_stop (downloader_t *downloader, int f)
     downloader->run = 0;
     pthread_mutex_unlock (&downloader->mutex_run);
 
+    /* the pool is stopped by valhalla */
+    if (VH_HANDLE->executor)
+      return;
+
     vh_fifo_queue_push (downloader->fifo,
                         FIFO_QUEUE_PRIORITY_HIGH, ACTION_KILL_THREAD, NULL);
     downloader->wait = 1;
@@ -409,4 +439,6 @@ vh_downloader_action_send (downloader_t *downloader,
     return;
 
   vh_fifo_queue_push (downloader->fifo, prio, action, data);
+  if (VH_HANDLE->executor)
+    vh_executor_notify (VH_HANDLE->executor, STEP_DOWNLOADING);
 }
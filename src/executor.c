@@ -0,0 +1,350 @@
+/*
+ * GeeXboX Valhalla: tiny media scanner API.
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of libvalhalla.
+ *
+ * libvalhalla is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libvalhalla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libvalhalla; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "valhalla.h"
+#include "valhalla_internals.h"
+#include "utils.h"
+#include "fifo_queue.h"
+#include "logs.h"
+#include "thread_utils.h"
+#include "executor.h"
+
+#ifndef EXECUTOR_NB_MAX
+#define EXECUTOR_NB_MAX 16
+#endif /* EXECUTOR_NB_MAX */
+
+#define EXECUTOR_SLOT_MAX (sizeof (unsigned int) * 8)
+
+#define VH_HANDLE executor->valhalla
+
+/*
+ * The pool replaces the threads of the parser, the grabber and the
+ * downloader. Every step has its own queue (the queue of the module) and
+ * a number of slots which is the number of threads of the module. The
+ * workers take always the last step first in order to end the files
+ * which are already in the pipeline before to begin new files.
+ */
+typedef struct executor_stage_s {
+  fifo_queue_t  *fifo;
+  executor_fct_t fct;
+  void          *ctx;
+  unsigned int   max;
+  unsigned int   pending;
+  unsigned int   busy;
+  unsigned int   slots;
+  int            paused;
+} executor_stage_t;
+
+struct executor_s {
+  valhalla_t   *valhalla;
+  pthread_t     thread[EXECUTOR_NB_MAX];
+  unsigned int  nb;
+  int           priority;
+
+  int             wait;
+  int             run;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+  pthread_cond_t  cond_idle;
+
+  executor_stage_t stage[STEP_ENDING];
+};
+
+
+static executor_stage_t *
+executor_stage_get (executor_t *executor)
+{
+  int i;
+
+  for (i = STEP_ENDING - 1; i >= 0; i--)
+  {
+    executor_stage_t *stage = &executor->stage[i];
+
+    if (stage->pending && !stage->paused && stage->busy < stage->max)
+      return stage;
+  }
+
+  return NULL;
+}
+
+static void *
+executor_thread (void *arg)
+{
+  int tid;
+  executor_t *executor = arg;
+
+  if (!executor)
+    pthread_exit (NULL);
+
+  tid = vh_setpriority (executor->priority);
+  if (VH_HANDLE->ioidle)
+    vh_setioprio_idle ();
+
+  vh_log (VALHALLA_MSG_VERBOSE,
+          "[%s] tid: %i priority: %i", __FUNCTION__, tid, executor->priority);
+
+  pthread_mutex_lock (&executor->mutex);
+
+  for (;;)
+  {
+    int e, res;
+    unsigned int slot;
+    void *data;
+    executor_stage_t *stage = NULL;
+
+    while (executor->run && !(stage = executor_stage_get (executor)))
+      pthread_cond_wait (&executor->cond, &executor->mutex);
+
+    if (!executor->run)
+      break;
+
+    /* the slot is the thread identifier for the module */
+    for (slot = 0; stage->slots & (1U << slot); slot++)
+      ;
+    stage->slots |= 1U << slot;
+    stage->pending--;
+    stage->busy++;
+
+    pthread_mutex_unlock (&executor->mutex);
+
+    e = ACTION_NO_OPERATION;
+    data = NULL;
+
+    /* an entry is always available because it is counted by pending */
+    res = vh_fifo_queue_pop (stage->fifo, &e, &data);
+    if (!res && e != ACTION_NO_OPERATION)
+      stage->fct (stage->ctx, slot, e, data);
+
+    pthread_mutex_lock (&executor->mutex);
+
+    stage->slots &= ~(1U << slot);
+    stage->busy--;
+    if (stage->paused && !stage->busy)
+      pthread_cond_broadcast (&executor->cond_idle);
+    pthread_cond_signal (&executor->cond);
+  }
+
+  pthread_mutex_unlock (&executor->mutex);
+
+  pthread_exit (NULL);
+}
+
+int
+vh_executor_run (executor_t *executor, int priority)
+{
+  int res = EXECUTOR_SUCCESS;
+  unsigned int i, slots = 0;
+  pthread_attr_t attr;
+
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!executor)
+    return EXECUTOR_ERROR_HANDLER;
+
+  /* more workers than slots are useless */
+  for (i = 0; i < ARRAY_NB_ELEMENTS (executor->stage); i++)
+    slots += executor->stage[i].max;
+  if (executor->nb > slots)
+    executor->nb = slots;
+
+  executor->priority = priority;
+  executor->run      = 1;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+  vh_thread_stack_set (&attr, VH_HANDLE->stack_size);
+
+  for (i = 0; i < executor->nb; i++)
+  {
+    res = pthread_create (&executor->thread[i],
+                          &attr, executor_thread, executor);
+    if (res)
+    {
+      res = EXECUTOR_ERROR_THREAD;
+      executor->run = 0;
+      executor->nb  = i;
+      break;
+    }
+  }
+
+  pthread_attr_destroy (&attr);
+  return res;
+}
+
+void
+vh_executor_stage_set (executor_t *executor, processing_step_t step,
+                       fifo_queue_t *fifo, unsigned int max,
+                       executor_fct_t fct, void *ctx)
+{
+  executor_stage_t *stage;
+
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!executor || step >= STEP_ENDING)
+    return;
+
+  stage = &executor->stage[step];
+
+  pthread_mutex_lock (&executor->mutex);
+  stage->fifo = fifo;
+  stage->fct  = fct;
+  stage->ctx  = ctx;
+  stage->max  = max < EXECUTOR_SLOT_MAX ? max : EXECUTOR_SLOT_MAX;
+  pthread_mutex_unlock (&executor->mutex);
+}
+
+void
+vh_executor_notify (executor_t *executor, processing_step_t step)
+{
+  executor_stage_t *stage;
+
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!executor || step >= STEP_ENDING)
+    return;
+
+  stage = &executor->stage[step];
+
+  pthread_mutex_lock (&executor->mutex);
+  stage->pending++;
+  pthread_cond_signal (&executor->cond);
+  pthread_mutex_unlock (&executor->mutex);
+}
+
+void
+vh_executor_pause (executor_t *executor, processing_step_t step)
+{
+  executor_stage_t *stage;
+
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!executor || step >= STEP_ENDING)
+    return;
+
+  stage = &executor->stage[step];
+  if (!stage->fifo)
+    return;
+
+  pthread_mutex_lock (&executor->mutex);
+
+  if (stage->paused)
+  {
+    stage->paused = 0;
+    vh_fifo_queue_limit_suspend (stage->fifo, 0);
+    pthread_cond_broadcast (&executor->cond);
+  }
+  else
+  {
+    /* no producer must wait on a paused step */
+    vh_fifo_queue_limit_suspend (stage->fifo, 1);
+    stage->paused = 1;
+    while (stage->busy && executor->run)
+      pthread_cond_wait (&executor->cond_idle, &executor->mutex);
+  }
+
+  pthread_mutex_unlock (&executor->mutex);
+}
+
+void
+vh_executor_stop (executor_t *executor, int f)
+{
+  unsigned int i;
+
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!executor)
+    return;
+
+  if (f & STOP_FLAG_REQUEST)
+  {
+    pthread_mutex_lock (&executor->mutex);
+    if (executor->run)
+    {
+      executor->run  = 0;
+      executor->wait = 1;
+      pthread_cond_broadcast (&executor->cond);
+      pthread_cond_broadcast (&executor->cond_idle);
+    }
+    pthread_mutex_unlock (&executor->mutex);
+  }
+
+  if (f & STOP_FLAG_WAIT && executor->wait)
+  {
+    for (i = 0; i < executor->nb; i++)
+      pthread_join (executor->thread[i], NULL);
+    executor->wait = 0;
+  }
+}
+
+void
+vh_executor_uninit (executor_t *executor)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!executor)
+    return;
+
+  pthread_mutex_destroy (&executor->mutex);
+  pthread_cond_destroy (&executor->cond);
+  pthread_cond_destroy (&executor->cond_idle);
+
+  free (executor);
+}
+
+executor_t *
+vh_executor_init (valhalla_t *handle, unsigned int nb)
+{
+  executor_t *executor;
+
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!handle)
+    return NULL;
+
+  executor = calloc (1, sizeof (executor_t));
+  if (!executor)
+    return NULL;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  /* one worker by core */
+  if (!nb)
+  {
+    long n = sysconf (_SC_NPROCESSORS_ONLN);
+    nb = n > 0 ? (unsigned int) n : 0;
+  }
+#endif /* _SC_NPROCESSORS_ONLN */
+
+  executor->valhalla = handle; /* VH_HANDLE */
+  executor->nb       = nb ? nb : 1;
+
+  if (executor->nb > ARRAY_NB_ELEMENTS (executor->thread))
+    executor->nb = ARRAY_NB_ELEMENTS (executor->thread);
+
+  pthread_mutex_init (&executor->mutex, NULL);
+  pthread_cond_init (&executor->cond, NULL);
+  pthread_cond_init (&executor->cond_idle, NULL);
+
+  return executor;
+}
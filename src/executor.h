@@ -0,0 +1,52 @@
+/*
+ * GeeXboX Valhalla: tiny media scanner API.
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of libvalhalla.
+ *
+ * libvalhalla is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libvalhalla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libvalhalla; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#ifndef VALHALLA_EXECUTOR_H
+#define VALHALLA_EXECUTOR_H
+
+#include "valhalla.h"
+#include "valhalla_internals.h"
+#include "fifo_queue.h"
+
+typedef struct executor_s executor_t;
+
+typedef void (*executor_fct_t) (void *ctx,
+                                unsigned int slot, int e, void *data);
+
+enum executor_errno {
+  EXECUTOR_ERROR_HANDLER = -2,
+  EXECUTOR_ERROR_THREAD  = -1,
+  EXECUTOR_SUCCESS       =  0,
+};
+
+int vh_executor_run (executor_t *executor, int priority);
+void vh_executor_pause (executor_t *executor, processing_step_t step);
+void vh_executor_stop (executor_t *executor, int f);
+void vh_executor_uninit (executor_t *executor);
+executor_t *vh_executor_init (valhalla_t *handle, unsigned int nb);
+
+void vh_executor_stage_set (executor_t *executor, processing_step_t step,
+                            fifo_queue_t *fifo, unsigned int max,
+                            executor_fct_t fct, void *ctx);
+void vh_executor_notify (executor_t *executor, processing_step_t step);
+
+#endif /* VALHALLA_EXECUTOR_H */
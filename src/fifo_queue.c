@@ -21,35 +21,746 @@
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "fifo_queue.h"
 
+/*
+ * Each priority below HIGH has a bounded lock-free ring (MPMC, D. Vyukov)
+ * and a locked list. The list is the slow path; it is used when the ring is
+ * full, when the atomic builtins are not available, and for the entries
+ * handled by vh_fifo_queue_search() and vh_fifo_queue_moveup(). While a list
+ * is not empty, the new entries of the same priority are appended to this
+ * list in order to keep the order of the pushes.
+ *
+ * The entries below HIGH are FIFO (the ring is older than the list). The
+ * HIGH entries are popped before; they are always pushed on the top of the
+ * HIGH list (like the moved up entries), then the last one is popped first.
+ * There is no ring for HIGH because a ring can not keep this order.
+ *
+ * Aging: each entry has a stamp (the number of pushes). When the pops have
+ * bypassed an entry with a lower priority "aging" times, the oldest entry
+ * below HIGH is popped instead. Then no entry waits forever, and an entry is
+ * never popped before an older entry with the same or a higher priority
+ * (HIGH excepted), like the metadata of a file before its end.
+ *
+ * The number of entries below HIGH can be limited for the producers which
+ * are using vh_fifo_queue_push_wait(). It is a soft limit (several
+ * producers can pass the check at the same time). The HIGH entries are
+ * never limited.
+ *
+ * The entries of the lists can be indexed by a key (a string like the path
+ * of a file) with vh_fifo_queue_index_set(). Then the entries are found in
+ * constant time by vh_fifo_queue_search() and vh_fifo_queue_moveup(). The
+ * rings are drained in the lists before, they are bounded.
+ */
+#define FIFO_QUEUE_RING_SIZE  256 /* power of 2 */
+#define FIFO_QUEUE_RING_MASK  (FIFO_QUEUE_RING_SIZE - 1)
+#define FIFO_QUEUE_CACHELINE  64
+
+#define FIFO_QUEUE_PRIO_NB    (FIFO_QUEUE_PRIORITY_HIGH + 1)
+
+#define FIFO_QUEUE_INDEX_MIN  256 /* power of 2 */
+
 typedef struct fifo_queue_item_s {
   int id;
   void *data;
   struct fifo_queue_item_s *next;
+  struct fifo_queue_item_s *prev;
+
+  fifo_queue_prio_t prio;       /* list of the entry */
+  uint32_t stamp;
+  int indexed;
+  uint32_t hash;
+  struct fifo_queue_item_s *hnext;
 } fifo_queue_item_t;
 
-struct fifo_queue_s {
+#ifdef HAVE_ATOMIC
+typedef struct fifo_queue_cell_s {
+  size_t seq;
+  int id;
+  void *data;
+  uint32_t stamp;
+} fifo_queue_cell_t;
+
+typedef struct fifo_queue_ring_s {
+  size_t head; /* next position to push */
+  char   pad1[FIFO_QUEUE_CACHELINE - sizeof (size_t)];
+  size_t tail; /* next position to pop */
+  char   pad2[FIFO_QUEUE_CACHELINE - sizeof (size_t)];
+  fifo_queue_cell_t cells[FIFO_QUEUE_RING_SIZE];
+} fifo_queue_ring_t;
+#endif /* HAVE_ATOMIC */
+
+typedef struct fifo_queue_list_s {
   fifo_queue_item_t *item;
   fifo_queue_item_t *item_last;
+  unsigned int nb; /* read without the mutex */
+} fifo_queue_list_t;
+
+typedef struct fifo_queue_index_s {
+  const char *(*key_fct) (int id, const void *data);
+  fifo_queue_item_t **bucket;
+  unsigned int size; /* power of 2 */
+  unsigned int nb;
+} fifo_queue_index_t;
+
+struct fifo_queue_s {
+#ifdef HAVE_ATOMIC
+  fifo_queue_ring_t ring[FIFO_QUEUE_PRIORITY_HIGH]; /* below HIGH */
+#endif /* HAVE_ATOMIC */
+  fifo_queue_list_t list[FIFO_QUEUE_PRIO_NB];
   pthread_mutex_t mutex;
   sem_t sem;
+
+  /* free items kept for the next pushes (up to pool_max) */
+  fifo_queue_item_t *pool;
+  unsigned int pool_nb;
+  unsigned int pool_max;
+
+  uint32_t stamp; /* number of pushes */
+  unsigned int aging;
+  unsigned int skip;  /* pops since the last aging */
+
+  /* capacity for the entries below HIGH (0 for unlimited) */
+  unsigned int limit;
+  int suspend;  /* the limit is ignored (paused or stopped consumer) */
+  int waiters;  /* producers waiting for space, changed with the mutex */
+  pthread_cond_t cond;
+
+  fifo_queue_index_t index;
 };
 
 
+#ifdef HAVE_ATOMIC
+#define LIST_NB_GET(l)    __atomic_load_n (&(l)->nb, __ATOMIC_ACQUIRE)
+#define LIST_NB_SET(l, v) __atomic_store_n (&(l)->nb, v, __ATOMIC_RELEASE)
+
+#define SHARED_GET(v)     __atomic_load_n (&(v), __ATOMIC_SEQ_CST)
+#define SHARED_SET(v, x)  __atomic_store_n (&(v), x, __ATOMIC_SEQ_CST)
+#define SHARED_ADD(v, x)  __atomic_add_fetch (&(v), x, __ATOMIC_SEQ_CST)
+
+#define STAMP_NEXT(q)     __atomic_fetch_add (&(q)->stamp, 1, __ATOMIC_RELAXED)
+
+static void
+fifo_queue_ring_init (fifo_queue_ring_t *ring)
+{
+  size_t i;
+
+  for (i = 0; i < FIFO_QUEUE_RING_SIZE; i++)
+    ring->cells[i].seq = i;
+}
+
+static int
+fifo_queue_ring_push (fifo_queue_ring_t *ring,
+                      int id, void *data, uint32_t stamp)
+{
+  fifo_queue_cell_t *cell;
+  size_t pos = __atomic_load_n (&ring->head, __ATOMIC_RELAXED);
+
+  for (;;)
+  {
+    size_t seq;
+    intptr_t dif;
+
+    cell = &ring->cells[pos & FIFO_QUEUE_RING_MASK];
+    seq  = __atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE);
+    dif  = (intptr_t) seq - (intptr_t) pos;
+
+    if (!dif)
+    {
+      if (__atomic_compare_exchange_n (&ring->head, &pos, pos + 1, 1,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if (dif < 0)
+      return -1; /* full */
+    else
+      pos = __atomic_load_n (&ring->head, __ATOMIC_RELAXED);
+  }
+
+  cell->id    = id;
+  cell->data  = data;
+  cell->stamp = stamp;
+  __atomic_store_n (&cell->seq, pos + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static int
+fifo_queue_ring_pop (fifo_queue_ring_t *ring,
+                     int *id, void **data, uint32_t *stamp)
+{
+  fifo_queue_cell_t *cell;
+  size_t pos = __atomic_load_n (&ring->tail, __ATOMIC_RELAXED);
+
+  for (;;)
+  {
+    size_t seq;
+    intptr_t dif;
+
+    cell = &ring->cells[pos & FIFO_QUEUE_RING_MASK];
+    seq  = __atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE);
+    dif  = (intptr_t) seq - (intptr_t) (pos + 1);
+
+    if (!dif)
+    {
+      if (__atomic_compare_exchange_n (&ring->tail, &pos, pos + 1, 1,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if (dif < 0)
+      return -1; /* empty (or an entry is not yet published) */
+    else
+      pos = __atomic_load_n (&ring->tail, __ATOMIC_RELAXED);
+  }
+
+  *id    = cell->id;
+  *data  = cell->data;
+  *stamp = cell->stamp;
+  __atomic_store_n (&cell->seq, pos + FIFO_QUEUE_RING_SIZE, __ATOMIC_RELEASE);
+  return 0;
+}
+#else
+#define LIST_NB_GET(l)    1 /* always use the lists */
+#define LIST_NB_SET(l, v) ((l)->nb = (v))
+
+/* without the atomic builtins, these fields are used with the mutex */
+#define SHARED_GET(v)     (v)
+#define SHARED_SET(v, x)  ((v) = (x))
+#define SHARED_ADD(v, x)  ((v) += (x))
+
+#define STAMP_NEXT(q)     ((q)->stamp++)
+#endif /* !HAVE_ATOMIC */
+
+/* Number of entries of a priority (the mutex is necessary without atomics). */
+static unsigned int
+fifo_queue_level_nb (fifo_queue_t *queue, int p)
+{
+#ifdef HAVE_ATOMIC
+  fifo_queue_ring_t *ring;
+  size_t tail, head;
+
+  if (p == FIFO_QUEUE_PRIORITY_HIGH)
+    return LIST_NB_GET (&queue->list[p]);
+
+  ring = &queue->ring[p];
+  /* the tail is read first, then the head can not be behind */
+  tail = __atomic_load_n (&ring->tail, __ATOMIC_SEQ_CST);
+  head = __atomic_load_n (&ring->head, __ATOMIC_SEQ_CST);
+
+  return (unsigned int) (head - tail) + LIST_NB_GET (&queue->list[p]);
+#else
+  return queue->list[p].nb;
+#endif /* !HAVE_ATOMIC */
+}
+
+static int
+fifo_queue_is_full (fifo_queue_t *queue)
+{
+  int p;
+  unsigned int nb = 0, limit = SHARED_GET (queue->limit);
+
+  if (!limit || SHARED_GET (queue->suspend))
+    return 0;
+
+  for (p = FIFO_QUEUE_PRIORITY_NORMAL; p < FIFO_QUEUE_PRIORITY_HIGH; p++)
+    nb += fifo_queue_level_nb (queue, p);
+
+  return nb >= limit;
+}
+
+/* Wake up a producer after that an entry below HIGH has left the queue. */
+static void
+fifo_queue_signal (fifo_queue_t *queue)
+{
+#ifdef HAVE_ATOMIC
+  if (!__atomic_load_n (&queue->limit, __ATOMIC_RELAXED))
+    return;
+
+  /* pairs with the increment of the waiters in vh_fifo_queue_push_wait() */
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (!__atomic_load_n (&queue->waiters, __ATOMIC_RELAXED))
+    return;
+#endif /* HAVE_ATOMIC */
+
+  pthread_mutex_lock (&queue->mutex);
+  if (queue->waiters)
+    pthread_cond_signal (&queue->cond);
+  pthread_mutex_unlock (&queue->mutex);
+}
+
+static inline fifo_queue_item_t *
+fifo_queue_item_get (fifo_queue_t *queue)
+{
+  fifo_queue_item_t *item = queue->pool;
+
+  if (!item)
+    return calloc (1, sizeof (fifo_queue_item_t));
+
+  queue->pool = item->next;
+  queue->pool_nb--;
+  item->next = NULL;
+  return item;
+}
+
+static inline void
+fifo_queue_item_put (fifo_queue_t *queue, fifo_queue_item_t *item)
+{
+  if (queue->pool_nb >= queue->pool_max)
+  {
+    free (item);
+    return;
+  }
+
+  item->next = queue->pool;
+  queue->pool = item;
+  queue->pool_nb++;
+}
+
+static void
+fifo_queue_items_free (fifo_queue_item_t *item)
+{
+  fifo_queue_item_t *next;
+
+  while (item)
+  {
+    next = item->next;
+    free (item);
+    item = next;
+  }
+}
+
+/* FNV-1a */
+static uint32_t
+fifo_queue_hash (const char *key)
+{
+  uint32_t hash = 2166136261U;
+
+  for (; *key; key++)
+  {
+    hash ^= (unsigned char) *key;
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+static void
+fifo_queue_index_resize (fifo_queue_index_t *index, unsigned int size)
+{
+  unsigned int i;
+  fifo_queue_item_t **bucket;
+
+  bucket = calloc (size, sizeof (*bucket));
+  if (!bucket)
+    return; /* the chains are just longer */
+
+  for (i = 0; i < index->size; i++)
+  {
+    fifo_queue_item_t *item, *next;
+
+    for (item = index->bucket[i]; item; item = next)
+    {
+      next = item->hnext;
+      item->hnext = bucket[item->hash & (size - 1)];
+      bucket[item->hash & (size - 1)] = item;
+    }
+  }
+
+  free (index->bucket);
+  index->bucket = bucket;
+  index->size   = size;
+}
+
+static void
+fifo_queue_index_add (fifo_queue_index_t *index, fifo_queue_item_t *item)
+{
+  const char *key;
+  fifo_queue_item_t **head;
+
+  item->indexed = 0;
+  if (!index->bucket)
+    return;
+
+  key = index->key_fct (item->id, item->data);
+  if (!key)
+    return;
+
+  if (index->nb >= index->size)
+    fifo_queue_index_resize (index, index->size << 1);
+
+  item->hash    = fifo_queue_hash (key);
+  item->indexed = 1;
+  head = &index->bucket[item->hash & (index->size - 1)];
+  item->hnext = *head;
+  *head = item;
+  index->nb++;
+}
+
+static void
+fifo_queue_index_del (fifo_queue_index_t *index, fifo_queue_item_t *item)
+{
+  fifo_queue_item_t **it;
+
+  if (!item->indexed)
+    return;
+
+  for (it = &index->bucket[item->hash & (index->size - 1)];
+       *it; it = &(*it)->hnext)
+    if (*it == item)
+    {
+      *it = item->hnext;
+      break;
+    }
+
+  item->indexed = 0;
+  index->nb--;
+
+  if (index->size > FIFO_QUEUE_INDEX_MIN && index->nb < index->size >> 3)
+    fifo_queue_index_resize (index, index->size >> 1);
+}
+
+/* The stamps are compared like the aging (they can wrap). */
+static inline int
+fifo_queue_older (const fifo_queue_item_t *a, const fifo_queue_item_t *b)
+{
+  return (int32_t) (a->stamp - b->stamp) < 0;
+}
+
+/*
+ * Retrieve the oldest entry accepted by \p cmp_fct (the first pushed, like
+ * with a single list), with the index if available. The rings must be
+ * drained before.
+ */
+static fifo_queue_item_t *
+fifo_queue_find (fifo_queue_t *queue, const void *tocmp,
+                 int (*cmp_fct) (const void *tocmp, int id, const void *data))
+{
+  int p;
+  fifo_queue_item_t *item, *found = NULL;
+  fifo_queue_index_t *index = &queue->index;
+
+  if (index->bucket)
+  {
+    uint32_t hash = fifo_queue_hash (tocmp);
+
+    for (item = index->bucket[hash & (index->size - 1)];
+         item; item = item->hnext)
+      if (item->hash == hash && !cmp_fct (tocmp, item->id, item->data)
+          && (!found || fifo_queue_older (item, found)))
+        found = item;
+    return found;
+  }
+
+  /* the raised and moved up entries are not in the order of the pushes */
+  for (p = FIFO_QUEUE_PRIORITY_HIGH; p >= FIFO_QUEUE_PRIORITY_NORMAL; p--)
+    for (item = queue->list[p].item; item; item = item->next)
+      if (!cmp_fct (tocmp, item->id, item->data)
+          && (!found || fifo_queue_older (item, found)))
+        found = item;
+
+  return found;
+}
+
+/* The helpers for the lists must be used with the mutex. */
+static void
+fifo_queue_list_prepend (fifo_queue_t *queue,
+                         fifo_queue_prio_t p, fifo_queue_item_t *item)
+{
+  fifo_queue_list_t *list = &queue->list[p];
+
+  item->prio = p;
+  item->prev = NULL;
+  item->next = list->item;
+  if (list->item)
+    list->item->prev = item;
+  else
+    list->item_last = item;
+  list->item = item;
+  LIST_NB_SET (list, list->nb + 1);
+
+  fifo_queue_index_add (&queue->index, item);
+}
+
+static void
+fifo_queue_list_append (fifo_queue_t *queue,
+                        fifo_queue_prio_t p, fifo_queue_item_t *item)
+{
+  fifo_queue_list_t *list = &queue->list[p];
+
+  item->prio = p;
+  item->prev = list->item_last;
+  item->next = NULL;
+  if (list->item_last)
+    list->item_last->next = item;
+  else
+    list->item = item;
+  list->item_last = item;
+  LIST_NB_SET (list, list->nb + 1);
+
+  fifo_queue_index_add (&queue->index, item);
+}
+
+static void
+fifo_queue_list_remove (fifo_queue_t *queue, fifo_queue_item_t *item)
+{
+  fifo_queue_list_t *list = &queue->list[item->prio];
+
+  if (item->prev)
+    item->prev->next = item->next;
+  else
+    list->item = item->next;
+  if (item->next)
+    item->next->prev = item->prev;
+  else
+    list->item_last = item->prev;
+  LIST_NB_SET (list, list->nb - 1);
+
+  fifo_queue_index_del (&queue->index, item);
+}
+
+static fifo_queue_item_t *
+fifo_queue_list_shift (fifo_queue_t *queue, fifo_queue_prio_t p)
+{
+  fifo_queue_item_t *item = queue->list[p].item;
+
+  if (item)
+    fifo_queue_list_remove (queue, item);
+  return item;
+}
+
+/*
+ * Move all entries of the rings in the lists (the mutex must be locked).
+ * The entries of a ring are older than the entries of its list.
+ */
+static void
+fifo_queue_drain (fifo_queue_t *queue)
+{
+#ifdef HAVE_ATOMIC
+  int p;
+  fifo_queue_item_t *item, *tmp;
+
+  /*
+   * The ring is popped before its list. The entries are kept in the reverse
+   * order, then prepended one by one.
+   */
+  for (p = FIFO_QUEUE_PRIORITY_NORMAL; p < FIFO_QUEUE_PRIORITY_HIGH; p++)
+  {
+    tmp = NULL;
+    while ((item = fifo_queue_item_get (queue)))
+    {
+      if (fifo_queue_ring_pop (&queue->ring[p],
+                               &item->id, &item->data, &item->stamp))
+        break;
+      item->next = tmp;
+      tmp = item;
+    }
+    if (item)
+      fifo_queue_item_put (queue, item);
+
+    while (tmp)
+    {
+      item = tmp;
+      tmp  = tmp->next;
+      fifo_queue_list_prepend (queue, p, item);
+    }
+  }
+#else
+  (void) queue;
+#endif /* HAVE_ATOMIC */
+}
+
+/*
+ * The helpers for the pops are used with "locked" set when the mutex is
+ * already locked by the caller (vh_fifo_queue_pop_many).
+ */
+static int
+fifo_queue_list_pop (fifo_queue_t *queue, fifo_queue_prio_t p, int locked,
+                     int *id, void **data)
+{
+  fifo_queue_item_t *item;
+
+  if (!locked)
+  {
+    if (!LIST_NB_GET (&queue->list[p]))
+      return -1;
+    pthread_mutex_lock (&queue->mutex);
+  }
+
+  item = fifo_queue_list_shift (queue, p);
+  if (item)
+  {
+    *id   = item->id;
+    *data = item->data;
+    fifo_queue_item_put (queue, item);
+  }
+
+  if (!locked)
+    pthread_mutex_unlock (&queue->mutex);
+
+  return item ? 0 : -1;
+}
+
+static int
+fifo_queue_level_pop (fifo_queue_t *queue, int p, int locked,
+                      int *id, void **data)
+{
+#ifdef HAVE_ATOMIC
+  uint32_t stamp;
+
+  /* HIGH: no ring */
+  if (p != FIFO_QUEUE_PRIORITY_HIGH
+      && !fifo_queue_ring_pop (&queue->ring[p], id, data, &stamp))
+    return 0;
+#endif /* HAVE_ATOMIC */
+  return fifo_queue_list_pop (queue, p, locked, id, data);
+}
+
+/*
+ * A pop of an entry below HIGH is counted for the aging when an entry with
+ * a lower priority is waiting.
+ */
+static void
+fifo_queue_age (fifo_queue_t *queue, int p, int locked)
+{
+#ifndef HAVE_ATOMIC
+  if (!locked)
+    pthread_mutex_lock (&queue->mutex);
+#endif /* !HAVE_ATOMIC */
+
+  if (SHARED_GET (queue->aging))
+    while (--p >= FIFO_QUEUE_PRIORITY_NORMAL)
+      if (fifo_queue_level_nb (queue, p))
+      {
+        SHARED_ADD (queue->skip, 1);
+        break;
+      }
+
+#ifndef HAVE_ATOMIC
+  if (!locked)
+    pthread_mutex_unlock (&queue->mutex);
+#else
+  (void) locked;
+#endif /* HAVE_ATOMIC */
+}
+
+static int
+fifo_queue_aged (fifo_queue_t *queue, int locked)
+{
+  int aged;
+  unsigned int aging;
+
+#ifndef HAVE_ATOMIC
+  if (!locked)
+    pthread_mutex_lock (&queue->mutex);
+#endif /* !HAVE_ATOMIC */
+
+  aging = SHARED_GET (queue->aging);
+  aged  = aging && SHARED_GET (queue->skip) >= aging;
+
+#ifndef HAVE_ATOMIC
+  if (!locked)
+    pthread_mutex_unlock (&queue->mutex);
+#else
+  (void) locked;
+#endif /* HAVE_ATOMIC */
+
+  return aged;
+}
+
+/* Pop the oldest entry below HIGH, it returns its priority. */
+static int
+fifo_queue_oldest_pop (fifo_queue_t *queue, int locked, int *id, void **data)
+{
+  int p;
+  fifo_queue_item_t *item = NULL;
+
+  if (!locked)
+    pthread_mutex_lock (&queue->mutex);
+
+  SHARED_SET (queue->skip, 0);
+  fifo_queue_drain (queue);
+
+  /* with the same stamp (wrapped), the highest priority is kept */
+  for (p = FIFO_QUEUE_PRIORITY_HIGH - 1; p >= FIFO_QUEUE_PRIORITY_NORMAL; p--)
+  {
+    fifo_queue_item_t *head = queue->list[p].item;
+
+    if (head && (!item || (int32_t) (head->stamp - item->stamp) < 0))
+      item = head;
+  }
+
+  if (item)
+  {
+    p = item->prio;
+    fifo_queue_list_remove (queue, item);
+    *id   = item->id;
+    *data = item->data;
+    fifo_queue_item_put (queue, item);
+  }
+
+  if (!locked)
+    pthread_mutex_unlock (&queue->mutex);
+
+  return item ? p : -1;
+}
+
+/*
+ * Pop the next entry: HIGH first, then the oldest entry when the aging is
+ * reached, else the entry with the highest priority. It returns the
+ * priority of the entry, or -1 if no entry is visible.
+ */
+static int
+fifo_queue_take (fifo_queue_t *queue, int locked, int *id, void **data)
+{
+  int p;
+
+  if (!fifo_queue_level_pop (queue, FIFO_QUEUE_PRIORITY_HIGH,
+                             locked, id, data))
+    return FIFO_QUEUE_PRIORITY_HIGH;
+
+  if (fifo_queue_aged (queue, locked))
+  {
+    p = fifo_queue_oldest_pop (queue, locked, id, data);
+    if (p >= 0)
+      return p;
+  }
+
+  for (p = FIFO_QUEUE_PRIORITY_HIGH - 1; p >= FIFO_QUEUE_PRIORITY_NORMAL; p--)
+    if (!fifo_queue_level_pop (queue, p, locked, id, data))
+    {
+      fifo_queue_age (queue, p, locked);
+      return p;
+    }
+
+  return -1;
+}
+
 fifo_queue_t *
 vh_fifo_queue_new (void)
 {
   fifo_queue_t *queue;
+#ifdef HAVE_ATOMIC
+  int p;
+#endif /* HAVE_ATOMIC */
 
   queue = calloc (1, sizeof (fifo_queue_t));
   if (!queue)
     return NULL;
 
+#ifdef HAVE_ATOMIC
+  for (p = FIFO_QUEUE_PRIORITY_NORMAL; p < FIFO_QUEUE_PRIORITY_HIGH; p++)
+    fifo_queue_ring_init (&queue->ring[p]);
+#endif /* HAVE_ATOMIC */
+
   pthread_mutex_init (&queue->mutex, NULL);
+  pthread_cond_init (&queue->cond, NULL);
   sem_init (&queue->sem, 0, 0);
+  queue->pool_max = FIFO_QUEUE_POOL_DEF;
+  queue->aging    = FIFO_QUEUE_AGING_DEF;
 
   return queue;
 }
@@ -57,20 +768,18 @@ vh_fifo_queue_new (void)
 void
 vh_fifo_queue_free (fifo_queue_t *queue)
 {
-  fifo_queue_item_t *item, *next;
+  int p;
 
   if (!queue)
     return;
 
-  item = queue->item;
-  while (item)
-  {
-    next = item->next;
-    free (item);
-    item = next;
-  }
+  for (p = FIFO_QUEUE_PRIORITY_NORMAL; p <= FIFO_QUEUE_PRIORITY_HIGH; p++)
+    fifo_queue_items_free (queue->list[p].item);
+  fifo_queue_items_free (queue->pool);
+  free (queue->index.bucket);
 
   pthread_mutex_destroy (&queue->mutex);
+  pthread_cond_destroy (&queue->cond);
   sem_destroy (&queue->sem);
 
   free (queue);
@@ -81,41 +790,28 @@ vh_fifo_queue_push (fifo_queue_t *queue,
                     fifo_queue_prio_t p, int id, void *data)
 {
   fifo_queue_item_t *item;
+#ifdef HAVE_ATOMIC
+  uint32_t stamp;
+#endif /* HAVE_ATOMIC */
 
   if (!queue)
     return FIFO_QUEUE_ERROR_QUEUE;
 
-  pthread_mutex_lock (&queue->mutex);
+  if (p < FIFO_QUEUE_PRIORITY_NORMAL || p > FIFO_QUEUE_PRIORITY_HIGH)
+    p = FIFO_QUEUE_PRIORITY_NORMAL;
 
-  item = queue->item;
-  if (item)
-  {
-    switch (p)
-    {
-    default:
-    case FIFO_QUEUE_PRIORITY_NORMAL:
-      queue->item_last->next = calloc (1, sizeof (fifo_queue_item_t));
-      item = queue->item_last->next;
-      if (item)
-        queue->item_last = item;
-      break;
+#ifdef HAVE_ATOMIC
+  stamp = STAMP_NEXT (queue);
 
-    case FIFO_QUEUE_PRIORITY_HIGH:
-      item = calloc (1, sizeof (fifo_queue_item_t));
-      if (!item)
-        break;
-      item->next = queue->item;
-      queue->item = item;
-      break;
-    }
-  }
-  else
-  {
-    item = calloc (1, sizeof (fifo_queue_item_t));
-    queue->item = item;
-    queue->item_last = item;
-  }
+  /* fast path (HIGH is always on the top of its list) */
+  if (p != FIFO_QUEUE_PRIORITY_HIGH && !LIST_NB_GET (&queue->list[p])
+      && !fifo_queue_ring_push (&queue->ring[p], id, data, stamp))
+    goto out;
+#endif /* HAVE_ATOMIC */
+
+  pthread_mutex_lock (&queue->mutex);
 
+  item = fifo_queue_item_get (queue);
   if (!item)
   {
     pthread_mutex_unlock (&queue->mutex);
@@ -124,46 +820,147 @@ vh_fifo_queue_push (fifo_queue_t *queue,
 
   item->id = id;
   item->data = data;
+#ifdef HAVE_ATOMIC
+  item->stamp = stamp;
+#else
+  item->stamp = STAMP_NEXT (queue);
+#endif /* !HAVE_ATOMIC */
 
-  /* new entry in the queue is ok */
-  sem_post (&queue->sem);
+  if (p == FIFO_QUEUE_PRIORITY_HIGH)
+    fifo_queue_list_prepend (queue, p, item);
+  else
+    fifo_queue_list_append (queue, p, item);
 
   pthread_mutex_unlock (&queue->mutex);
 
+#ifdef HAVE_ATOMIC
+ out:
+#endif /* HAVE_ATOMIC */
+  /* new entry in the queue is ok */
+  sem_post (&queue->sem);
+
   return FIFO_QUEUE_SUCCESS;
 }
 
+/*
+ * Same as vh_fifo_queue_push() but an entry below HIGH waits until that the
+ * number of entries below HIGH is under the limit. It must be used only by a
+ * producer which is never waited by the consumer of this queue.
+ */
+int
+vh_fifo_queue_push_wait (fifo_queue_t *queue,
+                         fifo_queue_prio_t p, int id, void *data)
+{
+  if (!queue)
+    return FIFO_QUEUE_ERROR_QUEUE;
+
+  if (p != FIFO_QUEUE_PRIORITY_HIGH
+#ifdef HAVE_ATOMIC
+      && fifo_queue_is_full (queue)
+#endif /* HAVE_ATOMIC */
+     )
+  {
+    pthread_mutex_lock (&queue->mutex);
+    SHARED_ADD (queue->waiters, 1);
+    while (fifo_queue_is_full (queue))
+      pthread_cond_wait (&queue->cond, &queue->mutex);
+    SHARED_ADD (queue->waiters, -1);
+    pthread_mutex_unlock (&queue->mutex);
+  }
+
+  return vh_fifo_queue_push (queue, p, id, data);
+}
+
 int
 vh_fifo_queue_pop (fifo_queue_t *queue, int *id, void **data)
 {
-  fifo_queue_item_t *item, *next;
+  int i, p;
+  void *d;
 
   if (!queue)
     return FIFO_QUEUE_ERROR_QUEUE;
 
-  /* wait on the queue */
+  /* wait on the queue (the thread is parked only when it is empty) */
   sem_wait (&queue->sem);
 
-  pthread_mutex_lock (&queue->mutex);
-  item = queue->item;
-  if (!item)
+  /*
+   * An entry is reserved by the semaphore, but it can be not yet visible
+   * when an other thread is publishing an entry in the same ring.
+   */
+  for (;;)
   {
-    pthread_mutex_unlock (&queue->mutex);
+    p = fifo_queue_take (queue, 0, &i, &d);
+    if (p >= 0)
+      break;
+#ifndef HAVE_ATOMIC
     return FIFO_QUEUE_ERROR_EMPTY;
+#endif /* !HAVE_ATOMIC */
+    sched_yield ();
   }
 
+  /* an entry below HIGH is popped */
+  if (p != FIFO_QUEUE_PRIORITY_HIGH)
+    fifo_queue_signal (queue);
+
   if (id)
-    *id = item->id;
+    *id = i;
   if (data)
-    *data = item->data;
+    *data = d;
+
+  return FIFO_QUEUE_SUCCESS;
+}
+
+/*
+ * Pop up to "max" entries with only one lock of the mutex. It waits for the
+ * first entry, then only the entries already queued are returned. Nothing
+ * follows a HIGH entry, then a consumer handles the controls (pause, kill)
+ * after the previous entries and before the next ones. It returns the
+ * number of entries.
+ */
+int
+vh_fifo_queue_pop_many (fifo_queue_t *queue,
+                        unsigned int max, fifo_queue_entry_t *out)
+{
+  int p;
+  unsigned int nb = 0, freed = 0;
+
+  if (!queue || !max || !out)
+    return FIFO_QUEUE_ERROR_QUEUE;
+
+  sem_wait (&queue->sem);
+
+  pthread_mutex_lock (&queue->mutex);
+
+  for (;;)
+  {
+    p = fifo_queue_take (queue, 1, &out[nb].id, &out[nb].data);
+    if (p < 0)
+    {
+#ifdef HAVE_ATOMIC
+      /* reserved but not yet visible, see vh_fifo_queue_pop() */
+      sched_yield ();
+      continue;
+#else
+      break;
+#endif /* !HAVE_ATOMIC */
+    }
+
+    nb++;
+    if (p == FIFO_QUEUE_PRIORITY_HIGH)
+      break;
+
+    freed++;
+    if (nb == max || sem_trywait (&queue->sem))
+      break;
+  }
+
+  /* the entries below HIGH have left the queue */
+  if (freed && queue->waiters)
+    pthread_cond_broadcast (&queue->cond);
 
-  /* remove the entry and go to the next */
-  next = item->next;
-  free (item);
-  queue->item = next;
   pthread_mutex_unlock (&queue->mutex);
 
-  return FIFO_QUEUE_SUCCESS;
+  return nb ? (int) nb : FIFO_QUEUE_ERROR_EMPTY;
 }
 
 void *
@@ -179,46 +976,256 @@ vh_fifo_queue_search (fifo_queue_t *queue, int *id, const void *tocmp,
 
   pthread_mutex_lock (&queue->mutex);
 
-  for (item = queue->item; item; item = item->next)
-    if (!cmp_fct (tocmp, item->id, item->data))
-    {
-      *id  = item->id;
-      data = item->data;
-      break;
-    }
+  fifo_queue_drain (queue);
+
+  item = fifo_queue_find (queue, tocmp, cmp_fct);
+  if (item)
+  {
+    *id  = item->id;
+    data = item->data;
+  }
 
   pthread_mutex_unlock (&queue->mutex);
 
   return data;
 }
 
-void
+/*
+ * All entries accepted by \p cmp_fct are moved on the top of the HIGH list,
+ * in the order of their pushes (the oldest is popped first). The number of
+ * entries moved is returned.
+ */
+int
 vh_fifo_queue_moveup (fifo_queue_t *queue, const void *tomove,
                       int (*cmp_fct) (const void *tocmp,
                                       int id, const void *data))
 {
-  fifo_queue_item_t *item, *item_p = NULL;
+  int nb = 0, below = 0;
+  fifo_queue_item_t *item, *moved = NULL;
 
   if (!queue || !tomove || !cmp_fct)
+    return 0;
+
+  pthread_mutex_lock (&queue->mutex);
+
+  fifo_queue_drain (queue);
+
+  /* the oldest first, the removed entries are no longer found */
+  while ((item = fifo_queue_find (queue, tomove, cmp_fct)))
+  {
+    if (item->prio != FIFO_QUEUE_PRIORITY_HIGH)
+      below++;
+    fifo_queue_list_remove (queue, item);
+    item->next = moved;
+    moved = item;
+    nb++;
+  }
+
+  /* the newest is prepended first */
+  while (moved)
+  {
+    item  = moved;
+    moved = moved->next;
+    fifo_queue_list_prepend (queue, FIFO_QUEUE_PRIORITY_HIGH, item);
+  }
+
+  /* less entries below HIGH */
+  if (below && queue->waiters)
+    pthread_cond_broadcast (&queue->cond);
+
+  pthread_mutex_unlock (&queue->mutex);
+  return nb;
+}
+
+/*
+ * All entries below \p p and accepted by \p cmp_fct are moved at the end
+ * of the list \p p (in their order). The number of entries is returned.
+ */
+unsigned int
+vh_fifo_queue_raise (fifo_queue_t *queue, fifo_queue_prio_t p,
+                     const void *tocmp,
+                     int (*cmp_fct) (const void *tocmp,
+                                     int id, const void *data))
+{
+  int l;
+  unsigned int nb = 0;
+  fifo_queue_item_t *item, *next;
+
+  if (!queue || !cmp_fct || p > FIFO_QUEUE_PRIORITY_HIGH)
+    return 0;
+
+  pthread_mutex_lock (&queue->mutex);
+
+  fifo_queue_drain (queue);
+
+  for (l = FIFO_QUEUE_PRIORITY_NORMAL; l < (int) p; l++)
+    for (item = queue->list[l].item; item; item = next)
+    {
+      next = item->next;
+      if (cmp_fct (tocmp, item->id, item->data))
+        continue;
+
+      fifo_queue_list_remove (queue, item);
+      fifo_queue_list_append (queue, p, item);
+      nb++;
+    }
+
+  /* less entries below HIGH */
+  if (nb && p == FIFO_QUEUE_PRIORITY_HIGH && queue->waiters)
+    pthread_cond_broadcast (&queue->cond);
+
+  pthread_mutex_unlock (&queue->mutex);
+  return nb;
+}
+
+void
+vh_fifo_queue_pool_set (fifo_queue_t *queue, unsigned int max)
+{
+  fifo_queue_item_t *item;
+
+  if (!queue)
     return;
 
   pthread_mutex_lock (&queue->mutex);
 
-  for (item = queue->item; item; item = item->next)
+  queue->pool_max = max;
+  while (queue->pool_nb > max)
   {
-    if (!cmp_fct (tomove, item->id, item->data))
+    item = queue->pool;
+    queue->pool = item->next;
+    queue->pool_nb--;
+    free (item);
+  }
+
+  pthread_mutex_unlock (&queue->mutex);
+}
+
+/* The aging is disabled with 0 (strict priorities). */
+void
+vh_fifo_queue_aging_set (fifo_queue_t *queue, unsigned int pops)
+{
+  if (!queue)
+    return;
+
+  pthread_mutex_lock (&queue->mutex);
+  SHARED_SET (queue->aging, pops);
+  SHARED_SET (queue->skip, 0);
+  pthread_mutex_unlock (&queue->mutex);
+}
+
+void
+vh_fifo_queue_limit_set (fifo_queue_t *queue, unsigned int max)
+{
+  if (!queue)
+    return;
+
+  pthread_mutex_lock (&queue->mutex);
+  SHARED_SET (queue->limit, max);
+  pthread_cond_broadcast (&queue->cond);
+  pthread_mutex_unlock (&queue->mutex);
+}
+
+/*
+ * The limit must be suspended while the consumer is paused or stopped,
+ * else a producer can wait forever.
+ */
+void
+vh_fifo_queue_limit_suspend (fifo_queue_t *queue, int suspend)
+{
+  if (!queue)
+    return;
+
+  pthread_mutex_lock (&queue->mutex);
+  SHARED_SET (queue->suspend, !!suspend);
+  pthread_cond_broadcast (&queue->cond);
+  pthread_mutex_unlock (&queue->mutex);
+}
+
+int
+vh_fifo_queue_full (fifo_queue_t *queue)
+{
+  int full;
+
+  if (!queue)
+    return 0;
+
+#ifdef HAVE_ATOMIC
+  full = fifo_queue_is_full (queue);
+#else
+  pthread_mutex_lock (&queue->mutex);
+  full = fifo_queue_is_full (queue);
+  pthread_mutex_unlock (&queue->mutex);
+#endif /* !HAVE_ATOMIC */
+
+  return full;
+}
+
+/* Number of entries below HIGH (the controls are not counted). */
+unsigned int
+vh_fifo_queue_nb (fifo_queue_t *queue)
+{
+  int p;
+  unsigned int nb = 0;
+
+  if (!queue)
+    return 0;
+
+#ifndef HAVE_ATOMIC
+  pthread_mutex_lock (&queue->mutex);
+#endif /* !HAVE_ATOMIC */
+
+  for (p = FIFO_QUEUE_PRIORITY_NORMAL; p < FIFO_QUEUE_PRIORITY_HIGH; p++)
+    nb += fifo_queue_level_nb (queue, p);
+
+#ifndef HAVE_ATOMIC
+  pthread_mutex_unlock (&queue->mutex);
+#endif /* !HAVE_ATOMIC */
+
+  return nb;
+}
+
+/*
+ * Index the entries with a key. The key of an entry must not change while
+ * the entry is in the queue. Then the "tocmp" argument of the search and
+ * moveup functions must be a key, and "cmp_fct" must return 0 only for an
+ * entry with this key. NULL is returned by "key_fct" for the entries which
+ * are not indexed. The index is removed when "key_fct" is NULL.
+ */
+int
+vh_fifo_queue_index_set (fifo_queue_t *queue,
+                         const char *(*key_fct) (int id, const void *data))
+{
+  int p, res = 0;
+  fifo_queue_item_t *item;
+  fifo_queue_index_t *index;
+
+  if (!queue)
+    return FIFO_QUEUE_ERROR_QUEUE;
+
+  pthread_mutex_lock (&queue->mutex);
+
+  index = &queue->index;
+  free (index->bucket);
+  memset (index, 0, sizeof (*index));
+
+  if (key_fct)
+  {
+    index->bucket = calloc (FIFO_QUEUE_INDEX_MIN, sizeof (*index->bucket));
+    if (index->bucket)
     {
-      if (!item_p)
-        break;
-      item_p->next = item->next;
-      if (!item_p->next)
-        queue->item_last = item_p;
-      item->next = queue->item;
-      queue->item = item;
-      break;
+      index->key_fct = key_fct;
+      index->size    = FIFO_QUEUE_INDEX_MIN;
     }
-    item_p = item;
+    else
+      res = FIFO_QUEUE_ERROR_MALLOC;
   }
 
+  /* the entries already in the lists */
+  for (p = FIFO_QUEUE_PRIORITY_NORMAL; p <= FIFO_QUEUE_PRIORITY_HIGH; p++)
+    for (item = queue->list[p].item; item; item = item->next)
+      fifo_queue_index_add (index, item);
+
   pthread_mutex_unlock (&queue->mutex);
+
+  return res;
 }
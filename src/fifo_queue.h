@@ -31,24 +31,58 @@ enum fifo_queue_errno {
   FIFO_QUEUE_SUCCESS      =  0,
 };
 
+/*
+ * The entries are popped from the highest priority. The HIGH entries are
+ * pushed on the top of the queue, the entries of the other priorities are
+ * FIFO and aged (see fifo_queue.c).
+ */
 typedef enum fifo_queue_prio {
-  FIFO_QUEUE_PRIORITY_NORMAL,
-  FIFO_QUEUE_PRIORITY_HIGH,
+  FIFO_QUEUE_PRIORITY_NORMAL,   /* background */
+  FIFO_QUEUE_PRIORITY_RECENT,   /* recently modified files */
+  FIFO_QUEUE_PRIORITY_BROWSED,  /* directories browsed by the user */
+  FIFO_QUEUE_PRIORITY_HIGH,     /* ondemand and controls */
 } fifo_queue_prio_t;
 
+typedef struct fifo_queue_entry_s {
+  int   id;
+  void *data;
+} fifo_queue_entry_t;
+
+/* Default number of free items kept by a queue (high-water mark). */
+#define FIFO_QUEUE_POOL_DEF 64
+
+/* Default number of pops before to serve the oldest entry (aging). */
+#define FIFO_QUEUE_AGING_DEF 16
+
 
 fifo_queue_t *vh_fifo_queue_new (void);
 void vh_fifo_queue_free (fifo_queue_t *queue);
+void vh_fifo_queue_pool_set (fifo_queue_t *queue, unsigned int max);
+void vh_fifo_queue_aging_set (fifo_queue_t *queue, unsigned int pops);
+void vh_fifo_queue_limit_set (fifo_queue_t *queue, unsigned int max);
+void vh_fifo_queue_limit_suspend (fifo_queue_t *queue, int suspend);
+int vh_fifo_queue_full (fifo_queue_t *queue);
+unsigned int vh_fifo_queue_nb (fifo_queue_t *queue);
+int vh_fifo_queue_index_set (fifo_queue_t *queue,
+                             const char *(*key_fct) (int id, const void *data));
 
 int vh_fifo_queue_push (fifo_queue_t *queue,
                         fifo_queue_prio_t p, int id, void *data);
+int vh_fifo_queue_push_wait (fifo_queue_t *queue,
+                             fifo_queue_prio_t p, int id, void *data);
 int vh_fifo_queue_pop (fifo_queue_t *queue, int *id, void **data);
+int vh_fifo_queue_pop_many (fifo_queue_t *queue,
+                            unsigned int max, fifo_queue_entry_t *out);
 
 void *vh_fifo_queue_search (fifo_queue_t *queue, int *id, const void *tocmp,
                             int (*cmp_fct) (const void *tocmp,
                                             int id, const void *data));
-void vh_fifo_queue_moveup (fifo_queue_t *queue, const void *tomove,
-                           int (*cmp_fct) (const void *tocmp,
-                                           int id, const void *data));
+int vh_fifo_queue_moveup (fifo_queue_t *queue, const void *tomove,
+                          int (*cmp_fct) (const void *tocmp,
+                                          int id, const void *data));
+unsigned int vh_fifo_queue_raise (fifo_queue_t *queue, fifo_queue_prio_t p,
+                                  const void *tocmp,
+                                  int (*cmp_fct) (const void *tocmp,
+                                                  int id, const void *data));
 
 #endif /* VALHALLA_FIFO_QUEUE_H */
@@ -34,11 +34,13 @@
 #include "logs.h"
 #include "timer_thread.h"
 #include "thread_utils.h"
+#include "thread_scale.h"
 #include "url_utils.h"
 #include "grabber.h"
 #include "grabber_common.h"
 #include "dbmanager.h"
 #include "dispatcher.h"
+#include "executor.h"
 
 #ifdef HAVE_GRABBER_DUMMY
 #include "grabber_dummy.h"
@@ -91,14 +93,13 @@
 
 struct grabber_s {
   valhalla_t   *valhalla;
-  pthread_t     thread[GRABBER_NB_MAX];
-  fifo_queue_t *fifo;
-  unsigned int  nb;
-  int           priority;
+  thread_scale_t *scale;
+  fifo_queue_t  *fifo;
+  unsigned int   nb;
+  int            priority;
 
   int             wait;
   int             run;
-  unsigned int    run_id;
   pthread_mutex_t mutex_run;
 
   VH_THREAD_PAUSE_ATTRS
@@ -294,24 +295,123 @@ grabber_lock (grabber_list_t *list, file_data_t *fdata, timer_thread_t *timer)
   return NULL;
 }
 
+/* return a non-zero value if the grabber is stopped while waiting */
+static int
+grabber_file (grabber_t *grabber, unsigned int id, int e, file_data_t *pdata)
+{
+  int grab;
+  grabber_list_t *it;
+
+  if (e == ACTION_DB_NEXT_LOOP)
+  {
+    for (it = grabber->list; it; it = it->next)
+    {
+      if (!it->loop)
+        continue;
+
+      pthread_mutex_lock (&it->mutex);
+      it->loop (it->priv);
+      pthread_mutex_unlock (&it->mutex);
+    }
+    return 0;
+  }
+
+  /*
+   * Wait here until the grabbed data are inserted/updated in the
+   * database by the dbmanager. It prevent a race condition on
+   * pdata->meta_grabber. With the pool, the file is received only when
+   * the data are handled (see dispatcher_thread), then it never waits.
+   */
+  if (pdata->wait)
+  {
+    int stop;
+
+    vh_log (VALHALLA_MSG_VERBOSE,
+            "[%s] waiting grabbing: %s", __FUNCTION__, pdata->file.path);
+
+    /* sem_grabber provides a way to wake up the thread for "force_stop" */
+    grabber->sem_grabber[id] = &pdata->sem_grabber;
+    pthread_mutex_unlock (&grabber->mutex_grabber[id]);
+
+    stop = grabber_is_stopped (grabber);
+    if (!stop)
+    {
+      sem_wait (&pdata->sem_grabber);
+      pdata->wait = 0;
+    }
+
+    pthread_mutex_lock (&grabber->mutex_grabber[id]);
+    grabber->sem_grabber[id] = NULL;
+
+    if (stop)
+      return -1;
+  }
+
+  it = grabber_lock (grabber->list, pdata, grabber->timer[id]);
+  if (it) /* one grabber available */
+  {
+    int res;
+
+    pdata->grabber_name = it->name;
+    VH_STATS_TIMER_START (it->tmr);
+    res = it->grab (it->priv, pdata);
+    VH_STATS_TIMER_STOP (it->tmr);
+    VH_TIMERNOW (&it->timegrab);
+    grabber_unlock (it);
+    if (res)
+    {
+      VH_STATS_COUNTER_INC (it->cnt_failure);
+      vh_log (VALHALLA_MSG_VERBOSE,
+              "[%s] grabbing failed (%i): %s",
+              it->name, res, pdata->file.path);
+    }
+    else
+      VH_STATS_COUNTER_INC (it->cnt_success);
+
+    vh_list_append (pdata->grabber_list, it->name, strlen (it->name) + 1);
+  }
+
+  /* at least still one grabber for this file ? */
+  GRABBER_IS_AVAILABLE (it, grabber->list, pdata)
+  if (!grab) /* no?, then next step */
+    vh_file_data_step_increase (pdata, &e);
+  else
+    vh_file_data_step_continue (pdata, &e);
+
+  vh_log (VALHALLA_MSG_VERBOSE, "[%s] %s grabbing: %s",
+          __FUNCTION__, grab ? "continue" : "finished", pdata->file.path);
+
+  vh_dispatcher_action_send (VH_HANDLE->dispatcher,
+                             pdata->priority, e, pdata);
+  return 0;
+}
+
+static void
+grabber_task (void *arg, unsigned int slot, int e, void *data)
+{
+  grabber_t *grabber = arg;
+
+  /* the slot of the pool is used like the thread id */
+  pthread_mutex_lock (&grabber->mutex_grabber[slot]);
+  grabber_file (grabber, slot, e, data);
+  pthread_mutex_unlock (&grabber->mutex_grabber[slot]);
+}
+
 static void *
 grabber_thread (void *arg)
 {
   int res, tid;
   int e;
-  int grab;
   unsigned int id;
+  uint64_t start, end;
   void *data = NULL;
-  file_data_t *pdata;
-  grabber_t *grabber = arg;
-  grabber_list_t *it;
+  grabber_t *grabber = vh_thread_scale_data (arg, &id);
 
   if (!grabber)
     pthread_exit (NULL);
 
-  pthread_mutex_lock (&grabber->mutex_run);
-  id = grabber->run_id++;
-  pthread_mutex_unlock (&grabber->mutex_run);
+  /* the thread is unlocked only when it waits for the dbmanager */
+  pthread_mutex_lock (&grabber->mutex_grabber[id]);
 
   tid = vh_setpriority (grabber->priority);
 
@@ -330,98 +430,25 @@ grabber_thread (void *arg)
     if (e == ACTION_KILL_THREAD)
       break;
 
-    if (e == ACTION_DB_NEXT_LOOP)
-    {
-      for (it = grabber->list; it; it = it->next)
-      {
-        if (!it->loop)
-          continue;
-
-        pthread_mutex_lock (&it->mutex);
-        it->loop (it->priv);
-        pthread_mutex_unlock (&it->mutex);
-      }
-      continue;
-    }
-
     if (e == ACTION_PAUSE_THREAD)
     {
       VH_THREAD_PAUSE_ACTION (grabber)
       continue;
     }
 
-    pdata = data;
-
-    /*
-     * Wait here until the grabbed data are inserted/updated in the
-     * database by the dbmanager. It prevent a race condition on
-     * pdata->meta_grabber.
-     */
-    if (pdata->wait)
-    {
-      int stop;
-
-      vh_log (VALHALLA_MSG_VERBOSE,
-              "[%s] waiting grabbing: %s", __FUNCTION__, pdata->file.path);
-
-      /* sem_grabber provides a way to wake up the thread for "force_stop" */
-      grabber->sem_grabber[id] = &pdata->sem_grabber;
-      pthread_mutex_unlock (&grabber->mutex_grabber[id]);
-
-      stop = grabber_is_stopped (grabber);
-      if (!stop)
-      {
-        sem_wait (&pdata->sem_grabber);
-        pdata->wait = 0;
-      }
-
-      pthread_mutex_lock (&grabber->mutex_grabber[id]);
-      grabber->sem_grabber[id] = NULL;
-
-      if (stop)
-        break;
-    }
-
-    it = grabber_lock (grabber->list, pdata, grabber->timer[id]);
-    if (it) /* one grabber available */
-    {
-      int res;
-
-      pdata->grabber_name = it->name;
-      VH_STATS_TIMER_START (it->tmr);
-      res = it->grab (it->priv, pdata);
-      VH_STATS_TIMER_STOP (it->tmr);
-      VH_TIMERNOW (&it->timegrab);
-      grabber_unlock (it);
-      if (res)
-      {
-        VH_STATS_COUNTER_INC (it->cnt_failure);
-        vh_log (VALHALLA_MSG_VERBOSE,
-                "[%s] grabbing failed (%i): %s",
-                it->name, res, pdata->file.path);
-      }
-      else
-        VH_STATS_COUNTER_INC (it->cnt_success);
-
-      vh_list_append (pdata->grabber_list, it->name, strlen (it->name) + 1);
-    }
-
-    /* at least still one grabber for this file ? */
-    GRABBER_IS_AVAILABLE (it, grabber->list, pdata)
-    if (!grab) /* no?, then next step */
-      vh_file_data_step_increase (pdata, &e);
-    else
-      vh_file_data_step_continue (pdata, &e);
-
-    vh_log (VALHALLA_MSG_VERBOSE, "[%s] %s grabbing: %s",
-            __FUNCTION__, grab ? "continue" : "finished", pdata->file.path);
+    VH_TIMERNOW (&start);
+    if (grabber_file (grabber, id, e, data))
+      break;
+    VH_TIMERNOW (&end);
+    vh_thread_scale_sample (grabber->scale, end - start);
 
-    vh_dispatcher_action_send (VH_HANDLE->dispatcher,
-                               pdata->priority, e, pdata);
+    /* no more file, this thread is not necessary */
+    if (vh_thread_scale_retire (grabber->scale,
+                                id, vh_fifo_queue_nb (grabber->fifo)))
+      break;
   }
   while (!grabber_is_stopped (grabber));
 
-  /* the thread is locked by vh_grabber_run() */
   pthread_mutex_unlock (&grabber->mutex_grabber[id]);
 
   pthread_exit (NULL);
@@ -432,7 +459,6 @@ vh_grabber_run (grabber_t *grabber, int priority)
 {
   int res = GRABBER_SUCCESS;
   unsigned int i;
-  pthread_attr_t attr;
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
@@ -441,29 +467,26 @@ vh_grabber_run (grabber_t *grabber, int priority)
 
   grabber->priority = priority;
   grabber->run      = 1;
-  grabber->run_id   = 0;
-
-  pthread_attr_init (&attr);
-  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
 
   for (i = 0; i < grabber->nb; i++)
-  {
     vh_timer_thread_start (grabber->timer[i]);
-    pthread_mutex_lock (&grabber->mutex_grabber[i]);
-    res = pthread_create (&grabber->thread[i], &attr, grabber_thread, grabber);
-    if (res)
-    {
-      res = GRABBER_ERROR_THREAD;
-      grabber->run = 0;
-      break;
-    }
+
+  /* the files are grabbed by the shared pool of threads */
+  if (VH_HANDLE->executor)
+  {
+    vh_executor_stage_set (VH_HANDLE->executor, STEP_GRABBING,
+                           grabber->fifo, grabber->nb, grabber_task, grabber);
+    return res;
   }
 
+  /* only the minimum of threads, the others are started on demand */
+  res = vh_thread_scale_start (grabber->scale);
   if (res)
-    for (i++; i > 0; i--)
-      pthread_mutex_unlock (&grabber->mutex_grabber[i - 1]);
+  {
+    res = GRABBER_ERROR_THREAD;
+    grabber->run = 0;
+  }
 
-  pthread_attr_destroy (&attr);
   return res;
 }
 
@@ -564,18 +587,30 @@ vh_grabber_next (grabber_t *grabber, const char *id)
 void
 vh_grabber_pause (grabber_t *grabber)
 {
+  unsigned int nb;
+
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
   if (!grabber)
     return;
 
-  VH_THREAD_PAUSE_FCT (grabber, grabber->nb)
+  if (VH_HANDLE->executor)
+  {
+    vh_executor_pause (VH_HANDLE->executor, STEP_GRABBING);
+    return;
+  }
+
+  /* the number of threads must not change while they are paused */
+  nb = vh_thread_scale_freeze (grabber->scale, 1);
+  VH_THREAD_PAUSE_FCT (grabber, nb)
+  if (!grabber->paused)
+    vh_thread_scale_freeze (grabber->scale, 0);
 }
 
 void
 vh_grabber_stop (grabber_t *grabber, int f)
 {
-  unsigned int i;
+  unsigned int i, nb;
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
@@ -588,13 +623,18 @@ vh_grabber_stop (grabber_t *grabber, int f)
     grabber->run = 0;
     pthread_mutex_unlock (&grabber->mutex_run);
 
-    for (i = 0; i < grabber->nb; i++)
-      vh_fifo_queue_push (grabber->fifo,
-                          FIFO_QUEUE_PRIORITY_HIGH, ACTION_KILL_THREAD, NULL);
+    /* the pool is stopped by valhalla */
+    if (!VH_HANDLE->executor)
+    {
+      nb = vh_thread_scale_stop (grabber->scale);
+      for (i = 0; i < nb; i++)
+        vh_fifo_queue_push (grabber->fifo, FIFO_QUEUE_PRIORITY_HIGH,
+                            ACTION_KILL_THREAD, NULL);
 
-    grabber->wait = 1;
+      grabber->wait = 1;
 
-    VH_THREAD_PAUSE_FORCESTOP (grabber, grabber->nb)
+      VH_THREAD_PAUSE_FORCESTOP (grabber, nb)
+    }
 
     for (i = 0; i < grabber->nb; i++)
     {
@@ -615,8 +655,7 @@ vh_grabber_stop (grabber_t *grabber, int f)
 
   if (f & STOP_FLAG_WAIT && grabber->wait)
   {
-    for (i = 0; i < grabber->nb; i++)
-      pthread_join (grabber->thread[i], NULL);
+    vh_thread_scale_join (grabber->scale);
     grabber->wait = 0;
   }
 }
@@ -632,6 +671,7 @@ vh_grabber_uninit (grabber_t *grabber)
   if (!grabber)
     return;
 
+  vh_thread_scale_free (grabber->scale);
   vh_fifo_queue_free (grabber->fifo);
   pthread_mutex_destroy (&grabber->mutex_run);
   for (i = 0; i < grabber->nb; i++)
@@ -749,7 +789,7 @@ grabber_stats_dump (vh_stats_t *stats, void *data)
 }
 
 grabber_t *
-vh_grabber_init (valhalla_t *handle, unsigned int nb)
+vh_grabber_init (valhalla_t *handle, unsigned int nb, unsigned int min)
 {
   unsigned int i;
   grabber_t *grabber;
@@ -767,7 +807,7 @@ vh_grabber_init (valhalla_t *handle, unsigned int nb)
   grabber->valhalla = handle; /* VH_HANDLE */
   grabber->nb       = nb ? nb : GRABBER_NUMBER_DEF;
 
-  if (grabber->nb > ARRAY_NB_ELEMENTS (grabber->thread))
+  if (grabber->nb > GRABBER_NB_MAX)
     goto err;
 
   pthread_mutex_init (&grabber->mutex_run, NULL);
@@ -782,6 +822,11 @@ vh_grabber_init (valhalla_t *handle, unsigned int nb)
   if (!grabber->fifo)
     goto err;
 
+  grabber->scale = vh_thread_scale_new (min, grabber->nb, handle->stack_size,
+                                        grabber_thread, grabber);
+  if (!grabber->scale)
+    goto err;
+
   grabber->list = grabber_register_childs (handle->url_ctl);
   if (!grabber->list)
     goto err;
@@ -826,4 +871,8 @@ vh_grabber_action_send (grabber_t *grabber,
     return;
 
   vh_fifo_queue_push (grabber->fifo, prio, action, data);
+  if (VH_HANDLE->executor)
+    vh_executor_notify (VH_HANDLE->executor, STEP_GRABBING);
+  else
+    vh_thread_scale_grow (grabber->scale, vh_fifo_queue_nb (grabber->fifo));
 }
@@ -48,7 +48,8 @@ void vh_grabber_state_set (grabber_t *grabber, const char *id, int enable);
 const char *vh_grabber_next (grabber_t *grabber, const char *id);
 void vh_grabber_stop (grabber_t *grabber, int f);
 void vh_grabber_uninit (grabber_t *grabber);
-grabber_t *vh_grabber_init (valhalla_t *handle, unsigned int nb);
+grabber_t *vh_grabber_init (valhalla_t *handle,
+                            unsigned int nb, unsigned int min);
 
 void vh_grabber_action_send (grabber_t *grabber,
                              fifo_queue_prio_t prio, int action, void *data);
@@ -27,6 +27,7 @@
 #include "grabber_common.h"
 #include "grabber_ffmpeg.h"
 #include "grabber_utils.h"
+#include "throttle.h"
 #include "lavf_utils.h"
 #include "metadata.h"
 #include "logs.h"
@@ -207,14 +208,14 @@ grabber_ffmpeg_grab (void *priv, file_data_t *data)
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
-  ctx = vh_lavf_utils_open_input_file (data->file.path);
+  ctx = vh_lavf_utils_open_input_file (data->file.path, NULL);
   if (!ctx)
     return -1;
 
   res = grabber_ffmpeg_properties_get (ffmpeg, ctx, data);
   /* TODO: res = grabber_ffmpeg_snapshot (ctx, data, pos); */
 
-  avformat_close_input (&ctx);
+  vh_lavf_utils_close_input_file (&ctx);
   return res;
 }
 
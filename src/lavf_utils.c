@@ -21,14 +21,25 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <libavformat/avformat.h>
 
 #include "valhalla.h"
 #include "valhalla_internals.h"
 #include "logs.h"
+#include "throttle.h"
 #include "lavf_utils.h"
 
+#define LAVF_IO_BUFFER_SIZE 32768
+
+/* Private data of the AVIOContext used with the I/O budget. */
+struct lavf_io_s {
+  FILE       *fd;
+  throttle_t *throttle;
+};
+
 static const struct fileext_s {
   const char *fmtname;
   const char *suffix;
@@ -138,7 +149,7 @@ suffix_fmt_guess (const char *file)
  *          and can be "broken" with future versions of FFmpeg.
  */
 static int
-lavf_utils_probe (AVInputFormat *fmt, const char *file)
+lavf_utils_probe (AVInputFormat *fmt, const char *file, throttle_t *throttle)
 {
   FILE *fd;
   int rc = 0;
@@ -173,6 +184,7 @@ lavf_utils_probe (AVInputFormat *fmt, const char *file)
       break;
 
     p_data.buf_size = fread (p_data.buf, 1, p_size, fd);
+    vh_throttle_take (throttle, THROTTLE_BYTES, p_data.buf_size);
     if (p_data.buf_size != p_size) /* EOF is reached? */
       break;
 
@@ -197,13 +209,105 @@ lavf_utils_probe (AVInputFormat *fmt, const char *file)
   return rc;
 }
 
+static int
+lavf_io_read (void *opaque, uint8_t *buf, int size)
+{
+  struct lavf_io_s *io = opaque;
+  size_t n;
+
+  n = fread (buf, 1, size, io->fd);
+  vh_throttle_take (io->throttle, THROTTLE_BYTES, n);
+  return n ? (int) n : AVERROR_EOF;
+}
+
+static int64_t
+lavf_io_seek (void *opaque, int64_t offset, int whence)
+{
+  struct lavf_io_s *io = opaque;
+
+  if (whence == AVSEEK_SIZE)
+  {
+    struct stat st;
+
+    if (fstat (fileno (io->fd), &st))
+      return -1;
+    return (int64_t) st.st_size;
+  }
+
+  if (fseeko (io->fd, (off_t) offset, whence & ~AVSEEK_FORCE))
+    return -1;
+
+  return (int64_t) ftello (io->fd);
+}
+
+static void
+lavf_io_free (AVIOContext *pb)
+{
+  struct lavf_io_s *io;
+
+  if (!pb)
+    return;
+
+  io = pb->opaque;
+  if (io)
+  {
+    fclose (io->fd);
+    free (io);
+  }
+
+  av_free (pb->buffer);
+  av_free (pb);
+}
+
+/*
+ * The reads by the demuxers can be limited only with our own AVIOContext,
+ * else the file is opened by avformat_open_input() and it is not possible
+ * to know when the data are read.
+ */
+static AVIOContext *
+lavf_io_new (const char *file, throttle_t *throttle)
+{
+  AVIOContext *pb;
+  struct lavf_io_s *io;
+  unsigned char *buffer;
+
+  io = calloc (1, sizeof (struct lavf_io_s));
+  if (!io)
+    return NULL;
+
+  io->throttle = throttle;
+  io->fd = fopen (file, "rb");
+  if (!io->fd)
+    goto err_fd;
+
+  buffer = av_malloc (LAVF_IO_BUFFER_SIZE);
+  if (!buffer)
+    goto err_buffer;
+
+  pb = avio_alloc_context (buffer, LAVF_IO_BUFFER_SIZE,
+                           0, io, lavf_io_read, NULL, lavf_io_seek);
+  if (!pb)
+    goto err_pb;
+
+  return pb;
+
+ err_pb:
+  av_free (buffer);
+ err_buffer:
+  fclose (io->fd);
+ err_fd:
+  free (io);
+  return NULL;
+}
+
 AVFormatContext *
-vh_lavf_utils_open_input_file (const char *file)
+vh_lavf_utils_open_input_file (const char *file, throttle_t *throttle)
 {
   int res;
   const char *name;
   AVFormatContext   *ctx;
   AVInputFormat     *fmt = NULL;
+  AVIOContext       *pb = NULL;
 
   ctx = avformat_alloc_context ();
   if (!ctx)
@@ -221,20 +325,49 @@ vh_lavf_utils_open_input_file (const char *file)
 
   if (fmt)
   {
-    int score = lavf_utils_probe (fmt, file);
+    int score = lavf_utils_probe (fmt, file, throttle);
     vh_log (VALHALLA_MSG_VERBOSE,
             "Probe score (%i) [%s] : %s", score, name, file);
     if (!score) /* Bad score? */
       fmt = NULL;
   }
 
+  /* the demuxers which are not opening a file are not limited */
+  if (vh_throttle_enabled (throttle, THROTTLE_BYTES)
+      && !(fmt && fmt->flags & AVFMT_NOFILE))
+  {
+    pb = lavf_io_new (file, throttle);
+    if (pb)
+    {
+      ctx->pb = pb;
+      ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+  }
+
   res = avformat_open_input (&ctx, file, fmt, NULL);
   if (res)
   {
     vh_log (VALHALLA_MSG_WARNING,
             "FFmpeg can't open file (%i) : %s", res, file);
+    /* the context is freed by avformat_open_input() but not our I/O */
+    lavf_io_free (pb);
     return NULL;
   }
 
   return ctx;
 }
+
+void
+vh_lavf_utils_close_input_file (AVFormatContext **ctx)
+{
+  AVIOContext *pb = NULL;
+
+  if (!ctx || !*ctx)
+    return;
+
+  if ((*ctx)->flags & AVFMT_FLAG_CUSTOM_IO)
+    pb = (*ctx)->pb;
+
+  avformat_close_input (ctx);
+  lavf_io_free (pb);
+}
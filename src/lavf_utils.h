@@ -23,6 +23,8 @@
 #define VALHALLA_LAVF_UTILS
 
 const char *vh_lavf_utils_fmtname_get (const char *suffix);
-AVFormatContext *vh_lavf_utils_open_input_file (const char *file);
+AVFormatContext *vh_lavf_utils_open_input_file (const char *file,
+                                                throttle_t *throttle);
+void vh_lavf_utils_close_input_file (AVFormatContext **ctx);
 
 #endif /* VALHALLA_LAVF_UTILS */
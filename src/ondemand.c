@@ -22,6 +22,7 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/stat.h>
 
 #include "valhalla.h"
@@ -45,6 +46,25 @@
 
 #define VH_HANDLE ondemand->valhalla
 
+/*
+ * The express lane is the list of the files requested by the ondemand
+ * and which are not ended. The stages are never paused; a file of this
+ * list is promoted to the HIGH priority by the dispatcher and by the
+ * dbmanager (vh_ondemand_express()) when it goes to the next stage, and
+ * the queues are only used to move up the file where it is waiting.
+ */
+typedef struct ondemand_express_s {
+  struct ondemand_express_s *next;
+  char *path;
+} ondemand_express_t;
+
+/* Queues where an ondemand file can be waiting. */
+typedef struct ondemand_queue_s {
+  void *handler;
+  fifo_queue_t *(*fct_fifo_get) (void *handler);
+  fifo_queue_t *fifo;
+} ondemand_queue_t;
+
 struct ondemand_s {
   valhalla_t   *valhalla;
   pthread_t     thread;
@@ -55,6 +75,10 @@ struct ondemand_s {
   int             run;
   pthread_mutex_t mutex_run;
 
+  ondemand_express_t *express;
+  ondemand_hint_t    *hints;  /* removed only by the ondemand thread */
+  pthread_mutex_t     mutex_express;
+
   vh_stats_cnt_t *st_cnt;
   vh_stats_tmr_t *st_tmr;
 };
@@ -62,6 +86,32 @@ struct ondemand_s {
 #define STATS_GROUP "ondemand"
 
 
+void
+vh_ondemand_files_free (ondemand_files_t *files)
+{
+  unsigned int i;
+
+  if (!files)
+    return;
+
+  for (i = 0; i < files->nb; i++)
+    if (files->files[i])
+      free (files->files[i]);
+  free (files);
+}
+
+void
+vh_ondemand_hint_free (ondemand_hint_t *hint)
+{
+  if (!hint)
+    return;
+
+  if (hint->path)
+    free (hint->path);
+  free (hint);
+}
+
+
 static inline int
 ondemand_is_stopped (ondemand_t *ondemand)
 {
@@ -96,6 +146,308 @@ ondemand_cmp_fct (const void *tocmp, int id, const void *data)
   }
 }
 
+/*
+ * ACTION_DB_END is never moved up, else it can be handled by the dbmanager
+ * before the other entries of the same file (then the file is freed).
+ */
+static int
+ondemand_moveup_cmp_fct (const void *tocmp, int id, const void *data)
+{
+  if (id == ACTION_DB_END)
+    return -1;
+
+  return ondemand_cmp_fct (tocmp, id, data);
+}
+
+/* Key of the entries for the index of the fifo queues. */
+static const char *
+ondemand_key_fct (int id, const void *data)
+{
+  const file_data_t *fdata = data;
+
+  if (!data)
+    return NULL;
+
+  switch (id)
+  {
+  case ACTION_DB_INSERT_P:
+  case ACTION_DB_INSERT_G:
+  case ACTION_DB_UPDATE_P:
+  case ACTION_DB_UPDATE_G:
+  case ACTION_DB_END:
+  case ACTION_DB_NEWFILE:
+    return fdata->file.path;
+
+  default:
+    return NULL;
+  }
+}
+
+/* Add a file in the express lane, 0 is returned if it is already there. */
+static int
+ondemand_express_add (ondemand_t *ondemand, const char *file)
+{
+  int res = 0;
+  ondemand_express_t *it;
+
+  pthread_mutex_lock (&ondemand->mutex_express);
+
+  for (it = ondemand->express; it; it = it->next)
+    if (!strcmp (it->path, file))
+      goto out;
+
+  it = calloc (1, sizeof (ondemand_express_t));
+  if (!it)
+    goto out;
+
+  it->path = strdup (file);
+  if (!it->path)
+  {
+    free (it);
+    goto out;
+  }
+
+  it->next = ondemand->express;
+  ondemand->express = it;
+  res = 1;
+
+ out:
+  pthread_mutex_unlock (&ondemand->mutex_express);
+  return res;
+}
+
+/*
+ * Engage the ondemand for a set of files in a single pass. The unavailable
+ * entries of \p files are released and set to NULL.
+ */
+static void
+ondemand_engage (ondemand_t *ondemand,
+                 const ondemand_queue_t *queues, unsigned int nb_queues,
+                 char **files, unsigned int nb)
+{
+  unsigned int i, j;
+  struct stat *st;
+  int64_t *mtime;
+  int *complete;
+
+  st       = calloc (nb, sizeof (*st));
+  mtime    = calloc (nb, sizeof (*mtime));
+  complete = calloc (nb, sizeof (*complete));
+  if (!st || !mtime || !complete)
+    goto out;
+
+  for (i = 0; i < nb; i++)
+  {
+    if (!files[i])
+      continue;
+
+    if (!lstat (files[i], &st[i]))
+    {
+      mtime[i] = (int64_t) st[i].st_mtime;
+      continue;
+    }
+
+    vh_log (VALHALLA_MSG_WARNING,
+            "[%s] File %s unavailable", __FUNCTION__, files[i]);
+    free (files[i]);
+    files[i] = NULL;
+  }
+
+  /*
+   * Ignore the ondemand query if the file is already fully available.
+   * The ENDED event is sent by this function for all complete files.
+   */
+  if (vh_dbmanager_files_complete (VH_HANDLE->dbmanager,
+                                   (const char **) files,
+                                   mtime, complete, nb) == nb)
+    goto out;
+
+  VH_STATS_TIMER_START (ondemand->st_tmr);
+
+  for (i = 0; i < nb; i++)
+  {
+    int express, found = 0;
+    file_data_t *fdata = NULL;
+    const char *file = files[i];
+
+    if (!file || complete[i])
+      continue;
+
+    VH_STATS_COUNTER_INC (ondemand->st_cnt);
+
+    /*
+     * The file is added in the express lane, then the next stages will
+     * handle it before the other files. Nothing is paused; if the file is
+     * waiting in a queue, all its entries are moved up (in their order) in
+     * order to leave its current stage without delay.
+     */
+    express = ondemand_express_add (ondemand, file);
+    for (j = 0; j < nb_queues; j++)
+      found |= vh_fifo_queue_moveup (queues[j].fifo,
+                                     file, ondemand_moveup_cmp_fct);
+
+    /*
+     * Not in the queues, then the file is not handled or it is in progress
+     * in a stage (it is promoted when it leaves this stage). The dbmanager
+     * drops the new entry when the file is in flight, then the express
+     * entry is kept until the ACTION_DB_END of the file in flight.
+     */
+    if (found || !express)
+      continue;
+
+    /* Check if the file is available and consistent. */
+    if (S_ISREG (st[i].st_mode)
+        && !vh_scanner_suffix_cmp (VH_HANDLE->scanner, file))
+    {
+      int outofpath = !!vh_scanner_path_cmp (VH_HANDLE->scanner, file);
+
+      fdata = vh_file_data_new (file, &st[i], outofpath, OD_TYPE_NEW,
+                                FIFO_QUEUE_PRIORITY_HIGH, STEP_PARSING);
+      if (fdata)
+        vh_dbmanager_action_send (VH_HANDLE->dbmanager, fdata->priority,
+                                  ACTION_DB_NEWFILE, fdata);
+    }
+    else
+      vh_log (VALHALLA_MSG_WARNING,
+              "[%s] File %s unsupported", __FUNCTION__, file);
+
+    /* nothing will end this file */
+    if (!fdata)
+      vh_ondemand_express_end (ondemand, file);
+  }
+
+  VH_STATS_TIMER_STOP (ondemand->st_tmr);
+
+ out:
+  if (st)
+    free (st);
+  if (mtime)
+    free (mtime);
+  if (complete)
+    free (complete);
+}
+
+/* Return 1 if \p path is the directory \p dir or in its tree. */
+static int
+ondemand_hint_under (const char *dir, const char *path)
+{
+  size_t len = strlen (dir);
+
+  if (len == 1 && *dir == '/')
+    return 1;
+
+  return !strncmp (dir, path, len) && (path[len] == '/' || path[len] == '\0');
+}
+
+/*
+ * Return 1 if \p path is in a hinted directory, or a parent of a hinted
+ * directory with \p ancestor. The mutex must be locked.
+ */
+static int
+ondemand_hint_match (ondemand_t *ondemand, const char *path, int ancestor)
+{
+  time_t now;
+  ondemand_hint_t *it;
+
+  if (!ondemand->hints)
+    return 0;
+
+  now = time (NULL);
+  for (it = ondemand->hints; it; it = it->next)
+    if (it->expire > now
+        && (ondemand_hint_under (it->path, path)
+            || (ancestor && ondemand_hint_under (path, it->path))))
+      return 1;
+
+  return 0;
+}
+
+static int
+ondemand_hint_cmp_fct (const void *tocmp, int id, const void *data)
+{
+  const char *file = ondemand_key_fct (id, data);
+
+  /*
+   * The raised entries are appended by level, an END (lowest priority of
+   * its file) can be appended before an older entry of the same file.
+   */
+  if (id == ACTION_DB_END)
+    return -1;
+
+  /* the files of a batch are in the same directory */
+  if (id == ACTION_DB_NEWFILES && data)
+  {
+    const dbmanager_files_t *files = data;
+    file = files->nb ? files->files[0]->file.path : NULL;
+  }
+
+  if (!tocmp || !file)
+    return -1;
+
+  return !ondemand_hint_under (tocmp, file);
+}
+
+/*
+ * The hint replaces the previous one for the same directory. The files
+ * already in the queues are raised to the BROWSED level, the next ones are
+ * raised by vh_ondemand_express() and by the scanner.
+ */
+static void
+ondemand_hint (ondemand_t *ondemand,
+               const ondemand_queue_t *queues, unsigned int nb_queues,
+               ondemand_hint_t *hint)
+{
+  unsigned int i, nb = 0;
+  time_t now = time (NULL);
+  ondemand_hint_t **it;
+
+  pthread_mutex_lock (&ondemand->mutex_express);
+
+  for (it = &ondemand->hints; *it; it = &(*it)->next)
+    if (!strcmp ((*it)->path, hint->path))
+    {
+      ondemand_hint_t *old = *it;
+      *it = old->next;
+      vh_ondemand_hint_free (old);
+      break;
+    }
+
+  hint->next = ondemand->hints;
+  ondemand->hints = hint;
+
+  pthread_mutex_unlock (&ondemand->mutex_express);
+
+  if (hint->expire > now)
+  {
+    for (i = 0; i < nb_queues; i++)
+      nb += vh_fifo_queue_raise (queues[i].fifo, FIFO_QUEUE_PRIORITY_BROWSED,
+                                 hint->path, ondemand_hint_cmp_fct);
+
+    vh_log (VALHALLA_MSG_VERBOSE, "[%s] %s: %u files raised",
+            __FUNCTION__, hint->path, nb);
+  }
+
+  /* the expired (and cancelled) hints are removed */
+  pthread_mutex_lock (&ondemand->mutex_express);
+
+  it = &ondemand->hints;
+  while (*it)
+  {
+    ondemand_hint_t *old = *it;
+
+    if (old->expire > now)
+    {
+      it = &old->next;
+      continue;
+    }
+
+    *it = old->next;
+    vh_ondemand_hint_free (old);
+  }
+
+  pthread_mutex_unlock (&ondemand->mutex_express);
+}
+
 static void *
 ondemand_thread (void *arg)
 {
@@ -103,27 +455,16 @@ ondemand_thread (void *arg)
   int e;
   unsigned int i = 0;
   void *data = NULL;
-  char *file;
-  file_data_t *fdata;
   ondemand_t *ondemand = arg;
 
-  struct {
-    void *handler;
-    void (*fct_pause) (void *handler);
-    fifo_queue_t *(*fct_fifo_get) (void *handler);
-  } pause[] = {
-    /*
-     * Because the grabber can be in waiting on the dbmanager, it must be
-     * the first to be sent in the pause mode. And in all cases, it is better
-     * to keep the dbmanager at the end of this list.
-     */
+  ondemand_queue_t queues[] = {
 #ifdef USE_GRABBER
-    { NULL, (void *) vh_grabber_pause,    (void *) vh_grabber_fifo_get    },
-    { NULL, (void *) vh_downloader_pause, (void *) vh_downloader_fifo_get },
+    { NULL, (void *) vh_grabber_fifo_get,    NULL },
+    { NULL, (void *) vh_downloader_fifo_get, NULL },
 #endif /* USE_GRABBER */
-    { NULL, (void *) vh_parser_pause,     (void *) vh_parser_fifo_get     },
-    { NULL, (void *) vh_dispatcher_pause, (void *) vh_dispatcher_fifo_get },
-    { NULL, (void *) vh_dbmanager_pause,  (void *) vh_dbmanager_fifo_get  },
+    { NULL, (void *) vh_parser_fifo_get,     NULL },
+    { NULL, (void *) vh_dispatcher_fifo_get, NULL },
+    { NULL, (void *) vh_dbmanager_fifo_get,  NULL },
   };
 
   if (!ondemand)
@@ -135,17 +476,22 @@ ondemand_thread (void *arg)
           "[%s] tid: %i priority: %i", __FUNCTION__, tid, ondemand->priority);
 
 #ifdef USE_GRABBER
-  pause[i++].handler = VH_HANDLE->grabber;
-  pause[i++].handler = VH_HANDLE->downloader;
+  queues[i++].handler = VH_HANDLE->grabber;
+  queues[i++].handler = VH_HANDLE->downloader;
 #endif /* USE_GRABBER */
-  pause[i++].handler = VH_HANDLE->parser;
-  pause[i++].handler = VH_HANDLE->dispatcher;
-  pause[i++].handler = VH_HANDLE->dbmanager;
+  queues[i++].handler = VH_HANDLE->parser;
+  queues[i++].handler = VH_HANDLE->dispatcher;
+  queues[i++].handler = VH_HANDLE->dbmanager;
+
+  /* the queues are indexed in order to find the entries in constant time */
+  for (i = 0; i < ARRAY_NB_ELEMENTS (queues); i++)
+  {
+    queues[i].fifo = queues[i].fct_fifo_get (queues[i].handler);
+    vh_fifo_queue_index_set (queues[i].fifo, ondemand_key_fct);
+  }
 
   do
   {
-    int id = 0;
-    struct stat st;
     e = ACTION_NO_OPERATION;
     data = NULL;
 
@@ -156,91 +502,25 @@ ondemand_thread (void *arg)
     if (e == ACTION_KILL_THREAD)
       break;
 
-    if (e != ACTION_OD_ENGAGE)
-      continue;
-
-    fdata = NULL;
-    file  = data;
-
-    if (lstat (file, &st))
+    if (e == ACTION_OD_ENGAGE)
     {
-      vh_log (VALHALLA_MSG_WARNING,
-              "[%s] File %s unavailable", __FUNCTION__, file);
-      free (file);
-      continue;
-    }
+      char *file = data;
 
-    /*
-     * Ignore the ondemand query if the file is already fully available.
-     * The ENDED event is sent by this function if the return value is 1.
-     */
-    if (vh_dbmanager_file_complete (VH_HANDLE->dbmanager,
-                                    file, (int64_t) st.st_mtime))
-    {
-      free (file);
-      continue;
+      ondemand_engage (ondemand,
+                       queues, ARRAY_NB_ELEMENTS (queues), &file, 1);
+      if (file)
+        free (file);
     }
-
-    VH_STATS_COUNTER_INC (ondemand->st_cnt);
-    VH_STATS_TIMER_START (ondemand->st_tmr);
-
-    /*
-     * On-demand engaged, all threads must be in pause mode.
-     * After this loop, we are sure that "all" threads are in waiting list.
-     */
-    for (i = 0; i < ARRAY_NB_ELEMENTS (pause); i++)
-      pause[i].fct_pause (pause[i].handler);
-
-    /*
-     * Maybe the file for "on-demand" is already in a queue, we must check
-     * all queues in order to change its priority.
-     */
-    for (i = 0; i < ARRAY_NB_ELEMENTS (pause) && !fdata; i++)
+    else if (e == ACTION_OD_ENGAGE_MANY)
     {
-      fifo_queue_t *queue = pause[i].fct_fifo_get (pause[i].handler);
-      fdata = vh_fifo_queue_search (queue, &id, file, ondemand_cmp_fct);
-    }
+      ondemand_files_t *files = data;
 
-    /* Already in queues? */
-    if (fdata)
-    {
-      if (id != ACTION_DB_END)
-      {
-        fdata->priority = FIFO_QUEUE_PRIORITY_HIGH;
-
-        /* Move up this entry in the queues. */
-        for (i = 0; i < ARRAY_NB_ELEMENTS (pause); i++)
-        {
-          fifo_queue_t *queue = pause[i].fct_fifo_get (pause[i].handler);
-          vh_fifo_queue_moveup (queue, file, ondemand_cmp_fct);
-        }
-      }
-      if (fdata->od == OD_TYPE_DEF)
-        fdata->od = OD_TYPE_UPD;
+      ondemand_engage (ondemand, queues, ARRAY_NB_ELEMENTS (queues),
+                       files->files, files->nb);
+      vh_ondemand_files_free (files);
     }
-    /* Check if the file is available and consistent. */
-    else if (S_ISREG (st.st_mode)
-             && !vh_scanner_suffix_cmp (VH_HANDLE->scanner, file))
-    {
-      int outofpath = !!vh_scanner_path_cmp (VH_HANDLE->scanner, file);
-
-      fdata = vh_file_data_new (file, &st, outofpath, OD_TYPE_NEW,
-                                FIFO_QUEUE_PRIORITY_HIGH, STEP_PARSING);
-      if (fdata)
-        vh_dbmanager_action_send (VH_HANDLE->dbmanager,
-                                  fdata->priority, ACTION_DB_NEWFILE, fdata);
-    }
-    else
-      vh_log (VALHALLA_MSG_WARNING,
-              "[%s] File %s unsupported", __FUNCTION__, file);
-
-    free (file);
-
-    /* Wake up threads */
-    for (i = 0; i < ARRAY_NB_ELEMENTS (pause); i++)
-      pause[i].fct_pause (pause[i].handler);
-
-    VH_STATS_TIMER_STOP (ondemand->st_tmr);
+    else if (e == ACTION_OD_HINT)
+      ondemand_hint (ondemand, queues, ARRAY_NB_ELEMENTS (queues), data);
   }
   while (!ondemand_is_stopped (ondemand));
 
@@ -263,6 +543,7 @@ vh_ondemand_run (ondemand_t *ondemand, int priority)
 
   pthread_attr_init (&attr);
   pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+  vh_thread_stack_set (&attr, VH_HANDLE->stack_size);
 
   res = pthread_create (&ondemand->thread, &attr, ondemand_thread, ondemand);
   if (res)
@@ -320,8 +601,24 @@ vh_ondemand_uninit (ondemand_t *ondemand)
   if (!ondemand)
     return;
 
+  while (ondemand->express)
+  {
+    ondemand_express_t *it = ondemand->express;
+    ondemand->express = it->next;
+    free (it->path);
+    free (it);
+  }
+
+  while (ondemand->hints)
+  {
+    ondemand_hint_t *hint = ondemand->hints;
+    ondemand->hints = hint->next;
+    vh_ondemand_hint_free (hint);
+  }
+
   vh_fifo_queue_free (ondemand->fifo);
   pthread_mutex_destroy (&ondemand->mutex_run);
+  pthread_mutex_destroy (&ondemand->mutex_express);
 
   free (ondemand);
 }
@@ -370,6 +667,7 @@ vh_ondemand_init (valhalla_t *handle)
   ondemand->valhalla = handle; /* VH_HANDLE */
 
   pthread_mutex_init (&ondemand->mutex_run, NULL);
+  pthread_mutex_init (&ondemand->mutex_express, NULL);
 
   /* init statistics */
   vh_stats_grp_add (handle->stats, STATS_GROUP, ondemand_stats_dump, ondemand);
@@ -396,3 +694,79 @@ vh_ondemand_action_send (ondemand_t *ondemand,
 
   vh_fifo_queue_push (ondemand->fifo, prio, action, data);
 }
+
+/*
+ * Called by the owner of \p fdata before to send it to the next stage. The
+ * file is promoted if it is in the express lane.
+ */
+void
+vh_ondemand_express (ondemand_t *ondemand, file_data_t *fdata)
+{
+  ondemand_express_t *it;
+
+  if (!ondemand || !fdata)
+    return;
+
+  pthread_mutex_lock (&ondemand->mutex_express);
+
+  for (it = ondemand->express; it; it = it->next)
+    if (!strcmp (it->path, fdata->file.path))
+    {
+      fdata->priority = FIFO_QUEUE_PRIORITY_HIGH;
+      if (fdata->od == OD_TYPE_DEF)
+        fdata->od = OD_TYPE_UPD;
+      break;
+    }
+
+  /* in a directory browsed by the user */
+  if (!it && fdata->priority < FIFO_QUEUE_PRIORITY_BROWSED
+      && ondemand_hint_match (ondemand, fdata->file.path, 0))
+    fdata->priority = FIFO_QUEUE_PRIORITY_BROWSED;
+
+  pthread_mutex_unlock (&ondemand->mutex_express);
+}
+
+/* Remove a file of the express lane (ENDED event). */
+void
+vh_ondemand_express_end (ondemand_t *ondemand, const char *file)
+{
+  ondemand_express_t *it, *prev = NULL;
+
+  if (!ondemand || !file)
+    return;
+
+  pthread_mutex_lock (&ondemand->mutex_express);
+
+  for (it = ondemand->express; it; prev = it, it = it->next)
+    if (!strcmp (it->path, file))
+    {
+      if (prev)
+        prev->next = it->next;
+      else
+        ondemand->express = it->next;
+      free (it->path);
+      free (it);
+      break;
+    }
+
+  pthread_mutex_unlock (&ondemand->mutex_express);
+}
+
+/*
+ * Return 1 if \p path is in a hinted directory (see valhalla_priority_hint_dir)
+ * or, with \p ancestor, if a hinted directory is in its tree.
+ */
+int
+vh_ondemand_hinted (ondemand_t *ondemand, const char *path, int ancestor)
+{
+  int res;
+
+  if (!ondemand || !path)
+    return 0;
+
+  pthread_mutex_lock (&ondemand->mutex_express);
+  res = ondemand_hint_match (ondemand, path, ancestor);
+  pthread_mutex_unlock (&ondemand->mutex_express);
+
+  return res;
+}
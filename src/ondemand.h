@@ -22,10 +22,24 @@
 #ifndef VALHALLA_ONDEMAND_H
 #define VALHALLA_ONDEMAND_H
 
+#include <time.h>
+
 #include "fifo_queue.h"
+#include "utils.h"
 
 typedef struct ondemand_s ondemand_t;
 
+typedef struct ondemand_files_s {
+  unsigned int nb;
+  char        *files[];
+} ondemand_files_t;
+
+typedef struct ondemand_hint_s {
+  struct ondemand_hint_s *next;
+  char  *path;    /* directory without trailing '/' */
+  time_t expire;  /* 0 to cancel the hint */
+} ondemand_hint_t;
+
 enum ondemand_errno {
   ONDEMAND_ERROR_HANDLER = -2,
   ONDEMAND_ERROR_THREAD  = -1,
@@ -33,6 +47,9 @@ enum ondemand_errno {
 };
 
 
+void vh_ondemand_files_free (ondemand_files_t *files);
+void vh_ondemand_hint_free (ondemand_hint_t *hint);
+
 int vh_ondemand_run (ondemand_t *ondemand, int priority);
 fifo_queue_t *vh_ondemand_fifo_get (ondemand_t *ondemand);
 void vh_ondemand_stop (ondemand_t *ondemand, int f);
@@ -42,4 +59,8 @@ ondemand_t *vh_ondemand_init (valhalla_t *handle);
 void vh_ondemand_action_send (ondemand_t *ondemand,
                               fifo_queue_prio_t prio, int action, void *data);
 
+void vh_ondemand_express (ondemand_t *ondemand, file_data_t *fdata);
+void vh_ondemand_express_end (ondemand_t *ondemand, const char *file);
+int vh_ondemand_hinted (ondemand_t *ondemand, const char *path, int ancestor);
+
 #endif /* VALHALLA_ONDEMAND_H */
@@ -32,12 +32,15 @@
 #include "osdep.h"
 #include "fifo_queue.h"
 #include "logs.h"
+#include "throttle.h"
 #include "lavf_utils.h"
 #include "metadata.h"
 #include "thread_utils.h"
+#include "thread_scale.h"
 #include "dbmanager.h"
 #include "parser.h"
 #include "dispatcher.h"
+#include "executor.h"
 
 #ifndef PARSER_NB_MAX
 #define PARSER_NB_MAX 8
@@ -53,9 +56,9 @@
 
 struct parser_s {
   valhalla_t   *valhalla;
-  pthread_t     thread[PARSER_NB_MAX];
-  fifo_queue_t *fifo;
-  unsigned int  nb;
+  thread_scale_t *scale;
+  fifo_queue_t  *fifo;
+  unsigned int   nb;
   int           priority;
 
   int    decrapifier;
@@ -367,19 +370,64 @@ parser_stream_info (AVFormatContext *ctx)
   return VALHALLA_FILE_TYPE_NULL;
 }
 
+/* Read the blocks for the signature with the I/O context of the demuxer. */
+static ssize_t
+parser_signature_read (void *handle, unsigned char *buf, size_t size,
+                       int64_t offset)
+{
+  AVIOContext *pb = handle;
+
+  if (avio_seek (pb, offset, SEEK_SET) < 0)
+    return -1;
+
+  return avio_read (pb, buf, (int) size);
+}
+
 static void
 parser_metadata (parser_t *parser, file_data_t *data)
 {
   AVFormatContext *ctx;
 
-  ctx = vh_lavf_utils_open_input_file (data->file.path);
+  ctx = vh_lavf_utils_open_input_file (data->file.path, VH_HANDLE->throttle);
   if (!ctx)
     return;
 
   data->file.type = parser_stream_info (ctx);
   data->meta_parser = parser_metadata_get (parser, ctx, data->file.path);
 
-  avformat_close_input (&ctx);
+  /*
+   * The blocks are read with the context already opened by the demuxer.
+   * The custom I/O context counts its bytes itself in the I/O budget.
+   */
+  if (!(ctx->flags & AVFMT_FLAG_CUSTOM_IO))
+    vh_throttle_take (VH_HANDLE->throttle, THROTTLE_BYTES,
+                      data->file.size < 2 * VH_SIGNATURE_BLOCK
+                      ? (unsigned long) data->file.size
+                      : 2 * VH_SIGNATURE_BLOCK);
+  if (ctx->pb)
+    data->sign = vh_file_signature_read (parser_signature_read,
+                                         ctx->pb, data->file.size);
+  else /* demuxer without file */
+    data->sign = vh_file_signature (data->file.path, data->file.size);
+
+  vh_lavf_utils_close_input_file (&ctx);
+}
+
+static void
+parser_file (parser_t *parser, int e, file_data_t *pdata)
+{
+  if (pdata)
+    parser_metadata (parser, pdata);
+
+  vh_file_data_step_increase (pdata, &e);
+  vh_dispatcher_action_send (VH_HANDLE->dispatcher,
+                             pdata->priority, e, pdata);
+}
+
+static void
+parser_task (void *arg, vh_unused unsigned int slot, int e, void *data)
+{
+  parser_file (arg, e, data);
 }
 
 static void *
@@ -387,14 +435,17 @@ parser_thread (void *arg)
 {
   int res, tid;
   int e;
+  unsigned int id;
+  uint64_t start, end;
   void *data = NULL;
-  file_data_t *pdata;
-  parser_t *parser = arg;
+  parser_t *parser = vh_thread_scale_data (arg, &id);
 
   if (!parser)
     pthread_exit (NULL);
 
   tid = vh_setpriority (parser->priority);
+  if (VH_HANDLE->ioidle)
+    vh_setioprio_idle ();
 
   vh_log (VALHALLA_MSG_VERBOSE,
           "[%s] tid: %i priority: %i", __FUNCTION__, tid, parser->priority);
@@ -417,13 +468,15 @@ parser_thread (void *arg)
       continue;
     }
 
-    pdata = data;
-    if (pdata)
-      parser_metadata (parser, pdata);
+    VH_TIMERNOW (&start);
+    parser_file (parser, e, data);
+    VH_TIMERNOW (&end);
+    vh_thread_scale_sample (parser->scale, end - start);
 
-    vh_file_data_step_increase (pdata, &e);
-    vh_dispatcher_action_send (VH_HANDLE->dispatcher,
-                               pdata->priority, e, pdata);
+    /* no more file, this thread is not necessary */
+    if (vh_thread_scale_retire (parser->scale,
+                                id, vh_fifo_queue_nb (parser->fifo)))
+      break;
   }
   while (!parser_is_stopped (parser));
 
@@ -434,8 +487,6 @@ int
 vh_parser_run (parser_t *parser, int priority)
 {
   int res = PARSER_SUCCESS;
-  unsigned int i;
-  pthread_attr_t attr;
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
@@ -445,21 +496,22 @@ vh_parser_run (parser_t *parser, int priority)
   parser->priority = priority;
   parser->run      = 1;
 
-  pthread_attr_init (&attr);
-  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+  /* the files are parsed by the shared pool of threads */
+  if (VH_HANDLE->executor)
+  {
+    vh_executor_stage_set (VH_HANDLE->executor, STEP_PARSING,
+                           parser->fifo, parser->nb, parser_task, parser);
+    return res;
+  }
 
-  for (i = 0; i < parser->nb; i++)
+  /* only the minimum of threads, the others are started on demand */
+  res = vh_thread_scale_start (parser->scale);
+  if (res)
   {
-    res = pthread_create (&parser->thread[i], &attr, parser_thread, parser);
-    if (res)
-    {
-      res = PARSER_ERROR_THREAD;
-      parser->run = 0;
-      break;
-    }
+    res = PARSER_ERROR_THREAD;
+    parser->run = 0;
   }
 
-  pthread_attr_destroy (&attr);
   return res;
 }
 
@@ -508,18 +560,30 @@ vh_parser_fifo_get (parser_t *parser)
 void
 vh_parser_pause (parser_t *parser)
 {
+  unsigned int nb;
+
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
   if (!parser)
     return;
 
-  VH_THREAD_PAUSE_FCT (parser, parser->nb)
+  if (VH_HANDLE->executor)
+  {
+    vh_executor_pause (VH_HANDLE->executor, STEP_PARSING);
+    return;
+  }
+
+  /* the number of threads must not change while they are paused */
+  nb = vh_thread_scale_freeze (parser->scale, 1);
+  VH_THREAD_PAUSE_FCT (parser, nb)
+  if (!parser->paused)
+    vh_thread_scale_freeze (parser->scale, 0);
 }
 
 void
 vh_parser_stop (parser_t *parser, int f)
 {
-  unsigned int i;
+  unsigned int i, nb;
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
@@ -532,18 +596,25 @@ vh_parser_stop (parser_t *parser, int f)
     parser->run = 0;
     pthread_mutex_unlock (&parser->mutex_run);
 
-    for (i = 0; i < parser->nb; i++)
+    /* the parsers must not sleep for the I/O budget */
+    vh_throttle_abort (VH_HANDLE->throttle, THROTTLE_BYTES);
+
+    /* the pool is stopped by valhalla */
+    if (VH_HANDLE->executor)
+      return;
+
+    nb = vh_thread_scale_stop (parser->scale);
+    for (i = 0; i < nb; i++)
       vh_fifo_queue_push (parser->fifo,
                           FIFO_QUEUE_PRIORITY_HIGH, ACTION_KILL_THREAD, NULL);
     parser->wait = 1;
 
-    VH_THREAD_PAUSE_FORCESTOP (parser, parser->nb)
+    VH_THREAD_PAUSE_FORCESTOP (parser, nb)
   }
 
   if (f & STOP_FLAG_WAIT && parser->wait)
   {
-    for (i = 0; i < parser->nb; i++)
-      pthread_join (parser->thread[i], NULL);
+    vh_thread_scale_join (parser->scale);
     parser->wait = 0;
   }
 }
@@ -564,6 +635,7 @@ vh_parser_uninit (parser_t *parser)
     free (parser->bl_list);
   }
 
+  vh_thread_scale_free (parser->scale);
   vh_fifo_queue_free (parser->fifo);
   pthread_mutex_destroy (&parser->mutex_run);
   VH_THREAD_PAUSE_UNINIT (parser)
@@ -572,7 +644,8 @@ vh_parser_uninit (parser_t *parser)
 }
 
 parser_t *
-vh_parser_init (valhalla_t *handle, unsigned int nb, unsigned int decrapifier)
+vh_parser_init (valhalla_t *handle,
+                unsigned int nb, unsigned int min, unsigned int decrapifier)
 {
   parser_t *parser;
 
@@ -585,7 +658,7 @@ vh_parser_init (valhalla_t *handle, unsigned int nb, unsigned int decrapifier)
   if (!parser)
     return NULL;
 
-  if (nb > ARRAY_NB_ELEMENTS (parser->thread))
+  if (nb > PARSER_NB_MAX)
     goto err;
 
   parser->fifo = vh_fifo_queue_new ();
@@ -596,6 +669,11 @@ vh_parser_init (valhalla_t *handle, unsigned int nb, unsigned int decrapifier)
   parser->nb          = nb ? nb : PARSER_NUMBER_DEF;
   parser->decrapifier = !!decrapifier;
 
+  parser->scale = vh_thread_scale_new (min, parser->nb, handle->stack_size,
+                                       parser_thread, parser);
+  if (!parser->scale)
+    goto err;
+
   pthread_mutex_init (&parser->mutex_run, NULL);
   VH_THREAD_PAUSE_INIT (parser)
 
@@ -616,4 +694,24 @@ vh_parser_action_send (parser_t *parser,
     return;
 
   vh_fifo_queue_push (parser->fifo, prio, action, data);
+  if (VH_HANDLE->executor)
+    vh_executor_notify (VH_HANDLE->executor, STEP_PARSING);
+  else
+    vh_thread_scale_grow (parser->scale, vh_fifo_queue_nb (parser->fifo));
+}
+
+void
+vh_parser_action_send_wait (parser_t *parser,
+                            fifo_queue_prio_t prio, int action, void *data)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!parser)
+    return;
+
+  vh_fifo_queue_push_wait (parser->fifo, prio, action, data);
+  if (VH_HANDLE->executor)
+    vh_executor_notify (VH_HANDLE->executor, STEP_PARSING);
+  else
+    vh_thread_scale_grow (parser->scale, vh_fifo_queue_nb (parser->fifo));
 }
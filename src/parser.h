@@ -40,12 +40,15 @@ void vh_parser_pause (parser_t *parser);
 fifo_queue_t *vh_parser_fifo_get (parser_t *parser);
 void vh_parser_stop (parser_t *parser, int f);
 void vh_parser_uninit (parser_t *parser);
-parser_t *vh_parser_init (valhalla_t *handle,
-                          unsigned int nb, unsigned int decrapifier);
+parser_t *vh_parser_init (valhalla_t *handle, unsigned int nb,
+                          unsigned int min, unsigned int decrapifier);
 
 void vh_parser_bl_keyword_add (parser_t *parser, const char *keyword);
 
 void vh_parser_action_send (parser_t *parser,
                             fifo_queue_prio_t prio, int action, void *data);
+void vh_parser_action_send_wait (parser_t *parser,
+                                 fifo_queue_prio_t prio,
+                                 int action, void *data);
 
 #endif /* VALHALLA_PARSER_H */
@@ -25,9 +25,25 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
 #include <dirent.h>
 #include <sys/stat.h>
 
+#ifdef HAVE_FSTATAT
+#include <fcntl.h>
+#endif /* HAVE_FSTATAT */
+
+#ifdef HAVE_GETMNTENT
+#include <mntent.h>
+#endif /* HAVE_GETMNTENT */
+
+#ifdef USE_INOTIFY
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif /* USE_INOTIFY */
+
 #include "valhalla.h"
 #include "valhalla_internals.h"
 #include "utils.h"
@@ -37,21 +53,152 @@
 #include "thread_utils.h"
 #include "timer_thread.h"
 #include "dbmanager.h"
+#include "ondemand.h"
 #include "event_handler.h"
+#include "stats.h"
+#include "throttle.h"
 #include "scanner.h"
 
 #ifndef PATH_RECURSIVENESS_MAX
 #define PATH_RECURSIVENESS_MAX 42
 #endif /* PATH_RECURSIVENESS_MAX */
 
+/* The files modified since less than one day are handled before the others. */
+#define RECENT_DELAY (24 * 60 * 60) /* [sec] */
+
+#ifdef USE_INOTIFY
+#define WATCH_HASH_SIZE     256
+#define WATCH_POLL_TIMEOUT  500 /* [msec] */
+#define WATCH_BUFFER_SIZE   4096
+#define WATCH_EVENTS                                          \
+  (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM   \
+   | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+struct watch_s {
+  struct watch_s *next;
+  int    wd;
+  int    recursive;
+  char  *location;
+  time_t mtime;  /* of the directory when watched, 0 if unknown */
+};
+#endif /* USE_INOTIFY */
+
+/*
+ * The scanner paths are indexed in a tree where each node is a component of
+ * a path (the root of the absolute paths is the component "/"). The children
+ * are sorted by name for a binary search.
+ */
+typedef struct path_node_s {
+  char         *name;
+  size_t        len;
+  int           depth;  /* max depth of the files, 0 if no path ends here */
+  struct path_s *path;
+  unsigned int  nb;
+  struct path_node_s **childs;
+} path_node_t;
+
+/*
+ * Exclusion patterns (*, ? and [...] are supported). A pattern without '/'
+ * is compared with the name of each file and directory, else with the path
+ * relative to the scanner path.
+ */
+struct exclude_s {
+  struct exclude_s *next;
+  char *pattern;
+  int   glob;     /* 0 for a plain name */
+  int   anchored; /* compared with the relative path */
+};
+
+#define SUFFIX_HASH_SIZE 128
+
+/* The suffixes are saved in lowercase. */
+struct suffix_s {
+  struct suffix_s *next;
+  char  *name;
+  size_t len;
+};
+
+#ifndef WALKER_NB_MAX
+#define WALKER_NB_MAX 16
+#endif /* WALKER_NB_MAX */
+
+#define WALKER_DEQUE_SIZE 64
+
+#define DIRCACHE_HASH_SIZE  1024
+#define DIRCACHE_FNV_OFFSET 0xcbf29ce484222325ULL
+#define DIRCACHE_FNV_PRIME  0x100000001b3ULL
+
+struct dircache_s {
+  struct dircache_s *next;
+  char   *location;
+  int64_t mtime;
+  int64_t hash;
+};
+
+typedef struct walker_dir_s {
+  struct walker_dir_s *prev, *next; /* pending directories */
+  struct path_s *root;
+  char *location;   /* full path of the directory */
+  int   recursive;  /* recursiveness for this directory */
+  int  *files;      /* counter of files sent to the dbmanager */
+} walker_dir_t;
+
+typedef struct walker_s {
+  struct scanner_s *scanner;
+  unsigned int      nb;
+  int               prune;    /* unchanged directories are pruned */
+
+  struct walker_deque_s {
+    pthread_mutex_t mutex;
+    walker_dir_t  **dirs;
+    unsigned int    size;
+    unsigned int    top;
+    unsigned int    count;
+  } *deques;
+
+  struct walker_thread_s {
+    struct walker_s *walker;
+    pthread_t        thread;
+    unsigned int     id;
+    int              run;
+  } *threads;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+  unsigned int    queued;   /* directories in the deques */
+  unsigned int    pending;  /* directories queued or being read */
+  walker_dir_t   *dirs;     /* list of the pending directories */
+
+  int             checkpoint;      /* the position is saved periodically */
+  int             resume;          /* skip the directories already handled */
+  int             broken;          /* a directory is not fully read */
+  time_t          checkpoint_time; /* last saved position */
+
+#ifdef USE_INOTIFY
+  /* rescan after an events overflow (watch mode) */
+  char          **watched;    /* sorted, these sub-directories are skipped */
+  unsigned int    watched_nb;
+  char          **rescan;     /* directories read again */
+  unsigned int    rescan_nb;
+#endif /* USE_INOTIFY */
+} walker_t;
+
 #define VH_HANDLE scanner->valhalla
 
+#define STATS_GROUP       "scanner"
+#define STATS_OUTSTANDING "outstanding"
+
 struct scanner_s {
   valhalla_t   *valhalla;
   pthread_t     thread;
   fifo_queue_t *fifo;
   int           priority;
   int           loop;
+  int           watch;
+  int           pruning;
+  int           checkpoint; /* interval in seconds */
+  int           offline;    /* keep the files of the unreachable paths */
+  unsigned int  walker_nb;
 
   int             wait;
   int             run;
@@ -61,16 +208,450 @@ struct scanner_s {
   uint64_t        delay;
   timer_thread_t *timer;
 
+  /* files (and directories) sent to the dbmanager and not yet handled */
+  unsigned int    outstanding;
+  pthread_mutex_t mutex_ack;
+  pthread_cond_t  cond_ack;
+  vh_stats_cnt_t *st_outstanding;
+
+  /* protect the offline states of the paths (read by the dbmanager) */
+  pthread_mutex_t mutex_offline;
+
   struct path_s {
     struct path_s *next;
     char *location;
     int recursive;
     int nb_files;
+    struct exclude_s *exclude;
+    char *resume;  /* checkpoint of the interrupted scan, "" when done */
+    int offline;   /* unreachable with the last loop */
+    int mounted;   /* seen as a mount point */
+    dev_t dev;
+#ifdef USE_INOTIFY
+    int fd;
+    struct watch_s *watches[WATCH_HASH_SIZE];
+#endif /* USE_INOTIFY */
   } *paths;
-  char **suffix;
+  path_node_t *path_tree;
+  struct exclude_s *exclude; /* for all paths */
+
+  /* hash set of the suffixes */
+  struct suffix_s *suffix[SUFFIX_HASH_SIZE];
+  unsigned int     suffix_nb;
+  size_t           suffix_len;  /* length of the longest suffix */
+
+  /* directories pruning */
+  struct dircache_s **dircache; /* states saved by the previous loop */
+  struct dircache_s  *dirs;     /* changed directories to save */
+  int                 dirs_nb;  /* unchanged directories sent */
+  uint64_t            dirs_salt;
+  time_t              dirs_time;
 };
 
 
+#ifdef USE_INOTIFY
+static struct watch_s *
+watch_get (struct path_s *path, int wd)
+{
+  struct watch_s *watch;
+
+  if (wd < 0)
+    return NULL;
+
+  for (watch = path->watches[wd % WATCH_HASH_SIZE]; watch; watch = watch->next)
+    if (watch->wd == wd)
+      return watch;
+
+  return NULL;
+}
+
+static void
+watch_add (struct path_s *path,
+           const char *location, int recursive, time_t mtime)
+{
+  int wd;
+  struct watch_s *watch;
+
+  if (path->fd < 0)
+    return;
+
+  wd = inotify_add_watch (path->fd, location, WATCH_EVENTS);
+  if (wd < 0)
+  {
+    vh_log (VALHALLA_MSG_WARNING,
+            "[%s] Impossible to watch : %s", __FUNCTION__, location);
+    return;
+  }
+
+  /* the same directory can be added again, after an overflow for example */
+  watch = watch_get (path, wd);
+  if (watch)
+  {
+    if (strcmp (watch->location, location))
+    {
+      char *it = strdup (location);
+      if (!it)
+        return;
+      free (watch->location);
+      watch->location = it;
+    }
+    watch->recursive = recursive;
+    watch->mtime     = mtime;
+    return;
+  }
+
+  watch = calloc (1, sizeof (struct watch_s));
+  if (!watch)
+    return;
+
+  watch->location = strdup (location);
+  if (!watch->location)
+  {
+    free (watch);
+    return;
+  }
+
+  watch->wd        = wd;
+  watch->recursive = recursive;
+  watch->mtime     = mtime;
+  watch->next      = path->watches[wd % WATCH_HASH_SIZE];
+  path->watches[wd % WATCH_HASH_SIZE] = watch;
+}
+
+static void
+watch_del (struct path_s *path, int wd)
+{
+  struct watch_s *watch, *prev = NULL;
+
+  if (wd < 0)
+    return;
+
+  for (watch = path->watches[wd % WATCH_HASH_SIZE]; watch; watch = watch->next)
+  {
+    if (watch->wd != wd)
+    {
+      prev = watch;
+      continue;
+    }
+
+    if (prev)
+      prev->next = watch->next;
+    else
+      path->watches[wd % WATCH_HASH_SIZE] = watch->next;
+
+    free (watch->location);
+    free (watch);
+    return;
+  }
+}
+
+/* Remove the watches on a directory and on all its sub-directories. */
+static void
+watch_tree_del (struct path_s *path, const char *location)
+{
+  int i;
+  size_t len = strlen (location);
+
+  for (i = 0; i < WATCH_HASH_SIZE; i++)
+  {
+    struct watch_s *watch = path->watches[i];
+
+    while (watch)
+    {
+      int wd = watch->wd;
+      const char *it = watch->location;
+
+      watch = watch->next;
+      if (strncmp (it, location, len) || (it[len] != '/' && it[len] != '\0'))
+        continue;
+
+      inotify_rm_watch (path->fd, wd);
+      watch_del (path, wd);
+    }
+  }
+}
+
+static void
+watch_free (struct path_s *path)
+{
+  int i;
+
+  for (i = 0; i < WATCH_HASH_SIZE; i++)
+    while (path->watches[i])
+    {
+      struct watch_s *watch = path->watches[i];
+
+      path->watches[i] = watch->next;
+      free (watch->location);
+      free (watch);
+    }
+
+  if (path->fd >= 0)
+    close (path->fd);
+  path->fd = -1;
+}
+#endif /* USE_INOTIFY */
+
+/* Return the next component of a path (the slashes are skipped). */
+static const char *
+path_component (const char *it, size_t *len)
+{
+  while (*it == '/')
+    it++;
+
+  *len = strcspn (it, "/");
+  return *it ? it : NULL;
+}
+
+static void
+exclude_free (struct exclude_s *exclude)
+{
+  struct exclude_s *next;
+
+  for (; exclude; exclude = next)
+  {
+    next = exclude->next;
+    free (exclude->pattern);
+    free (exclude);
+  }
+}
+
+static void
+exclude_add (struct exclude_s **list, const char *pattern)
+{
+  const char *it;
+  struct exclude_s *exclude;
+
+  /* the patterns are always relative to the scanner path */
+  while (*pattern == '/')
+    pattern++;
+
+  if (!*pattern)
+    return;
+
+  for (exclude = *list; exclude; exclude = exclude->next)
+    if (!strcmp (exclude->pattern, pattern))
+      return;
+
+  exclude = calloc (1, sizeof (struct exclude_s));
+  if (!exclude)
+    return;
+
+  exclude->pattern = strdup (pattern);
+  if (!exclude->pattern)
+  {
+    free (exclude);
+    return;
+  }
+
+  /* trailing slashes are useless, only the entries are compared */
+  it = exclude->pattern + strlen (exclude->pattern);
+  while (it > exclude->pattern && *(it - 1) == '/')
+    *(char *) --it = '\0';
+
+  exclude->glob     = !!strpbrk (exclude->pattern, "*?[\\");
+  exclude->anchored = !!strchr (exclude->pattern, '/');
+  exclude->next     = *list;
+  *list = exclude;
+}
+
+/*
+ * Compare a character with a class. \p pat is the position after '[' and it
+ * is moved after ']'. -1 is returned when the class is not terminated.
+ */
+static int
+exclude_class (const char **pat, char c)
+{
+  int neg = 0, match = 0;
+  const char *p = *pat;
+
+  if (*p == '!' || *p == '^')
+  {
+    neg = 1;
+    p++;
+  }
+
+  if (*p == ']')
+  {
+    match = c == ']';
+    p++;
+  }
+
+  for (; *p && *p != ']'; p++)
+    if (*(p + 1) == '-' && *(p + 2) && *(p + 2) != ']')
+    {
+      if (c >= *p && c <= *(p + 2))
+        match = 1;
+      p += 2;
+    }
+    else if (*p == c)
+      match = 1;
+
+  if (!*p)
+    return -1;
+
+  *pat = p + 1;
+  return match != neg;
+}
+
+/*
+ * Compare \p len chars of \p str with a pattern. When the pattern is
+ * anchored, the wildcards never match '/'.
+ */
+static int
+exclude_glob (const char *pat, const char *str, size_t len, int anchored)
+{
+  const char *s = str, *end = str + len;
+  const char *bp = NULL, *bs = NULL; /* to backtrack on the last '*' */
+
+  while (s < end)
+  {
+    int ok;
+    const char *p = pat;
+
+    if (*p == '*')
+    {
+      bp = ++pat;
+      bs = s;
+      continue;
+    }
+
+    if (*p == '?')
+    {
+      ok = !anchored || *s != '/';
+      p++;
+    }
+    else if (*p == '[')
+    {
+      p++;
+      ok = exclude_class (&p, *s);
+      if (ok < 0) /* not a class, '[' is a normal char */
+        ok = *s == '[';
+      else if (anchored && *s == '/')
+        ok = 0;
+    }
+    else
+    {
+      if (*p == '\\' && *(p + 1))
+        p++;
+      ok = *p && *p == *s;
+      p++;
+    }
+
+    if (ok)
+    {
+      pat = p;
+      s++;
+      continue;
+    }
+
+    if (!bp || (anchored && *bs == '/'))
+      return 0;
+
+    pat = bp;
+    s   = ++bs;
+  }
+
+  while (*pat == '*')
+    pat++;
+
+  return !*pat;
+}
+
+static int
+exclude_match (struct exclude_s *exclude,
+               const char *name, size_t name_len,
+               const char *rel, size_t rel_len)
+{
+  for (; exclude; exclude = exclude->next)
+  {
+    const char *str = exclude->anchored ? rel : name;
+    size_t len = exclude->anchored ? rel_len : name_len;
+
+    if (!str)
+      continue;
+
+    if (exclude->glob)
+    {
+      if (exclude_glob (exclude->pattern, str, len, exclude->anchored))
+        return 1;
+    }
+    else if (!strncmp (exclude->pattern, str, len)
+             && exclude->pattern[len] == '\0')
+      return 1;
+  }
+
+  return 0;
+}
+
+static inline int
+exclude_anchored (struct exclude_s *exclude)
+{
+  for (; exclude; exclude = exclude->next)
+    if (exclude->anchored)
+      return 1;
+  return 0;
+}
+
+/*
+ * Check if an entry of a directory is excluded. \p location is the full
+ * path of the directory which must be in the scanner path \p path.
+ */
+static int
+exclude_entry (scanner_t *scanner, struct path_s *path,
+               const char *location, const char *name)
+{
+  int res;
+  char *rel = NULL;
+  size_t len = 0;
+
+  if (!scanner->exclude && !path->exclude)
+    return 0;
+
+  if (exclude_anchored (scanner->exclude) || exclude_anchored (path->exclude))
+  {
+    const char *it = location + strlen (path->location);
+
+    while (*it == '/')
+      it++;
+
+    len = strlen (it) + strlen (name) + 2;
+    rel = malloc (len);
+    if (rel)
+      len = snprintf (rel, len, "%s%s%s", it, *it ? "/" : "", name);
+  }
+
+  res = exclude_match (scanner->exclude, name, strlen (name), rel, len)
+        || exclude_match (path->exclude, name, strlen (name), rel, len);
+
+  free (rel);
+  return res;
+}
+
+/*
+ * Check if a file is excluded; each component of the path relative to the
+ * scanner path is compared.
+ */
+static int
+exclude_file (scanner_t *scanner, struct path_s *path, const char *rel)
+{
+  size_t len;
+  const char *it;
+
+  if (!scanner->exclude && !path->exclude)
+    return 0;
+
+  while (*rel == '/')
+    rel++;
+
+  for (it = rel; (it = path_component (it, &len)); it += len)
+    if (exclude_match (scanner->exclude, it, len, rel, it + len - rel)
+        || exclude_match (path->exclude, it, len, rel, it + len - rel))
+      return 1;
+
+  return 0;
+}
+
 static void
 path_free (struct path_s *path)
 {
@@ -78,7 +659,11 @@ path_free (struct path_s *path)
 
   while (path)
   {
+#ifdef USE_INOTIFY
+    watch_free (path);
+#endif /* USE_INOTIFY */
     free (path->location);
+    exclude_free (path->exclude);
     path_tmp = path->next;
     free (path);
     path = path_tmp;
@@ -98,173 +683,1802 @@ path_new (const char *location, int recursive)
   if (!path)
     return NULL;
 
-  path->location = strdup (location);
-  it = strrchr (path->location, '/');
-  if (it && it != path->location && *(it + 1) == '\0')
-    *it = '\0';
+  path->location = strdup (location);
+  if (!path->location)
+  {
+    free (path);
+    return NULL;
+  }
+
+  it = strrchr (path->location, '/');
+  if (it && it != path->location && *(it + 1) == '\0')
+    *it = '\0';
+
+  path->recursive = recursive ? PATH_RECURSIVENESS_MAX : 0;
+#ifdef USE_INOTIFY
+  path->fd = -1;
+#endif /* USE_INOTIFY */
+  return path;
+}
+
+static void
+path_node_free (path_node_t *node)
+{
+  unsigned int i;
+
+  if (!node)
+    return;
+
+  for (i = 0; i < node->nb; i++)
+    path_node_free (node->childs[i]);
+
+  free (node->childs);
+  free (node->name);
+  free (node);
+}
+
+static int
+path_node_cmp (const path_node_t *node, const char *name, size_t len)
+{
+  int res = memcmp (node->name, name, node->len < len ? node->len : len);
+  if (res)
+    return res;
+  return node->len < len ? -1 : node->len > len;
+}
+
+/*
+ * Search a child by its name. When the child is not found, \p pos is set
+ * to the index where it must be inserted.
+ */
+static path_node_t *
+path_node_child (path_node_t *node,
+                 const char *name, size_t len, unsigned int *pos)
+{
+  unsigned int lo = 0, hi = node->nb;
+
+  while (lo < hi)
+  {
+    unsigned int mid = (lo + hi) / 2;
+    int res = path_node_cmp (node->childs[mid], name, len);
+
+    if (!res)
+      return node->childs[mid];
+    if (res < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (pos)
+    *pos = lo;
+  return NULL;
+}
+
+static path_node_t *
+path_node_add (path_node_t *node, const char *name, size_t len)
+{
+  unsigned int pos = 0;
+  path_node_t *child, **childs;
+
+  child = path_node_child (node, name, len, &pos);
+  if (child)
+    return child;
+
+  child = calloc (1, sizeof (path_node_t));
+  if (!child)
+    return NULL;
+
+  child->name = malloc (len + 1);
+  childs = realloc (node->childs, (node->nb + 1) * sizeof (*node->childs));
+  if (!child->name || !childs)
+  {
+    free (child->name);
+    free (child);
+    if (childs)
+      node->childs = childs;
+    return NULL;
+  }
+
+  memcpy (child->name, name, len);
+  child->name[len] = '\0';
+  child->len = len;
+
+  node->childs = childs;
+  memmove (node->childs + pos + 1,
+           node->childs + pos, (node->nb - pos) * sizeof (*node->childs));
+  node->childs[pos] = child;
+  node->nb++;
+  return child;
+}
+
+static void
+path_tree_add (scanner_t *scanner, struct path_s *path, int depth)
+{
+  const char *location = path->location;
+  size_t len;
+  const char *it;
+  path_node_t *node;
+
+  if (!scanner->path_tree)
+  {
+    scanner->path_tree = calloc (1, sizeof (path_node_t));
+    if (!scanner->path_tree)
+      return;
+  }
+
+  node = scanner->path_tree;
+  if (*location == '/')
+    node = path_node_add (node, "/", 1);
+
+  for (it = location; node && (it = path_component (it, &len)); it += len)
+    node = path_node_add (node, it, len);
+
+  if (node && node->depth < depth)
+  {
+    node->depth = depth;
+    node->path  = path;
+  }
+}
+
+/*
+ * The file is in the scope of the scanner if at least one path is a parent,
+ * if the number of components between this path and the file is not
+ * greater than the depth limit of the path, and if the file is not
+ * excluded.
+ */
+static int
+path_cmp (scanner_t *scanner, const char *file)
+{
+  int depth = 0;
+  size_t len;
+  const char *it;
+  path_node_t *node = scanner->path_tree;
+
+  if (!file || !node)
+    return -1;
+
+  for (it = file; (it = path_component (it, &len)); it += len)
+    depth++;
+
+  if (*file == '/')
+    node = path_node_child (node, "/", 1, NULL);
+
+  for (it = file; node; it += len, depth--)
+  {
+    if (node->depth && depth <= node->depth
+        && !exclude_file (scanner, node->path, it))
+      return 0;
+
+    it = path_component (it, &len);
+    if (!it)
+      break;
+
+    node = path_node_child (node, it, len, NULL);
+  }
+
+  return -1;
+}
+
+/* The location is a mount point of the file systems table. */
+static int
+path_fstab (const char *location)
+{
+  int res = 0;
+#ifdef HAVE_GETMNTENT
+  FILE *fstab;
+  struct mntent *ent;
+
+  fstab = setmntent ("/etc/fstab", "r");
+  if (!fstab)
+    return 0;
+
+  while ((ent = getmntent (fstab)))
+    if (!strcmp (ent->mnt_dir, location))
+    {
+      res = 1;
+      break;
+    }
+
+  endmntent (fstab);
+#else
+  (void) location;
+#endif /* !HAVE_GETMNTENT */
+  return res;
+}
+
+/*
+ * A path is unreachable when the directory does not exist, when it was a
+ * mount point and the device has changed (the media or the share is
+ * unmounted), or when it is a mount point of the file systems table on the
+ * same device than its parent (never mounted since the init). A local
+ * directory which is only empty is reachable.
+ */
+static int
+path_available (struct path_s *path)
+{
+  int mounted;
+  char *parent;
+  struct stat st, st_parent;
+
+  if (stat (path->location, &st) || !S_ISDIR (st.st_mode))
+    return 0;
+
+  parent = malloc (strlen (path->location) + 4);
+  if (!parent)
+    return 1;
+
+  sprintf (parent, "%s/..", path->location);
+  mounted = stat (parent, &st_parent)
+            || st.st_dev != st_parent.st_dev
+            || st.st_ino == st_parent.st_ino; /* root */
+  free (parent);
+
+  if (mounted)
+  {
+    path->mounted = 1;
+    path->dev     = st.st_dev;
+    return 1;
+  }
+
+  if (path->mounted)
+    return st.st_dev == path->dev;
+
+  return !path_fstab (path->location);
+}
+
+static int
+path_offline (scanner_t *scanner, const char *file)
+{
+  int offline = 0;
+  size_t len;
+  const char *it;
+  struct path_s *path = NULL;
+  path_node_t *node = scanner->path_tree;
+
+  if (!file || !node)
+    return 0;
+
+  if (*file == '/')
+    node = path_node_child (node, "/", 1, NULL);
+
+  /* the deepest path is used with the nested paths */
+  for (it = file; node; it += len)
+  {
+    if (node->depth)
+      path = node->path;
+
+    it = path_component (it, &len);
+    if (!it)
+      break;
+
+    node = path_node_child (node, it, len, NULL);
+  }
+
+  if (!path)
+    return 0;
+
+  pthread_mutex_lock (&scanner->mutex_offline);
+  offline = path->offline;
+  pthread_mutex_unlock (&scanner->mutex_offline);
+
+  return offline;
+}
+
+/* FNV-1a (case insensitive) */
+static unsigned int
+suffix_hash (const char *str)
+{
+  uint32_t hash = 2166136261U;
+
+  for (; *str; str++)
+  {
+    hash ^= (unsigned char) tolower ((unsigned char) *str);
+    hash *= 16777619U;
+  }
+
+  return hash % SUFFIX_HASH_SIZE;
+}
+
+static struct suffix_s *
+suffix_get (scanner_t *scanner, const char *name, size_t len)
+{
+  struct suffix_s *suffix;
+
+  for (suffix = scanner->suffix[suffix_hash (name)]; suffix;
+       suffix = suffix->next)
+    if (suffix->len == len && !strcasecmp (suffix->name, name))
+      return suffix;
+
+  return NULL;
+}
+
+static void
+suffix_free (scanner_t *scanner)
+{
+  int i;
+  struct suffix_s *suffix, *next;
+
+  for (i = 0; i < SUFFIX_HASH_SIZE; i++)
+    for (suffix = scanner->suffix[i]; suffix; suffix = next)
+    {
+      next = suffix->next;
+      free (suffix->name);
+      free (suffix);
+    }
+}
+
+/*
+ * Only the ends of the filename which are preceded by a dot are looked up in
+ * the hash set; usually there is only one lookup by file.
+ */
+static int
+suffix_cmp (scanner_t *scanner, const char *file)
+{
+  const char *it, *end;
+
+  if (!file)
+    return -1;
+
+  if (!scanner->suffix_nb) /* always accepted */
+    return 0;
+
+  end = file + strlen (file);
+
+  for (it = end; it > file && *(it - 1) != '/'; it--)
+  {
+    if (*(it - 1) != '.')
+      continue;
+
+    if ((size_t) (end - it) > scanner->suffix_len)
+      break;
+
+    if (suffix_get (scanner, it, end - it))
+      return 0;
+  }
+
+  return -1;
+}
+
+static inline int
+scanner_is_stopped (scanner_t *scanner)
+{
+  int run;
+  pthread_mutex_lock (&scanner->mutex_run);
+  run = scanner->run;
+  pthread_mutex_unlock (&scanner->mutex_run);
+  return !run;
+}
+
+/*
+ * Every entry sent to the dbmanager must be counted before the send, the
+ * dbmanager acknowledges when the entry is fully handled.
+ */
+static void
+scanner_outstanding_add (scanner_t *scanner, unsigned int nb)
+{
+  pthread_mutex_lock (&scanner->mutex_ack);
+  scanner->outstanding += nb;
+  VH_STATS_COUNTER_SET (scanner->st_outstanding, scanner->outstanding);
+  pthread_mutex_unlock (&scanner->mutex_ack);
+}
+
+/* Wait until that all entries are acknowledged by the dbmanager. */
+static int
+scanner_ack_wait (scanner_t *scanner)
+{
+  int res = 0;
+
+  pthread_mutex_lock (&scanner->mutex_ack);
+  while (scanner->outstanding)
+  {
+    if (scanner_is_stopped (scanner))
+    {
+      res = -1;
+      break;
+    }
+    pthread_cond_wait (&scanner->cond_ack, &scanner->mutex_ack);
+  }
+  pthread_mutex_unlock (&scanner->mutex_ack);
+
+  return res;
+}
+
+/* The files of a directory browsed by the user are handled first. */
+static fifo_queue_prio_t
+scanner_priority (scanner_t *scanner, const char *file, fifo_queue_prio_t p)
+{
+  if (vh_ondemand_hinted (VH_HANDLE->ondemand, file, 0))
+    return FIFO_QUEUE_PRIORITY_BROWSED;
+  return p;
+}
+
+#ifdef USE_INOTIFY
+static int
+scanner_newfile (scanner_t *scanner, const char *file, struct stat *st)
+{
+  file_data_t *data;
+
+  /* new or just modified file */
+  data = vh_file_data_new (file, st, 0, OD_TYPE_DEF,
+                           scanner_priority (scanner, file,
+                                             FIFO_QUEUE_PRIORITY_RECENT),
+                           STEP_PARSING);
+  if (!data)
+    return -1;
+
+  scanner_outstanding_add (scanner, 1);
+  vh_dbmanager_action_send_wait (VH_HANDLE->dbmanager,
+                                 data->priority, ACTION_DB_NEWFILE, data);
+  return 0;
+}
+#endif /* USE_INOTIFY */
+
+/* FNV-1a */
+static uint64_t
+dircache_hash (uint64_t hash, const char *str)
+{
+  for (; *str; str++)
+  {
+    hash ^= (unsigned char) *str;
+    hash *= DIRCACHE_FNV_PRIME;
+  }
+  return hash;
+}
+
+static void
+dircache_free (scanner_t *scanner)
+{
+  int i;
+  struct dircache_s *dc, *next;
+
+  if (scanner->dircache)
+  {
+    for (i = 0; i < DIRCACHE_HASH_SIZE; i++)
+      for (dc = scanner->dircache[i]; dc; dc = next)
+      {
+        next = dc->next;
+        free (dc->location);
+        free (dc);
+      }
+    free (scanner->dircache);
+    scanner->dircache = NULL;
+  }
+
+  for (dc = scanner->dirs; dc; dc = next)
+  {
+    next = dc->next;
+    free (dc->location);
+    free (dc);
+  }
+  scanner->dirs    = NULL;
+  scanner->dirs_nb = 0;
+}
+
+static struct dircache_s *
+dircache_new (const char *location, int64_t mtime, int64_t hash)
+{
+  struct dircache_s *dc;
+
+  dc = calloc (1, sizeof (struct dircache_s));
+  if (!dc)
+    return NULL;
+
+  dc->location = strdup (location);
+  if (!dc->location)
+  {
+    free (dc);
+    return NULL;
+  }
+
+  dc->mtime = mtime;
+  dc->hash  = hash;
+  return dc;
+}
+
+/* The suffixes and the exclusions change the files handled by the scanner. */
+static uint64_t
+dircache_salt (scanner_t *scanner)
+{
+  int i;
+  uint64_t salt = DIRCACHE_FNV_OFFSET;
+  struct suffix_s *suffix;
+  struct exclude_s *exclude;
+  struct path_s *path;
+
+  for (i = 0; i < SUFFIX_HASH_SIZE; i++)
+    for (suffix = scanner->suffix[i]; suffix; suffix = suffix->next)
+      salt += dircache_hash (DIRCACHE_FNV_OFFSET, suffix->name);
+
+  for (exclude = scanner->exclude; exclude; exclude = exclude->next)
+    salt += dircache_hash (DIRCACHE_FNV_OFFSET, exclude->pattern);
+  for (path = scanner->paths; path; path = path->next)
+    for (exclude = path->exclude; exclude; exclude = exclude->next)
+      salt += dircache_hash (dircache_hash (DIRCACHE_FNV_OFFSET, path->location),
+                             exclude->pattern);
+
+  return salt;
+}
+
+/*
+ * Load the states of the directories saved by the previous loop. The
+ * suffixes and the exclusions are part of the hash, then all directories
+ * are read again when they are changed.
+ */
+static void
+dircache_load (scanner_t *scanner)
+{
+  int64_t mtime, hash;
+  const char *location;
+
+  dircache_free (scanner);
+
+  scanner->dirs_time = time (NULL);
+  scanner->dirs_salt = dircache_salt (scanner);
+
+  scanner->dircache = calloc (DIRCACHE_HASH_SIZE, sizeof (*scanner->dircache));
+  if (!scanner->dircache)
+    return;
+
+  while ((location = vh_dbmanager_db_directory_get (VH_HANDLE->dbmanager,
+                                                    &mtime, &hash, 0)))
+  {
+    unsigned int i;
+    struct dircache_s *dc = dircache_new (location, mtime, hash);
+    if (!dc)
+      continue;
+
+    i = dircache_hash (DIRCACHE_FNV_OFFSET, location) % DIRCACHE_HASH_SIZE;
+    dc->next = scanner->dircache[i];
+    scanner->dircache[i] = dc;
+  }
+}
+
+static struct dircache_s *
+dircache_get (scanner_t *scanner, const char *location)
+{
+  unsigned int i;
+  struct dircache_s *dc;
+
+  if (!scanner->dircache)
+    return NULL;
+
+  i = dircache_hash (DIRCACHE_FNV_OFFSET, location) % DIRCACHE_HASH_SIZE;
+  for (dc = scanner->dircache[i]; dc; dc = dc->next)
+    if (!strcmp (dc->location, location))
+      return dc;
+
+  return NULL;
+}
+
+static int
+scanner_directory (scanner_t *scanner, char *location,
+                   int64_t mtime, int64_t hash, int unchanged)
+{
+  dbmanager_dir_t *dir;
+
+  dir = calloc (1, sizeof (dbmanager_dir_t));
+  if (!dir)
+    return -1;
+
+  dir->path      = location;
+  dir->mtime     = mtime;
+  dir->hash      = hash;
+  dir->unchanged = unchanged;
+
+  scanner_outstanding_add (scanner, 1);
+  vh_dbmanager_action_send_wait (VH_HANDLE->dbmanager,
+                                 FIFO_QUEUE_PRIORITY_NORMAL,
+                                 ACTION_DB_DIRECTORY, dir);
+  return 0;
+}
+
+static void
+scanner_newfiles_send (scanner_t *scanner, dbmanager_files_t **files)
+{
+  unsigned int i;
+  fifo_queue_prio_t hint, p = FIFO_QUEUE_PRIORITY_NORMAL;
+
+  if (!*files)
+    return;
+
+  /*
+   * All files of a batch are in the same directory, which can be hinted
+   * since the first file. The batch has the highest priority of its files.
+   */
+  hint = scanner_priority (scanner, (*files)->files[0]->file.path,
+                           FIFO_QUEUE_PRIORITY_NORMAL);
+  for (i = 0; i < (*files)->nb; i++)
+  {
+    file_data_t *data = (*files)->files[i];
+
+    if (data->priority < hint)
+      data->priority = hint;
+    if (data->priority > p)
+      p = data->priority;
+  }
+
+  scanner_outstanding_add (scanner, (*files)->nb);
+  vh_dbmanager_action_send_wait (VH_HANDLE->dbmanager,
+                                 p, ACTION_DB_NEWFILES, *files);
+  *files = NULL;
+}
+
+/*
+ * The files of a directory are sent to the dbmanager by batches in order to
+ * limit the number of messages.
+ */
+static int
+scanner_newfiles_add (scanner_t *scanner, dbmanager_files_t **files,
+                      const char *file, struct stat *st)
+{
+  file_data_t *data;
+
+  if (!*files)
+  {
+    *files = calloc (1, sizeof (dbmanager_files_t));
+    if (!*files)
+      return -1;
+  }
+
+  data = vh_file_data_new (file, st, 0, OD_TYPE_DEF,
+                           scanner_priority (scanner, file,
+                                             time (NULL) - st->st_mtime
+                                             < RECENT_DELAY
+                                             ? FIFO_QUEUE_PRIORITY_RECENT
+                                             : FIFO_QUEUE_PRIORITY_NORMAL),
+                           STEP_PARSING);
+  if (!data)
+    return -1;
+
+  (*files)->files[(*files)->nb++] = data;
+  if ((*files)->nb == DBMANAGER_FILES_MAX)
+    scanner_newfiles_send (scanner, files);
+  return 0;
+}
+
+/*
+ * The directories are compared component by component ('/' is lower than
+ * all other characters), then a sub-tree is always just after its root.
+ */
+static int
+checkpoint_order (const char *a, const char *b)
+{
+  for (;; a++, b++)
+  {
+    int ca = *a == '/' ? 1 : (unsigned char) *a;
+    int cb = *b == '/' ? 1 : (unsigned char) *b;
+
+    if (ca != cb || !ca)
+      return ca - cb;
+  }
+}
+
+static int
+checkpoint_ancestor (const char *dir, const char *location)
+{
+  size_t len = strlen (dir);
+
+  if (len == 1 && *dir == '/')
+    return 1;
+
+  return !strncmp (dir, location, len) && location[len] == '/';
+}
+
+/*
+ * The checkpoint of a path is the lowest directory which was not fully
+ * read. All directories before (except its parents) are fully handled,
+ * with their sub-directories.
+ */
+static int
+checkpoint_skip (struct path_s *root, const char *location)
+{
+  if (!root->resume)
+    return 0;
+
+  if (!*root->resume)
+    return 1;
+
+  return checkpoint_order (location, root->resume) < 0
+         && !checkpoint_ancestor (location, root->resume);
+}
+
+static void
+checkpoint_free (scanner_t *scanner)
+{
+  struct path_s *path;
+
+  for (path = scanner->paths; path; path = path->next)
+  {
+    free (path->resume);
+    path->resume = NULL;
+  }
+}
+
+/*
+ * Load the checkpoint saved by an interrupted scan. It is ignored when the
+ * suffixes or the exclusions have changed.
+ */
+static int
+checkpoint_load (scanner_t *scanner)
+{
+  int res = 0;
+  char *value, *it, *line;
+  struct path_s *path;
+
+  value = vh_dbmanager_db_checkpoint_get (VH_HANDLE->dbmanager);
+  if (!value)
+    return 0;
+
+  line = strtok_r (value, "\n", &it);
+  if (!line || strtoull (line, NULL, 10) != dircache_salt (scanner))
+    goto out;
+
+  while ((line = strtok_r (NULL, "\n", &it)))
+  {
+    char *frontier = strchr (line, '\t');
+    if (!frontier)
+      continue;
+
+    *frontier++ = '\0';
+    for (path = scanner->paths; path; path = path->next)
+      if (!path->resume && !strcmp (path->location, line))
+      {
+        path->resume = strdup (frontier);
+        if (path->resume)
+          res++;
+        break;
+      }
+  }
+
+ out:
+  free (value);
+  return res;
+}
+
+/*
+ * Build the position of the walkers. It must be called with the walker
+ * mutex locked, then the list of the pending directories can not change.
+ * The files of the directories before the checkpoint are already sent to
+ * the dbmanager. The checkpoint is sent after the unlock (the queue can be
+ * full); the files sent meanwhile are after the frontier.
+ */
+static char *
+checkpoint_get (walker_t *walker)
+{
+  size_t size, len;
+  char *value;
+  struct path_s *path;
+  walker_dir_t *wdir;
+  scanner_t *scanner = walker->scanner;
+
+  size = 32;
+  for (path = scanner->paths; path; path = path->next)
+    size += strlen (path->location)
+            + (path->resume ? strlen (path->resume) : 0) + 2;
+  for (wdir = walker->dirs; wdir; wdir = wdir->next)
+    size += strlen (wdir->location) + 1;
+
+  value = malloc (size);
+  if (!value)
+    return NULL;
+
+  len = snprintf (value, size, "%"PRIu64"\n", dircache_salt (scanner));
+
+  for (path = scanner->paths; path; path = path->next)
+  {
+    const char *frontier = NULL;
+
+    for (wdir = walker->dirs; wdir; wdir = wdir->next)
+      if (wdir->root == path
+          && (!frontier || checkpoint_order (wdir->location, frontier) < 0))
+        frontier = wdir->location;
+
+    /* the previous checkpoint is still valid with a resumed scan */
+    if (path->resume && frontier && *path->resume
+        && checkpoint_order (frontier, path->resume) < 0)
+      frontier = path->resume;
+
+    len += snprintf (value + len, size - len, "%s\t%s\n",
+                     path->location, frontier ? frontier : "");
+  }
+
+  return value;
+}
+
+/*
+ * The files of the skipped directories are not sent again, except those
+ * which were not fully handled before the interruption.
+ */
+static void
+checkpoint_interrupted (scanner_t *scanner)
+{
+  const char *file;
+  struct path_s *path;
+  dbmanager_files_t *batch = NULL;
+
+  while ((file = vh_dbmanager_db_interrupted_get (VH_HANDLE->dbmanager, 0)))
+  {
+    struct stat st;
+    char *dir, *it;
+
+    for (path = scanner->paths; path; path = path->next)
+      if (path->resume && checkpoint_ancestor (path->location, file))
+        break;
+
+    if (!path || path_cmp (scanner, file) || suffix_cmp (scanner, file))
+      continue;
+
+    dir = strdup (file);
+    if (!dir)
+      continue;
+
+    it = strrchr (dir, '/');
+    if (it)
+      *it = '\0';
+
+    if (checkpoint_skip (path, dir)
+        && !lstat (file, &st) && S_ISREG (st.st_mode)
+        && !scanner_newfiles_add (scanner, &batch, file, &st))
+      path->nb_files++;
+
+    free (dir);
+  }
+
+  scanner_newfiles_send (scanner, &batch);
+}
+
+static walker_dir_t *
+walker_dir_new (struct path_s *root,
+                const char *path, const char *dir, int recursive, int *files)
+{
+  walker_dir_t *wdir;
+
+  wdir = calloc (1, sizeof (walker_dir_t));
+  if (!wdir)
+    return NULL;
+
+  if (dir)
+  {
+    size_t size = strlen (path) + strlen (dir) + 2;
+    wdir->location = malloc (size);
+    if (wdir->location)
+      snprintf (wdir->location, size, "%s%s%s",
+                path, *path == '/' && *(path + 1) == '\0' ? "" : "/", dir);
+  }
+  else
+    wdir->location = strdup (path);
+
+  if (!wdir->location)
+  {
+    free (wdir);
+    return NULL;
+  }
+
+  wdir->root      = root;
+  wdir->recursive = recursive;
+  wdir->files     = files;
+  return wdir;
+}
+
+static void
+walker_dir_free (walker_dir_t *wdir)
+{
+  free (wdir->location);
+  free (wdir);
+}
+
+static int
+walker_dir_cmp (const void *a, const void *b)
+{
+  const walker_dir_t *da = *(const walker_dir_t **) a;
+  const walker_dir_t *db = *(const walker_dir_t **) b;
+
+  return checkpoint_order (da->location, db->location);
+}
+
+#ifdef USE_INOTIFY
+static int
+walker_location_cmp (const void *a, const void *b)
+{
+  return checkpoint_order (*(char * const *) a, *(char * const *) b);
+}
+#endif /* USE_INOTIFY */
+
+/*
+ * Each thread has its own deque. The owner pushes and pops the directories
+ * at the bottom (depth-first), the other threads steal at the top.
+ */
+static int
+walker_deque_push (struct walker_deque_s *deque, walker_dir_t *wdir)
+{
+  int res = 0;
+
+  pthread_mutex_lock (&deque->mutex);
+
+  if (deque->count == deque->size)
+  {
+    unsigned int i, size = deque->size ? 2 * deque->size : WALKER_DEQUE_SIZE;
+    walker_dir_t **dirs = malloc (size * sizeof (*dirs));
+
+    if (!dirs)
+    {
+      res = -1;
+      goto out;
+    }
+
+    for (i = 0; i < deque->count; i++)
+      dirs[i] = deque->dirs[(deque->top + i) % deque->size];
+
+    free (deque->dirs);
+    deque->dirs = dirs;
+    deque->size = size;
+    deque->top  = 0;
+  }
+
+  deque->dirs[(deque->top + deque->count) % deque->size] = wdir;
+  deque->count++;
+
+ out:
+  pthread_mutex_unlock (&deque->mutex);
+  return res;
+}
+
+static walker_dir_t *
+walker_deque_pop (struct walker_deque_s *deque, int steal)
+{
+  walker_dir_t *wdir = NULL;
+
+  pthread_mutex_lock (&deque->mutex);
+
+  if (!deque->count)
+    goto out;
+
+  deque->count--;
+  if (steal)
+  {
+    wdir = deque->dirs[deque->top];
+    deque->top = (deque->top + 1) % deque->size;
+  }
+  else
+    wdir = deque->dirs[(deque->top + deque->count) % deque->size];
+
+ out:
+  pthread_mutex_unlock (&deque->mutex);
+  return wdir;
+}
+
+static void
+walker_push (walker_t *walker, unsigned int id, walker_dir_t *wdir)
+{
+  pthread_mutex_lock (&walker->mutex);
+
+  if (walker_deque_push (&walker->deques[id], wdir))
+  {
+    pthread_mutex_unlock (&walker->mutex);
+    walker_dir_free (wdir);
+    return;
+  }
+
+  wdir->next = walker->dirs;
+  if (walker->dirs)
+    walker->dirs->prev = wdir;
+  walker->dirs = wdir;
+
+  walker->queued++;
+  walker->pending++;
+  pthread_cond_signal (&walker->cond);
+  pthread_mutex_unlock (&walker->mutex);
+}
+
+static walker_dir_t *
+walker_pop (walker_t *walker, unsigned int id)
+{
+  unsigned int i;
+  walker_dir_t *wdir;
+
+  wdir = walker_deque_pop (&walker->deques[id], 0);
+
+  /* steal a directory to an other thread */
+  for (i = 1; !wdir && i < walker->nb; i++)
+    wdir = walker_deque_pop (&walker->deques[(id + i) % walker->nb], 1);
+
+  if (wdir)
+  {
+    pthread_mutex_lock (&walker->mutex);
+    walker->queued--;
+    pthread_mutex_unlock (&walker->mutex);
+  }
+
+  return wdir;
+}
+
+static int
+walker_stat (scanner_t *scanner, DIR *dirp,
+             const char *location, const char *name, struct stat *st)
+{
+#ifdef HAVE_FSTATAT
+  (void) location;
+  vh_throttle_take (VH_HANDLE->throttle, THROTTLE_OPS, 1);
+  return fstatat (dirfd (dirp), name, st, AT_SYMLINK_NOFOLLOW);
+#else /* HAVE_FSTATAT */
+  int res;
+  char *file;
+  size_t size = strlen (location) + strlen (name) + 2;
+
+  (void) dirp;
+  vh_throttle_take (VH_HANDLE->throttle, THROTTLE_OPS, 1);
+
+  file = malloc (size);
+  if (!file)
+    return -1;
+
+  snprintf (file, size, "%s/%s", location, name);
+  res = lstat (file, st);
+  free (file);
+  return res;
+#endif /* !HAVE_FSTATAT */
+}
+
+/*
+ * The hash of a directory is computed with the names of all entries. The
+ * order of the entries returned by readdir() is not relevant.
+ */
+static int64_t
+walker_listing (DIR *dirp, uint64_t salt)
+{
+  struct dirent *dp;
+  uint64_t hash = salt;
+
+  while ((dp = readdir (dirp)))
+    hash += dircache_hash (DIRCACHE_FNV_OFFSET, dp->d_name);
+
+  rewinddir (dirp);
+  return (int64_t) hash;
+}
+
+static void
+walker_readdir (walker_t *walker, unsigned int id, walker_dir_t *wdir)
+{
+  DIR *dirp;
+  struct dirent *dp;
+  struct stat st;
+  char *file;
+  size_t size;
+  int files = 0;
+  int recursive = wdir->recursive;
+  int unchanged = 0, save = 0;
+  int64_t mtime = 0, hash = 0;
+  dbmanager_files_t *batch = NULL;
+  walker_dir_t **subs = NULL;
+  unsigned int subs_nb = 0, subs_size = 0;
+  scanner_t *scanner = walker->scanner;
+
+  vh_throttle_take (VH_HANDLE->throttle, THROTTLE_OPS, walker->prune ? 2 : 1);
+
+  dirp = opendir (wdir->location);
+  if (!dirp)
+    return;
+
+  /*
+   * With the pruning, the files are not handled when the mtime and the list
+   * of entries are the same that with the previous loop. The state is saved
+   * only if the mtime is older than the beginning of the loop, else a change
+   * in the same second can be missed.
+   */
+  if (walker->prune && !stat (wdir->location, &st))
+  {
+    struct dircache_s *dc;
+
+    mtime = (int64_t) st.st_mtime;
+    hash  = walker_listing (dirp, scanner->dirs_salt);
+    save  = st.st_mtime < scanner->dirs_time;
+
+    pthread_mutex_lock (&walker->mutex);
+    dc = dircache_get (scanner, wdir->location);
+    unchanged = save && dc && dc->mtime == mtime && dc->hash == hash;
+    pthread_mutex_unlock (&walker->mutex);
+  }
+
+  if (recursive > 0)
+  {
+    recursive--;
+    if (!recursive)
+      vh_log (VALHALLA_MSG_WARNING,
+              "[scanner_thread] Max recursiveness reached : %s",
+              wdir->location);
+  }
+
+#ifdef USE_INOTIFY
+  /*
+   * Watch before reading, then no file can be missed. The mtime is kept for
+   * an events overflow, it is unknown when it can change in the same second.
+   */
+  if (wdir->root->fd >= 0)
+  {
+    time_t wtime = 0;
+
+    if (!stat (wdir->location, &st) && st.st_mtime < time (NULL))
+      wtime = st.st_mtime;
+
+    pthread_mutex_lock (&walker->mutex);
+    watch_add (wdir->root, wdir->location, recursive, wtime);
+    pthread_mutex_unlock (&walker->mutex);
+  }
+#endif /* USE_INOTIFY */
+
+  do
+  {
+    mode_t mode = 0;
+
+    dp = readdir (dirp);
+    if (!dp)
+      break;
+
+    if (!strcmp (dp->d_name, ".") || !strcmp (dp->d_name, ".."))
+      continue;
+
+    /* the excluded directories are never read */
+    if (exclude_entry (scanner, wdir->root, wdir->location, dp->d_name))
+      continue;
+
+#ifdef DT_UNKNOWN
+    /* symlinks, fifos, sockets, etc, ... are ignored like with lstat() */
+    if (dp->d_type == DT_REG)
+      mode = S_IFREG;
+    else if (dp->d_type == DT_DIR)
+      mode = S_IFDIR;
+    else if (dp->d_type != DT_UNKNOWN)
+      continue;
+#endif /* DT_UNKNOWN */
+
+    /*
+     * The type is unknown, a stat is necessary, except when it can be
+     * neither a sub-directory to read nor a file to handle.
+     */
+    if (!mode)
+    {
+      if (!recursive
+          && (unchanged || suffix_cmp (scanner, dp->d_name)))
+        continue;
+      if (walker_stat (scanner, dirp, wdir->location, dp->d_name, &st))
+        continue;
+      mode = st.st_mode & S_IFMT;
+    }
+    else if (S_ISREG (mode))
+    {
+      /* the suffix is checked first, most of the files are rejected here */
+      if (unchanged || suffix_cmp (scanner, dp->d_name))
+        continue;
+      if (walker_stat (scanner, dirp, wdir->location, dp->d_name, &st))
+        continue;
+      mode = st.st_mode & S_IFMT;
+    }
+
+    if (S_ISREG (mode) && !unchanged
+        && !suffix_cmp (scanner, dp->d_name))
+    {
+      /* the full path is built only for the files sent to the dbmanager */
+      size = strlen (wdir->location) + strlen (dp->d_name) + 2;
+
+      file = malloc (size);
+      if (!file)
+        continue;
+
+      snprintf (file, size, "%s/%s", wdir->location, dp->d_name);
+      if (!scanner_newfiles_add (scanner, &batch, file, &st))
+        files++;
+      free (file);
+    }
+    else if (S_ISDIR (mode) && recursive)
+    {
+      walker_dir_t *sub = walker_dir_new (wdir->root, wdir->location,
+                                          dp->d_name, recursive, wdir->files);
+      if (!sub)
+        continue;
+
+      /* already handled before the interruption of the previous scan */
+      if (walker->resume && checkpoint_skip (wdir->root, sub->location))
+      {
+        walker_dir_free (sub);
+        continue;
+      }
+
+#ifdef USE_INOTIFY
+      /* already watched, it is read again only if it has changed */
+      if (walker->watched
+          && bsearch (&sub->location, walker->watched, walker->watched_nb,
+                      sizeof (*walker->watched), walker_location_cmp))
+      {
+        walker_dir_free (sub);
+        continue;
+      }
+#endif /* USE_INOTIFY */
+
+      if (subs_nb == subs_size)
+      {
+        walker_dir_t **tmp;
+
+        subs_size = subs_size ? 2 * subs_size : 16;
+        tmp = realloc (subs, subs_size * sizeof (*subs));
+        if (!tmp)
+        {
+          walker_dir_free (sub);
+          continue;
+        }
+        subs = tmp;
+      }
+      subs[subs_nb++] = sub;
+    }
+  }
+  while (!scanner_is_stopped (scanner));
+
+  closedir (dirp);
+  scanner_newfiles_send (scanner, &batch);
+
+  /*
+   * The sub-directories are pushed in the reverse order, then the owner
+   * reads them in the sorted order and the checkpoint can progress.
+   */
+  if (subs)
+  {
+    unsigned int i, hinted = 0;
+
+    qsort (subs, subs_nb, sizeof (*subs), walker_dir_cmp);
+
+    /* the way to a directory browsed by the user is read first */
+    for (i = 0; i < subs_nb; i++)
+      if (vh_ondemand_hinted (VH_HANDLE->ondemand, subs[i]->location, 1))
+      {
+        walker_dir_t *sub = subs[i];
+
+        memmove (subs + hinted + 1, subs + hinted,
+                 (i - hinted) * sizeof (*subs));
+        subs[hinted++] = sub;
+      }
+
+    while (subs_nb)
+      walker_push (walker, id, subs[--subs_nb]);
+    free (subs);
+  }
+
+  /*
+   * The files of an unchanged directory are marked as still present. The
+   * state of a changed directory is saved only when all its files are fully
+   * handled by the dbmanager (see scanner_thread).
+   */
+  if (save && !scanner_is_stopped (scanner))
+  {
+    char *location = NULL;
+    struct dircache_s *dc = NULL;
+
+    if (unchanged)
+      location = strdup (wdir->location);
+    else
+      dc = dircache_new (wdir->location, mtime, hash);
+
+    pthread_mutex_lock (&walker->mutex);
+    if (location && !scanner_directory (scanner, location, mtime, hash, 1))
+      scanner->dirs_nb++;
+    else if (location)
+      free (location);
+    if (dc)
+    {
+      dc->next = scanner->dirs;
+      scanner->dirs = dc;
+    }
+    pthread_mutex_unlock (&walker->mutex);
+  }
+
+  pthread_mutex_lock (&walker->mutex);
+  *wdir->files += files;
+  pthread_mutex_unlock (&walker->mutex);
+}
+
+static void
+walker_work (walker_t *walker, unsigned int id)
+{
+  walker_dir_t *wdir;
+  scanner_t *scanner = walker->scanner;
+
+  for (;;)
+  {
+    char *checkpoint = NULL;
+
+    wdir = walker_pop (walker, id);
+    if (!wdir)
+    {
+      pthread_mutex_lock (&walker->mutex);
+      while (!walker->queued && walker->pending)
+        pthread_cond_wait (&walker->cond, &walker->mutex);
+      if (!walker->pending)
+      {
+        pthread_mutex_unlock (&walker->mutex);
+        break;
+      }
+      pthread_mutex_unlock (&walker->mutex);
+      continue;
+    }
+
+    if (!scanner_is_stopped (walker->scanner))
+      walker_readdir (walker, id, wdir);
+
+    /* all directories are read when nothing is pending */
+    pthread_mutex_lock (&walker->mutex);
+
+    if (wdir->prev)
+      wdir->prev->next = wdir->next;
+    else
+      walker->dirs = wdir->next;
+    if (wdir->next)
+      wdir->next->prev = wdir->prev;
+
+    /* a directory is maybe not fully read */
+    if (scanner_is_stopped (walker->scanner))
+      walker->broken = 1;
+
+    if (walker->checkpoint && !walker->broken
+        && time (NULL) - walker->checkpoint_time
+           >= walker->scanner->checkpoint)
+    {
+      checkpoint = checkpoint_get (walker);
+      walker->checkpoint_time = time (NULL);
+    }
+
+    walker->pending--;
+    if (!walker->pending)
+      pthread_cond_broadcast (&walker->cond);
+    pthread_mutex_unlock (&walker->mutex);
+
+    /* the other walkers are not blocked while the dbmanager is full */
+    if (checkpoint)
+      vh_dbmanager_action_send_wait (VH_HANDLE->dbmanager,
+                                     FIFO_QUEUE_PRIORITY_NORMAL,
+                                     ACTION_DB_CHECKPOINT, checkpoint);
+
+    walker_dir_free (wdir);
+  }
+}
+
+static void *
+walker_thread (void *arg)
+{
+  struct walker_thread_s *thread = arg;
+  walker_t *walker = thread->walker;
+
+  vh_setpriority (walker->scanner->priority);
+  if (walker->scanner->valhalla->ioidle)
+    vh_setioprio_idle ();
+
+  walker_work (walker, thread->id);
+  pthread_exit (NULL);
+}
+
+static void
+walker_free (walker_t *walker)
+{
+  unsigned int i;
+  walker_dir_t *wdir;
+
+  for (i = 0; i < walker->nb; i++)
+  {
+    while ((wdir = walker_deque_pop (&walker->deques[i], 0)))
+      walker_dir_free (wdir);
+    free (walker->deques[i].dirs);
+    pthread_mutex_destroy (&walker->deques[i].mutex);
+  }
+
+  pthread_mutex_destroy (&walker->mutex);
+  pthread_cond_destroy (&walker->cond);
+  free (walker->deques);
+  free (walker->threads);
+  free (walker);
+}
+
+static walker_t *
+walker_new (scanner_t *scanner)
+{
+  unsigned int i;
+  walker_t *walker;
+
+  walker = calloc (1, sizeof (walker_t));
+  if (!walker)
+    return NULL;
+
+  walker->scanner = scanner;
+  walker->nb      = scanner->walker_nb;
+
+  walker->deques  = calloc (walker->nb, sizeof (*walker->deques));
+  walker->threads = calloc (walker->nb, sizeof (*walker->threads));
+  if (!walker->deques || !walker->threads)
+  {
+    free (walker->deques);
+    free (walker->threads);
+    free (walker);
+    return NULL;
+  }
+
+  for (i = 0; i < walker->nb; i++)
+    pthread_mutex_init (&walker->deques[i].mutex, NULL);
+
+  pthread_mutex_init (&walker->mutex, NULL);
+  pthread_cond_init (&walker->cond, NULL);
+
+  return walker;
+}
+
+/*
+ * Read all directories pushed in the walker. The current thread is the
+ * first walker, the others are created only for this run.
+ */
+static void
+walker_run (walker_t *walker)
+{
+  unsigned int i;
+  pthread_attr_t attr;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+  vh_thread_stack_set (&attr, walker->scanner->valhalla->stack_size);
+
+  for (i = 1; i < walker->nb; i++)
+  {
+    walker->threads[i].walker = walker;
+    walker->threads[i].id     = i;
+    walker->threads[i].run    =
+      !pthread_create (&walker->threads[i].thread,
+                       &attr, walker_thread, &walker->threads[i]);
+  }
+
+  pthread_attr_destroy (&attr);
+
+  walker_work (walker, 0);
+
+  for (i = 1; i < walker->nb; i++)
+    if (walker->threads[i].run)
+      pthread_join (walker->threads[i].thread, NULL);
+}
+
+#ifdef USE_INOTIFY
+static void
+scanner_delfile (scanner_t *scanner, char *file)
+{
+  vh_dbmanager_action_send_wait (VH_HANDLE->dbmanager,
+                                 FIFO_QUEUE_PRIORITY_NORMAL,
+                                 ACTION_DB_DELFILE, file);
+}
+
+/*
+ * Some events are lost. The mtime of a directory changes when an entry is
+ * added, removed or renamed, then only the watched directories with a new
+ * mtime are read again (a file rewritten in place is missed). The other
+ * watched directories are not read through their parent. A directory which
+ * is no longer here is handled with its parent.
+ */
+static void
+scanner_watch_overflow (walker_t *walker, struct path_s *path, int *files)
+{
+  int i;
+  unsigned int nb = 0;
+  char **tmp;
+  struct watch_s *watch;
+
+  vh_log (VALHALLA_MSG_WARNING,
+          "[%s] Events overflow, scan again the changes : %s",
+          __FUNCTION__, path->location);
+
+  for (i = 0; i < WATCH_HASH_SIZE; i++)
+    for (watch = path->watches[i]; watch; watch = watch->next)
+      nb++;
+
+  tmp = realloc (walker->watched, (walker->watched_nb + nb) * sizeof (*tmp));
+  if (!tmp)
+    return;
+  walker->watched = tmp;
+
+  tmp = realloc (walker->rescan, (walker->rescan_nb + nb) * sizeof (*tmp));
+  if (!tmp)
+    return;
+  walker->rescan = tmp;
+
+  for (i = 0; i < WATCH_HASH_SIZE; i++)
+    for (watch = path->watches[i]; watch; watch = watch->next)
+    {
+      struct stat st;
+      walker_dir_t *wdir;
+      char *location;
+
+      location = strdup (watch->location);
+      if (!location)
+        continue;
+      walker->watched[walker->watched_nb++] = location;
+
+      if (stat (watch->location, &st)
+          || (watch->mtime && watch->mtime == st.st_mtime))
+        continue;
+
+      location = strdup (watch->location);
+      if (!location)
+        continue;
+
+      /* the recursiveness of the watch is already decremented */
+      wdir = walker_dir_new (path, watch->location, NULL,
+                             watch->recursive ? watch->recursive + 1 : 0,
+                             files);
+      if (!wdir)
+      {
+        free (location);
+        continue;
+      }
+
+      walker->rescan[walker->rescan_nb++] = location;
+      walker_push (walker, walker->rescan_nb % walker->nb, wdir);
+    }
+
+  qsort (walker->watched, walker->watched_nb,
+         sizeof (*walker->watched), walker_location_cmp);
+}
+
+/*
+ * The files of the directories read again after an overflow are checked by
+ * the dbmanager, only when the directory is still reachable. A sub-directory
+ * is already checked with its parent.
+ */
+static void
+scanner_watch_rescan_end (scanner_t *scanner, walker_t *walker)
+{
+  unsigned int i;
+  const char *prev = NULL;
+
+  if (!walker->rescan)
+    goto out;
+
+  qsort (walker->rescan, walker->rescan_nb,
+         sizeof (*walker->rescan), walker_location_cmp);
+
+  for (i = 0; i < walker->rescan_nb; i++)
+  {
+    char *location = walker->rescan[i];
+
+    if (scanner_is_stopped (scanner)
+        || (prev && checkpoint_ancestor (prev, location))
+        || access (location, R_OK | X_OK))
+    {
+      free (location);
+      continue;
+    }
+
+    prev = location;
+    scanner_delfile (scanner, location);
+  }
+
+ out:
+  free (walker->rescan);
+  walker->rescan    = NULL;
+  walker->rescan_nb = 0;
+
+  for (i = 0; i < walker->watched_nb; i++)
+    free (walker->watched[i]);
+  free (walker->watched);
+  walker->watched    = NULL;
+  walker->watched_nb = 0;
+}
+
+static void
+scanner_watch_event (scanner_t *scanner, walker_t *walker,
+                     struct path_s *path,
+                     const struct inotify_event *ev, int *files)
+{
+  char *file;
+  size_t size;
+  struct watch_s *watch;
+
+  if (ev->mask & IN_Q_OVERFLOW)
+  {
+    scanner_watch_overflow (walker, path, files);
+    return;
+  }
+
+  watch = watch_get (path, ev->wd);
+  if (!watch)
+    return;
+
+  if (ev->mask & IN_IGNORED)
+  {
+    watch_del (path, ev->wd);
+    return;
+  }
+
+  /*
+   * Event on the watched directory itself. Only the root of the path must
+   * be handled here, the other directories are handled by their parent.
+   */
+  if (!ev->len)
+  {
+    if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)
+        && !strcmp (watch->location, path->location))
+    {
+      vh_log (VALHALLA_MSG_WARNING,
+              "[%s] Path removed : %s", __FUNCTION__, path->location);
+
+      watch_tree_del (path, path->location);
+      file = strdup (path->location);
+      if (file)
+        scanner_delfile (scanner, file);
+    }
+    return;
+  }
 
-  path->recursive = recursive ? PATH_RECURSIVENESS_MAX : 0;
-  return path;
-}
+  size = strlen (watch->location) + strlen (ev->name) + 2;
+  file = malloc (size);
+  if (!file)
+    return;
 
-static int
-path_cmp (struct path_s *path, const char *file)
-{
-  for (; path; path = path->next)
-    if (strstr (file, path->location) == file)
-    {
-      int sf = 0;
-      const char *it;
+  snprintf (file, size, "%s/%s", watch->location, ev->name);
 
-      if (!path->recursive)
-        return -1;
+  if (exclude_entry (scanner, path, watch->location, ev->name))
+  {
+    free (file);
+    return;
+  }
 
-      it = file + strlen (path->location);
-      while ((it = strchr (it, '/')))
+  if (ev->mask & IN_ISDIR)
+  {
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+    {
+      /* read with the other new directories, after the events */
+      if (watch->recursive)
       {
-        it++;
-        sf++;
+        walker_dir_t *wdir = walker_dir_new (path, watch->location, ev->name,
+                                             watch->recursive, files);
+        if (wdir)
+          walker_push (walker, 0, wdir);
       }
+    }
+    else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+      watch_tree_del (path, file);
+      scanner_delfile (scanner, file);
+      file = NULL;
+    }
+  }
+  /*
+   * A new file is handled only with IN_CLOSE_WRITE (and not IN_CREATE) in
+   * order to never parse a file which is not completely written.
+   */
+  else if (!suffix_cmp (scanner, ev->name))
+  {
+    if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+    {
+      struct stat st;
 
-      if (path->recursive < sf)
-        return -1;
-      return 0;
+      if (!lstat (file, &st) && S_ISREG (st.st_mode)
+          && !scanner_newfile (scanner, file, &st))
+        (*files)++;
+    }
+    else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+      scanner_delfile (scanner, file);
+      file = NULL;
     }
+  }
 
-  return -1;
+  free (file);
 }
 
-static int
-suffix_cmp (char **suffix, const char *file)
+static void
+scanner_watch_read (scanner_t *scanner, walker_t *walker,
+                    struct path_s *path, int *files)
 {
-  const char *it;
-
-  if (!file)
-    return -1;
+  char buf[WATCH_BUFFER_SIZE]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  const struct inotify_event *ev;
+  ssize_t len;
+  char *it;
 
-  if (!suffix) /* always accepted */
-    return 0;
+  len = read (path->fd, buf, sizeof (buf));
+  if (len <= 0)
+    return;
 
-  for (; *suffix; suffix++)
+  for (it = buf; it < buf + len; it += sizeof (struct inotify_event) + ev->len)
   {
-    it = vh_strrcasestr (file, *suffix);
-    if (it && (it > file)
-        && *(it + strlen (*suffix)) == '\0' && *(it - 1) == '.')
-      return 0;
+    ev = (const struct inotify_event *) it;
+    scanner_watch_event (scanner, walker, path, ev, files);
   }
-
-  return -1;
-}
-
-static inline int
-scanner_is_stopped (scanner_t *scanner)
-{
-  int run;
-  pthread_mutex_lock (&scanner->mutex_run);
-  run = scanner->run;
-  pthread_mutex_unlock (&scanner->mutex_run);
-  return !run;
 }
 
 static void
-scanner_readdir (scanner_t *scanner,
-                 const char *path, const char *dir, int recursive, int *files)
+scanner_watch (scanner_t *scanner)
 {
-  DIR *dirp;
-  struct dirent *dp;
-  struct stat st;
-  char *file;
-  char *new_path;
-  size_t size;
-
-  if (!scanner || !path)
-    return;
+  int i, nb = 0;
+  struct pollfd *fds;
+  struct path_s *path;
+  walker_t *walker;
 
-  if (dir)
-  {
-    size_t size = strlen (path) + strlen (dir) + 2;
-    new_path = malloc (size);
-    if (!new_path)
-      return;
+  for (path = scanner->paths; path; path = path->next)
+    nb++;
 
-    snprintf (new_path, size, "%s%s%s",
-              path, *path == '/' && *(path + 1) == '\0' ? "" : "/", dir);
-  }
-  else
-    new_path = strdup (path);
+  fds = calloc (nb, sizeof (struct pollfd));
+  if (!fds)
+    return;
 
-  dirp = opendir (new_path);
-  if (!dirp)
+  /* the same walker reads the directories of all events */
+  walker = walker_new (scanner);
+  if (!walker)
   {
-    free (new_path);
+    free (fds);
     return;
   }
 
-  if (recursive > 0)
+  for (i = 0, path = scanner->paths; path; path = path->next, i++)
   {
-    recursive--;
-    if (!recursive)
-      vh_log (VALHALLA_MSG_WARNING,
-              "[scanner_thread] Max recursiveness reached : %s", new_path);
+    fds[i].fd     = path->fd;
+    fds[i].events = POLLIN;
   }
 
-  do
+  vh_log (VALHALLA_MSG_INFO, "[%s] Watching for changes", __FUNCTION__);
+
+  while (!scanner_is_stopped (scanner))
   {
-    dp = readdir (dirp);
-    if (!dp)
-      break;
+    int files = 0;
 
-    if (!strcmp (dp->d_name, ".") || !strcmp (dp->d_name, ".."))
+    if (poll (fds, nb, WATCH_POLL_TIMEOUT) <= 0)
       continue;
 
-    size = strlen (new_path) + strlen (dp->d_name) + 2;
+    for (i = 0, path = scanner->paths; path; path = path->next, i++)
+      if (fds[i].revents & POLLIN)
+        scanner_watch_read (scanner, walker, path, &files);
 
-    file = malloc (size);
-    if (!file)
-      continue;
+    /* new directories and directories changed before an overflow */
+    if (walker->pending)
+      walker_run (walker);
+    scanner_watch_rescan_end (scanner, walker);
 
-    snprintf (file, size, "%s/%s", new_path, dp->d_name);
-    if (lstat (file, &st))
-    {
-      free (file);
-      continue;
-    }
+    /* Wait until that all new files are handled (wait all ACKs). */
+    if (files)
+      scanner_ack_wait (scanner);
+  }
 
-    if (S_ISREG (st.st_mode) && !suffix_cmp (scanner->suffix, dp->d_name))
-    {
-      file_data_t *data;
+  walker_free (walker);
+  free (fds);
+}
 
-      data = vh_file_data_new (file, &st, 0, OD_TYPE_DEF,
-                               FIFO_QUEUE_PRIORITY_NORMAL, STEP_PARSING);
-      if (data)
-      {
-        vh_dbmanager_action_send (VH_HANDLE->dbmanager,
-                                  data->priority, ACTION_DB_NEWFILE, data);
-        (*files)++;
-      }
-    }
-    else if (S_ISDIR (st.st_mode) && recursive)
-      scanner_readdir (scanner, new_path, dp->d_name, recursive, files);
+static int
+scanner_watch_init (scanner_t *scanner)
+{
+  struct path_s *path;
 
-    free (file);
+  for (path = scanner->paths; path; path = path->next)
+  {
+    path->fd = inotify_init ();
+    if (path->fd < 0)
+      goto err;
   }
-  while (!scanner_is_stopped (scanner));
 
-  closedir (dirp);
-  free (new_path);
+  return 0;
+
+ err:
+  for (path = scanner->paths; path; path = path->next)
+    watch_free (path);
+  return -1;
 }
+#endif /* USE_INOTIFY */
 
 static void *
 scanner_thread (void *arg)
 {
-  int i, tid;
+  int i, tid, first = 1;
+  unsigned int j;
   scanner_t *scanner = arg;
   struct path_s *path;
+  walker_t *walker;
+  walker_dir_t *hinted;
 
   if (!scanner)
     pthread_exit (NULL);
 
   tid = vh_setpriority (scanner->priority);
+  if (VH_HANDLE->ioidle)
+    vh_setioprio_idle ();
 
   vh_log (VALHALLA_MSG_VERBOSE,
           "[%s] tid: %i priority: %i", __FUNCTION__, tid, scanner->priority);
@@ -290,19 +2504,114 @@ scanner_thread (void *arg)
     vh_event_handler_gl_send (VH_HANDLE->event_handler,
                               VALHALLA_EVENTGL_SCANNER_BEGIN);
 
-    for (path = scanner->paths; path; path = path->next)
+    if (scanner->pruning)
+      dircache_load (scanner);
+
+    /* All paths are scanned concurrently when several walkers are used. */
+    walker = walker_new (scanner);
+    if (!walker)
+      goto kill;
+
+    walker->prune = scanner->pruning;
+
+    /*
+     * The position is not saved with the watch mode, else the skipped
+     * directories are not watched after a resume.
+     */
+    if (scanner->checkpoint && !scanner->watch)
     {
-      vh_log (VALHALLA_MSG_INFO,
-              "[%s] Start scanning : %s", __FUNCTION__, path->location);
+      walker->checkpoint      = 1;
+      walker->checkpoint_time = time (NULL);
+      /* only the first loop can resume an interrupted scan */
+      if (first)
+        walker->resume = checkpoint_load (scanner) > 0;
+    }
+    first = 0;
+    hinted = NULL;
+
+    for (j = 0, path = scanner->paths; path; path = path->next, j++)
+    {
+      walker_dir_t *wdir;
 
       path->nb_files = 0;
-      scanner_readdir (scanner,
-                       path->location, NULL, path->recursive, &path->nb_files);
 
-      vh_log (VALHALLA_MSG_INFO,
-              "[%s] End scanning   : %i files", __FUNCTION__, path->nb_files);
+      if (scanner->offline)
+      {
+        int offline = !path_available (path);
+
+        pthread_mutex_lock (&scanner->mutex_offline);
+        path->offline = offline;
+        pthread_mutex_unlock (&scanner->mutex_offline);
+
+        if (offline)
+        {
+          vh_log (VALHALLA_MSG_WARNING,
+                  "[%s] Unreachable path (offline) : %s",
+                  __FUNCTION__, path->location);
+          continue;
+        }
+      }
+
+      if (walker->resume && path->resume)
+      {
+        vh_log (VALHALLA_MSG_INFO,
+                "[%s] Resume scanning : %s (%s)", __FUNCTION__,
+                path->location, *path->resume ? path->resume : "done");
+        if (!*path->resume)
+          continue;
+      }
+      else
+        vh_log (VALHALLA_MSG_INFO,
+                "[%s] Start scanning : %s", __FUNCTION__, path->location);
+
+      wdir = walker_dir_new (path, path->location,
+                             NULL, path->recursive, &path->nb_files);
+      if (!wdir)
+        continue;
+
+      /* kept for the end, then popped first by the main walker */
+      if (vh_ondemand_hinted (VH_HANDLE->ondemand, wdir->location, 1))
+      {
+        wdir->next = hinted;
+        hinted = wdir;
+        continue;
+      }
+
+      walker_push (walker, j % walker->nb, wdir);
+    }
+
+    while (hinted)
+    {
+      walker_dir_t *wdir = hinted;
+
+      hinted = wdir->next;
+      walker_push (walker, 0, wdir);
     }
 
+    if (walker->resume)
+      checkpoint_interrupted (scanner);
+
+    walker_run (walker);
+
+    /* the scan is complete, the checkpoint is no longer necessary */
+    if (walker->checkpoint && !scanner_is_stopped (scanner))
+      vh_dbmanager_action_send_wait (VH_HANDLE->dbmanager,
+                                     FIFO_QUEUE_PRIORITY_NORMAL,
+                                     ACTION_DB_CHECKPOINT, NULL);
+
+    walker_free (walker);
+    checkpoint_free (scanner);
+
+    for (path = scanner->paths; path; path = path->next)
+      vh_log (VALHALLA_MSG_INFO,
+              "[%s] End scanning   : %s, %i files",
+              __FUNCTION__, path->location, path->nb_files);
+
+    if (scanner->pruning)
+      vh_log (VALHALLA_MSG_INFO,
+              "[%s] Unchanged directories : %i", __FUNCTION__,
+              scanner->dirs_nb);
+
     vh_event_handler_gl_send (VH_HANDLE->event_handler,
                               VALHALLA_EVENTGL_SCANNER_END);
 
@@ -310,20 +2619,26 @@ scanner_thread (void *arg)
      * Wait until that all files are parsed and inserted in the database
      * for each path (wait all ACKs).
      */
-    for (path = scanner->paths; path; path = path->next)
+    if (scanner_ack_wait (scanner))
+      goto kill;
+
+    /* Save the states of the changed directories. */
+    if (scanner->dirs)
     {
-      int files = path->nb_files;
-      while (files)
+      while (scanner->dirs)
       {
-        int e;
-        vh_fifo_queue_pop (scanner->fifo, &e, NULL);
-        if (e == ACTION_ACKNOWLEDGE)
-          files--;
+        struct dircache_s *dc = scanner->dirs;
 
-        if (scanner_is_stopped (scanner))
-          goto kill;
+        scanner->dirs = dc->next;
+        if (scanner_directory (scanner, dc->location, dc->mtime, dc->hash, 0))
+          free (dc->location);
+        free (dc);
       }
+
+      if (scanner_ack_wait (scanner))
+        goto kill;
     }
+    dircache_free (scanner);
 
     vh_event_handler_gl_send (VH_HANDLE->event_handler,
                               VALHALLA_EVENTGL_SCANNER_ACKS);
@@ -331,9 +2646,17 @@ scanner_thread (void *arg)
     /* It is not the last loop ?  */
     if (i != 1)
     {
-      vh_dbmanager_action_send (VH_HANDLE->dbmanager,
-                                FIFO_QUEUE_PRIORITY_NORMAL,
-                                ACTION_DB_NEXT_LOOP, NULL);
+      vh_dbmanager_action_send_wait (VH_HANDLE->dbmanager,
+                                     FIFO_QUEUE_PRIORITY_NORMAL,
+                                     ACTION_DB_NEXT_LOOP, NULL);
+#ifdef USE_INOTIFY
+      /* Only the changes are handled after the first loop. */
+      if (scanner->watch)
+      {
+        scanner_watch (scanner);
+        goto kill;
+      }
+#endif /* USE_INOTIFY */
       vh_event_handler_gl_send (VH_HANDLE->event_handler,
                                 VALHALLA_EVENTGL_SCANNER_SLEEP);
       if (scanner->timeout)
@@ -387,14 +2710,33 @@ vh_scanner_run (scanner_t *scanner,
   if (delay || timeout)
     vh_timer_thread_start (scanner->timer);
 
-  /* -1 for infinite loop */
-  scanner->loop = loop < 1 ? -1 : loop;
+#ifdef USE_INOTIFY
+  if (scanner->watch && scanner_watch_init (scanner))
+  {
+    vh_log (VALHALLA_MSG_WARNING,
+            "[%s] Watch mode unavailable, the usual loops are used",
+            __FUNCTION__);
+    scanner->watch = 0;
+  }
+#else /* USE_INOTIFY */
+  if (scanner->watch)
+  {
+    vh_log (VALHALLA_MSG_WARNING,
+            "[%s] Watch mode not compiled, the usual loops are used",
+            __FUNCTION__);
+    scanner->watch = 0;
+  }
+#endif /* !USE_INOTIFY */
+
+  /* -1 for infinite loop (the watch mode never ends) */
+  scanner->loop = loop < 1 || scanner->watch ? -1 : loop;
 
   scanner->priority = priority;
   scanner->run      = 1;
 
   pthread_attr_init (&attr);
   pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+  vh_thread_stack_set (&attr, VH_HANDLE->stack_size);
 
   res = pthread_create (&scanner->thread, &attr, scanner_thread, scanner);
   if (res)
@@ -447,8 +2789,13 @@ vh_scanner_stop (scanner_t *scanner, int f)
 
     vh_fifo_queue_push (scanner->fifo,
                         FIFO_QUEUE_PRIORITY_HIGH, ACTION_KILL_THREAD, NULL);
+    pthread_mutex_lock (&scanner->mutex_ack);
+    pthread_cond_broadcast (&scanner->cond_ack);
+    pthread_mutex_unlock (&scanner->mutex_ack);
     scanner->wait = 1;
     vh_timer_thread_stop (scanner->timer);
+    /* the walkers must not sleep for the I/O budget */
+    vh_throttle_abort (VH_HANDLE->throttle, THROTTLE_OPS);
   }
 
   if (f & STOP_FLAG_WAIT && scanner->wait)
@@ -468,19 +2815,20 @@ vh_scanner_uninit (scanner_t *scanner)
 
   vh_timer_thread_delete (scanner->timer);
 
+  dircache_free (scanner);
+
   if (scanner->paths)
     path_free (scanner->paths);
+  path_node_free (scanner->path_tree);
+  exclude_free (scanner->exclude);
 
-  if (scanner->suffix)
-  {
-    char **it;
-    for (it = scanner->suffix; *it; it++)
-      free (*it);
-    free (scanner->suffix);
-  }
+  suffix_free (scanner);
 
   vh_fifo_queue_free (scanner->fifo);
   pthread_mutex_destroy (&scanner->mutex_run);
+  pthread_mutex_destroy (&scanner->mutex_ack);
+  pthread_mutex_destroy (&scanner->mutex_offline);
+  pthread_cond_destroy (&scanner->cond_ack);
 
   free (scanner);
 }
@@ -493,13 +2841,24 @@ vh_scanner_path_cmp (scanner_t *scanner, const char *file)
   if (!scanner)
     return -1;
 
-  return path_cmp (scanner->paths, file);
+  return path_cmp (scanner, file);
+}
+
+int
+vh_scanner_path_offline (scanner_t *scanner, const char *file)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!scanner || !scanner->offline)
+    return 0;
+
+  return path_offline (scanner, file);
 }
 
 void
 vh_scanner_path_add (scanner_t *scanner, const char *location, int recursive)
 {
-  struct path_s *path;
+  struct path_s *path, *new;
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
@@ -511,16 +2870,118 @@ vh_scanner_path_add (scanner_t *scanner, const char *location, int recursive)
     if (!strcmp (path->location, location))
       return;
 
+  new = path_new (location, recursive);
+  if (!new)
+    return;
+
+  /* the files are in the scope only in the top directory if not recursive */
+  path_tree_add (scanner, new, new->recursive ? new->recursive : 1);
+
   if (!scanner->paths)
   {
-    scanner->paths = path_new (location, recursive);
+    scanner->paths = new;
     return;
   }
 
   for (path = scanner->paths; path->next; path = path->next)
     ;
 
-  path->next = path_new (location, recursive);
+  path->next = new;
+}
+
+void
+vh_scanner_walker_set (scanner_t *scanner, unsigned int nb)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!scanner)
+    return;
+
+  if (!nb)
+    nb = WALKER_NUMBER_DEF;
+  else if (nb > WALKER_NB_MAX)
+    nb = WALKER_NB_MAX;
+
+  scanner->walker_nb = nb;
+}
+
+void
+vh_scanner_exclude_add (scanner_t *scanner,
+                        const char *location, const char *pattern)
+{
+  struct path_s *path;
+
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!scanner || !pattern)
+    return;
+
+  if (!location)
+  {
+    exclude_add (&scanner->exclude, pattern);
+    return;
+  }
+
+  for (path = scanner->paths; path; path = path->next)
+  {
+    size_t len = strlen (path->location);
+
+    /* the trailing slash is removed from the scanner paths */
+    if (!strncmp (path->location, location, len)
+        && (location[len] == '\0'
+            || (location[len] == '/' && location[len + 1] == '\0')))
+    {
+      exclude_add (&path->exclude, pattern);
+      return;
+    }
+  }
+
+  vh_log (VALHALLA_MSG_WARNING,
+          "[%s] Path not found for the exclusion : %s", __FUNCTION__, location);
+}
+
+void
+vh_scanner_pruning_set (scanner_t *scanner, int pruning)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!scanner)
+    return;
+
+  scanner->pruning = !!pruning;
+}
+
+void
+vh_scanner_checkpoint_set (scanner_t *scanner, int interval)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!scanner)
+    return;
+
+  scanner->checkpoint = interval > 0 ? interval : 0;
+}
+
+void
+vh_scanner_offline_set (scanner_t *scanner, int offline)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!scanner)
+    return;
+
+  scanner->offline = !!offline;
+}
+
+void
+vh_scanner_watch_set (scanner_t *scanner, int watch)
+{
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!scanner)
+    return;
+
+  scanner->watch = !!watch;
 }
 
 int
@@ -531,34 +2992,65 @@ vh_scanner_suffix_cmp (scanner_t *scanner, const char *file)
   if (!scanner)
     return -1;
 
-  return suffix_cmp (scanner->suffix, file);
+  return suffix_cmp (scanner, file);
 }
 
 void
 vh_scanner_suffix_add (scanner_t *scanner, const char *suffix)
 {
-  int n;
-  char *const *it;
+  char *it;
+  size_t len;
+  unsigned int hash;
+  struct suffix_s *sfx;
 
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
-  if (!scanner)
+  if (!scanner || !suffix || !*suffix)
     return;
 
-  /* check if the suffix is already in the list */
-  for (it = scanner->suffix; it && *it; it++)
-    if (!strcasecmp (*it, suffix))
-      return;
+  /* check if the suffix is already in the set */
+  len = strlen (suffix);
+  if (suffix_get (scanner, suffix, len))
+    return;
+
+  sfx = calloc (1, sizeof (struct suffix_s));
+  if (!sfx)
+    return;
+
+  sfx->name = strdup (suffix);
+  if (!sfx->name)
+  {
+    free (sfx);
+    return;
+  }
+
+  for (it = sfx->name; *it; it++)
+    *it = tolower ((unsigned char) *it);
 
-  n = vh_get_list_length (scanner->suffix) + 1;
+  hash = suffix_hash (sfx->name);
+  sfx->len  = len;
+  sfx->next = scanner->suffix[hash];
+  scanner->suffix[hash] = sfx;
 
-  scanner->suffix =
-    realloc (scanner->suffix, (n + 1) * sizeof (*scanner->suffix));
-  if (!scanner->suffix)
+  scanner->suffix_nb++;
+  if (len > scanner->suffix_len)
+    scanner->suffix_len = len;
+}
+
+static void
+scanner_stats_dump (vh_stats_t *stats, void *data)
+{
+  scanner_t *scanner = data;
+
+  if (!stats || !scanner)
     return;
 
-  scanner->suffix[n] = NULL;
-  scanner->suffix[n - 1] = strdup (suffix);
+  vh_log (VALHALLA_MSG_INFO, "==============================");
+  vh_log (VALHALLA_MSG_INFO, "Statistics dump (" STATS_GROUP ")");
+  vh_log (VALHALLA_MSG_INFO, "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~");
+
+  vh_log (VALHALLA_MSG_INFO, "Files outstanding | %"PRIu64,
+          vh_stats_counter_read (scanner->st_outstanding));
 }
 
 scanner_t *
@@ -583,9 +3075,20 @@ vh_scanner_init (valhalla_t *handle)
   if (!scanner->timer)
     goto err;
 
-  scanner->valhalla = handle; /* VH_HANDLE */
+  scanner->valhalla  = handle; /* VH_HANDLE */
+  scanner->walker_nb = WALKER_NUMBER_DEF;
 
   pthread_mutex_init (&scanner->mutex_run, NULL);
+  pthread_mutex_init (&scanner->mutex_ack, NULL);
+  pthread_mutex_init (&scanner->mutex_offline, NULL);
+  pthread_cond_init (&scanner->cond_ack, NULL);
+
+  /* init statistics */
+  vh_stats_grp_add (handle->stats,
+                    STATS_GROUP, scanner_stats_dump, scanner);
+  scanner->st_outstanding =
+    vh_stats_grp_counter_add (handle->stats,
+                              STATS_GROUP, STATS_OUTSTANDING, NULL);
 
   return scanner;
 
@@ -595,13 +3098,17 @@ vh_scanner_init (valhalla_t *handle)
 }
 
 void
-vh_scanner_action_send (scanner_t *scanner,
-                        fifo_queue_prio_t prio, int action, void *data)
+vh_scanner_acknowledge (scanner_t *scanner, unsigned int nb)
 {
   vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
 
-  if (!scanner)
+  if (!scanner || !nb)
     return;
 
-  vh_fifo_queue_push (scanner->fifo, prio, action, data);
+  pthread_mutex_lock (&scanner->mutex_ack);
+  scanner->outstanding -= nb > scanner->outstanding ? scanner->outstanding : nb;
+  VH_STATS_COUNTER_SET (scanner->st_outstanding, scanner->outstanding);
+  if (!scanner->outstanding)
+    pthread_cond_signal (&scanner->cond_ack);
+  pthread_mutex_unlock (&scanner->mutex_ack);
 }
@@ -24,6 +24,8 @@
 
 #include "fifo_queue.h"
 
+#define WALKER_NUMBER_DEF 1
+
 typedef struct scanner_s scanner_t;
 
 enum scanner_errno {
@@ -44,12 +46,19 @@ void vh_scanner_uninit (scanner_t *scanner);
 scanner_t *vh_scanner_init (valhalla_t *handle);
 
 int vh_scanner_path_cmp (scanner_t *scanner, const char *file);
+int vh_scanner_path_offline (scanner_t *scanner, const char *file);
 void vh_scanner_path_add (scanner_t *scanner,
                           const char *location, int recursive);
 int vh_scanner_suffix_cmp (scanner_t *scanner, const char *file);
 void vh_scanner_suffix_add (scanner_t *scanner, const char *suffix);
+void vh_scanner_exclude_add (scanner_t *scanner,
+                             const char *location, const char *pattern);
+void vh_scanner_pruning_set (scanner_t *scanner, int pruning);
+void vh_scanner_checkpoint_set (scanner_t *scanner, int interval);
+void vh_scanner_offline_set (scanner_t *scanner, int offline);
+void vh_scanner_walker_set (scanner_t *scanner, unsigned int nb);
+void vh_scanner_watch_set (scanner_t *scanner, int watch);
 
-void vh_scanner_action_send (scanner_t *scanner,
-                             fifo_queue_prio_t prio, int action, void *data);
+void vh_scanner_acknowledge (scanner_t *scanner, unsigned int nb);
 
 #endif /* VALHALLA_SCANNER_H */
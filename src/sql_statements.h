@@ -71,7 +71,12 @@
    "checked__        INTEGER NOT NULL, "                  \
    "interrupted__    INTEGER NOT NULL, "                  \
    "outofpath__      INTEGER NOT NULL, "                  \
-   "_type_id         INTEGER NULL "                       \
+   "_type_id         INTEGER NULL, "                      \
+   "offline__        INTEGER NOT NULL DEFAULT 0, "        \
+   "file_dev         INTEGER NOT NULL DEFAULT 0, "        \
+   "file_ino         INTEGER NOT NULL DEFAULT 0, "        \
+   "file_size        INTEGER NOT NULL DEFAULT 0, "        \
+   "file_sign        INTEGER NOT NULL DEFAULT 0 "         \
  ");"
 
 #define CREATE_TABLE_TYPE                                 \
@@ -121,6 +126,29 @@
    "_file_id         INTEGER NULL "                       \
  ");"
 
+#define CREATE_TABLE_DIRECTORY                            \
+ "CREATE TABLE IF NOT EXISTS directory ( "                \
+   "directory_id     INTEGER PRIMARY KEY AUTOINCREMENT, " \
+   "directory_path   TEXT    NOT NULL UNIQUE, "           \
+   "directory_mtime  INTEGER NOT NULL, "                  \
+   "directory_hash   INTEGER NOT NULL, "                  \
+   "checked__        INTEGER NOT NULL "                   \
+ ");"
+
+#define CREATE_TABLE_SPILL                                \
+ "CREATE TEMP TABLE IF NOT EXISTS spill ( "               \
+   "spill_id         INTEGER PRIMARY KEY, "               \
+   "spill_action     INTEGER NOT NULL, "                  \
+   "spill_path       TEXT, "                              \
+   "spill_mtime      INTEGER, "                           \
+   "spill_size       INTEGER, "                           \
+   "spill_dev        INTEGER, "                           \
+   "spill_ino        INTEGER, "                           \
+   "spill_hash       INTEGER, "                           \
+   "spill_flag       INTEGER, "                           \
+   "spill_priority   INTEGER "                            \
+ ");"
+
 #define CREATE_TABLE_ASSOC_FILE_METADATA                  \
  "CREATE TABLE IF NOT EXISTS assoc_file_metadata ( "      \
    "file_id          INTEGER NOT NULL, "                  \
@@ -157,6 +185,18 @@
  "CREATE INDEX IF NOT EXISTS "    \
  "outofpath_idx ON file (outofpath__);"
 
+#define CREATE_INDEX_OFFLINE      \
+ "CREATE INDEX IF NOT EXISTS "    \
+ "offline_idx ON file (offline__);"
+
+#define CREATE_INDEX_IDENTITY     \
+ "CREATE INDEX IF NOT EXISTS "    \
+ "identity_idx ON file (file_ino, file_dev);"
+
+#define CREATE_INDEX_SIZE         \
+ "CREATE INDEX IF NOT EXISTS "    \
+ "size_idx ON file (file_size);"
+
 #define CREATE_INDEX_ASSOC        \
  "CREATE INDEX IF NOT EXISTS "    \
  "assoc_idx ON assoc_file_metadata (meta_id, data_id);"
@@ -187,6 +227,26 @@
  "ALTER TABLE assoc_file_metadata "         \
  "ADD COLUMN priority__ INTEGER DEFAULT 0;"
 
+#define DB_UPDATER_FROM_2_TO_3                      \
+ "ALTER TABLE file "                                \
+ "ADD COLUMN offline__ INTEGER NOT NULL DEFAULT 0;"
+
+#define DB_UPDATER_FROM_3_TO_4_A                    \
+ "ALTER TABLE file "                                \
+ "ADD COLUMN file_dev INTEGER NOT NULL DEFAULT 0;"
+
+#define DB_UPDATER_FROM_3_TO_4_B                    \
+ "ALTER TABLE file "                                \
+ "ADD COLUMN file_ino INTEGER NOT NULL DEFAULT 0;"
+
+#define DB_UPDATER_FROM_3_TO_4_C                    \
+ "ALTER TABLE file "                                \
+ "ADD COLUMN file_size INTEGER NOT NULL DEFAULT 0;"
+
+#define DB_UPDATER_FROM_4_TO_5                      \
+ "ALTER TABLE file "                                \
+ "ADD COLUMN file_sign INTEGER NOT NULL DEFAULT 0;"
+
 /******************************************************************************/
 /*                                                                            */
 /*                                  Select                                    */
@@ -307,6 +367,25 @@
  "FROM file "             \
  "WHERE file_path = ?;"
 
+#define SELECT_FILE_STATE                 \
+ "SELECT file_mtime, interrupted__ "      \
+ "FROM file "                             \
+ "WHERE file_path = ?;"
+
+/* Only a fully handled file can be used as source. */
+#define SELECT_FILE_IDENTITY                                      \
+ "SELECT file_id "                                                \
+ "FROM file "                                                     \
+ "WHERE file_ino = ? AND file_dev = ? AND file_size = ? "         \
+   "AND file_mtime = ? AND interrupted__ = 0 AND file_path <> ? " \
+ "LIMIT 1;"
+
+/* Files not yet found by the scanner with this loop. */
+#define SELECT_FILE_SIZE        \
+ "SELECT file_path, file_sign " \
+ "FROM file "                   \
+ "WHERE file_size = ? AND file_sign <> 0 AND checked__ = 0;"
+
 #define SELECT_TYPE_ID   \
  "SELECT type_id "       \
  "FROM type "            \
@@ -370,13 +449,41 @@
 #define SELECT_FILE_CHECKED_CLEAR \
  "SELECT file_path "              \
  "FROM file "                     \
- "WHERE checked__ = 0 AND outofpath__ = 0;"
+ "WHERE checked__ = 0 AND outofpath__ = 0 AND offline__ = 0;"
 
 #define SELECT_FILE_OUTOFPATH_SET \
  "SELECT file_path "              \
  "FROM file "                     \
  "WHERE outofpath__ = 1;"
 
+#define SELECT_FILE_OFFLINE_SET \
+ "SELECT file_path "            \
+ "FROM file "                   \
+ "WHERE offline__ = 1;"
+
+#define SELECT_FILE_INTERRUP_SET \
+ "SELECT file_path "            \
+ "FROM file "                   \
+ "WHERE interrupted__ <> 0;"
+
+#define SELECT_FILE_TREE                                \
+ "SELECT file_path "                                    \
+ "FROM file "                                           \
+ "WHERE file_path = ?1 "                                \
+    "OR substr (file_path, 1, length (?1) + 1) = ?1 || '/';"
+
+#define SELECT_DIRECTORY                                      \
+ "SELECT directory_path, directory_mtime, directory_hash "    \
+ "FROM directory;"
+
+#define SELECT_SPILL                                          \
+ "SELECT spill_id, spill_action, spill_path, spill_mtime, "   \
+        "spill_size, spill_dev, spill_ino, spill_hash, "      \
+        "spill_flag, spill_priority "                         \
+ "FROM spill "                                                \
+ "ORDER BY spill_id "                                         \
+ "LIMIT 1;"
+
 #define SELECT_FILE_GRABBER_NAME                      \
  "SELECT grabber.grabber_name "                       \
  "FROM ( "                                            \
@@ -409,8 +516,32 @@
  "           file_mtime, "    \
  "           checked__, "     \
  "           interrupted__, " \
- "           outofpath__) "   \
- "VALUES (?, ?, 1, -1, ?);"
+ "           outofpath__, "   \
+ "           file_dev, "      \
+ "           file_ino, "      \
+ "           file_size) "     \
+ "VALUES (?, ?, 1, -1, ?, ?, ?, ?);"
+
+#define INSERT_DIRECTORY                \
+ "INSERT OR REPLACE "                   \
+ "INTO directory (directory_path, "     \
+ "                directory_mtime, "    \
+ "                directory_hash, "     \
+ "                checked__) "          \
+ "VALUES (?, ?, ?, 1);"
+
+#define INSERT_SPILL                    \
+ "INSERT "                              \
+ "INTO spill (spill_action, "           \
+ "            spill_path, "             \
+ "            spill_mtime, "            \
+ "            spill_size, "             \
+ "            spill_dev, "              \
+ "            spill_ino, "              \
+ "            spill_hash, "             \
+ "            spill_flag, "             \
+ "            spill_priority) "         \
+ "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);"
 
 #define INSERT_TYPE        \
  "INSERT "                 \
@@ -460,6 +591,22 @@
  "INTO assoc_file_grabber (file_id, grabber_id) "                 \
  "VALUES (?, ?);"
 
+/* Copy all associations of the file ?2 to the file ?1. */
+#define COPY_ASSOC_FILE_METADATA                               \
+ "INSERT OR IGNORE "                                           \
+ "INTO assoc_file_metadata (file_id, meta_id, data_id, "       \
+                            "_grp_id, external, priority__) "  \
+ "SELECT ?1, meta_id, data_id, _grp_id, external, priority__ " \
+ "FROM assoc_file_metadata "                                   \
+ "WHERE file_id = ?2;"
+
+#define COPY_ASSOC_FILE_GRABBER                   \
+ "INSERT OR IGNORE "                              \
+ "INTO assoc_file_grabber (file_id, grabber_id) " \
+ "SELECT ?1, grabber_id "                         \
+ "FROM assoc_file_grabber "                       \
+ "WHERE file_id = ?2;"
+
 /******************************************************************************/
 /*                                                                            */
 /*                                  Update                                    */
@@ -472,13 +619,76 @@
  "    checked__       = 1, " \
  "    interrupted__   = 1, " \
  "    outofpath__     = ?, " \
- "    _type_id        = ?  " \
+ "    offline__       = 0, " \
+ "    _type_id        = ?, " \
+ "    file_dev        = ?, " \
+ "    file_ino        = ?, " \
+ "    file_size       = ?, " \
+ "    file_sign       = ?  " \
+ "WHERE file_path = ?;"
+
+/*
+ * The file is fully handled with the associations of the file ?6. The
+ * content is the same, then the signature is copied too.
+ */
+#define UPDATE_FILE_COPY                                                 \
+ "UPDATE file "                                                          \
+ "SET file_mtime      = ?1, "                                            \
+ "    checked__       = 1, "                                             \
+ "    interrupted__   = 0, "                                             \
+ "    outofpath__     = ?2, "                                            \
+ "    offline__       = 0, "                                             \
+ "    file_dev        = ?3, "                                            \
+ "    file_ino        = ?4, "                                            \
+ "    file_size       = ?5, "                                            \
+ "    _type_id        = (SELECT _type_id FROM file WHERE file_id = ?6), " \
+ "    file_sign       = (SELECT file_sign FROM file WHERE file_id = ?6) " \
+ "WHERE file_path = ?7;"
+
+/* The identity can change without the mtime (remount, restore, ...). */
+#define UPDATE_FILE_IDENTITY                         \
+ "UPDATE file "                                      \
+ "SET file_dev = ?1, file_ino = ?2, file_size = ?3 " \
+ "WHERE file_path = ?4 "                             \
+   "AND (file_dev <> ?1 OR file_ino <> ?2 OR file_size <> ?3);"
+
+/* The file is moved, all associations are kept. */
+#define UPDATE_FILE_PATH \
+ "UPDATE file "          \
+ "SET file_path   = ?, " \
+ "    file_mtime  = ?, " \
+ "    checked__   = 1, " \
+ "    outofpath__ = ?, " \
+ "    offline__   = 0, " \
+ "    file_dev    = ?, " \
+ "    file_ino    = ? "  \
+ "WHERE file_path = ?;"
+
+#define UPDATE_FILE_OFFLINE  \
+ "UPDATE file "              \
+ "SET offline__ = ? "        \
  "WHERE file_path = ?;"
 
 #define UPDATE_FILE_CHECKED_CLEAR \
  "UPDATE file "                   \
  "SET checked__ = 0;"
 
+/* Only the files in the directory (not in the sub-directories). */
+#define UPDATE_FILE_CHECKED_DIR                           \
+ "UPDATE file "                                           \
+ "SET checked__ = 1 "                                     \
+ "WHERE file_path > ?1 || '/' AND file_path < ?1 || '0' " \
+   "AND substr (file_path, length (?1) + 2) NOT LIKE '%/%';"
+
+#define UPDATE_DIRECTORY_CHECKED  \
+ "UPDATE directory "              \
+ "SET checked__ = 1 "             \
+ "WHERE directory_path = ?;"
+
+#define UPDATE_DIRECTORY_CHECKED_CLEAR \
+ "UPDATE directory "                   \
+ "SET checked__ = 0;"
+
 #define UPDATE_FILE_INTERRUP_CLEAR \
  "UPDATE file "                    \
  "SET interrupted__ = 0 "          \
@@ -521,6 +731,18 @@
  "DELETE FROM file " \
  "WHERE file_path = ?;"
 
+#define DELETE_INFO  \
+ "DELETE FROM info " \
+ "WHERE info_name = ?;"
+
+#define DELETE_DIRECTORY_CHECKED \
+ "DELETE FROM directory "        \
+ "WHERE checked__ = 0;"
+
+#define DELETE_SPILL     \
+ "DELETE FROM spill "    \
+ "WHERE spill_id = ?;"
+
 #define DELETE_ASSOC_FILE_METADATA  \
  "DELETE FROM assoc_file_metadata " \
  "WHERE file_id = ? AND external = 0;"
@@ -47,6 +47,7 @@ uint64_t vh_stats_timer_read (vh_stats_tmr_t *timer);
 uint64_t vh_stats_counter_read (vh_stats_cnt_t *counter);
 void vh_stats_timer (vh_stats_tmr_t *timer, int start);
 void vh_stats_counter (vh_stats_cnt_t *counter, uint64_t val);
+void vh_stats_counter_set (vh_stats_cnt_t *counter, uint64_t val);
 
 void vh_stats_dump (vh_stats_t *stats, const char *grp);
 void vh_stats_debug_dump (vh_stats_t *stats);
@@ -61,5 +62,6 @@ uint64_t vh_stats_read_next (vh_stats_t *stats, const char *id,
 #define VH_STATS_TIMER_STOP(s)     vh_stats_timer (s, 0)
 #define VH_STATS_COUNTER_INC(s)    vh_stats_counter (s, 1)
 #define VH_STATS_COUNTER_ACC(s, v) vh_stats_counter (s, v)
+#define VH_STATS_COUNTER_SET(s, v) vh_stats_counter_set (s, v)
 
 #endif /* VALHALLA_STATS_H */
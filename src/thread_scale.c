@@ -0,0 +1,295 @@
+/*
+ * GeeXboX Valhalla: tiny media scanner API.
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of libvalhalla.
+ *
+ * libvalhalla is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libvalhalla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libvalhalla; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "thread_utils.h"
+#include "thread_scale.h"
+
+#ifndef THREAD_SCALE_NB_MAX
+#define THREAD_SCALE_NB_MAX 16
+#endif /* THREAD_SCALE_NB_MAX */
+
+/*
+ * A new thread is started when the backlog (number of entries in the queue
+ * multiplied by the average service time) is greater than this delay for
+ * every running thread. A thread is ended as soon as the queue is empty,
+ * until that only the minimum of threads is running.
+ */
+#define THREAD_SCALE_BACKLOG (2 * 1000000000ULL) /* ns */
+
+typedef enum thread_scale_state {
+  THREAD_SCALE_FREE = 0,
+  THREAD_SCALE_RUN,
+  THREAD_SCALE_EXIT,        /* ended but not joined */
+} thread_scale_state_t;
+
+typedef struct thread_scale_slot_s {
+  struct thread_scale_s *scale;
+  pthread_t              thread;
+  unsigned int           id;
+  thread_scale_state_t   state;
+} thread_scale_slot_t;
+
+struct thread_scale_s {
+  thread_scale_slot_t slot[THREAD_SCALE_NB_MAX];
+  unsigned int        min;
+  unsigned int        max;
+  unsigned int        nb;
+  size_t              stack;
+  uint64_t            service;  /* average time for one entry (ns) */
+  int                 frozen;
+  int                 stop;
+
+  void *(*fct) (void *arg);
+  void  *data;
+
+  pthread_mutex_t mutex;
+};
+
+
+/* The mutex must be locked. */
+static int
+thread_scale_spawn (thread_scale_t *scale)
+{
+  int res;
+  unsigned int i;
+  pthread_attr_t attr;
+  thread_scale_slot_t *slot = NULL;
+
+  for (i = 0; i < scale->max; i++)
+    if (scale->slot[i].state != THREAD_SCALE_RUN)
+    {
+      slot = &scale->slot[i];
+      break;
+    }
+
+  if (!slot)
+    return -1;
+
+  if (slot->state == THREAD_SCALE_EXIT)
+    pthread_join (slot->thread, NULL);
+  slot->state = THREAD_SCALE_FREE;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+  vh_thread_stack_set (&attr, scale->stack);
+
+  res = pthread_create (&slot->thread, &attr, scale->fct, slot);
+  pthread_attr_destroy (&attr);
+  if (res)
+    return -1;
+
+  slot->state = THREAD_SCALE_RUN;
+  scale->nb++;
+  return 0;
+}
+
+void *
+vh_thread_scale_data (void *arg, unsigned int *id)
+{
+  thread_scale_slot_t *slot = arg;
+
+  if (!slot)
+    return NULL;
+
+  if (id)
+    *id = slot->id;
+  return slot->scale->data;
+}
+
+void
+vh_thread_scale_sample (thread_scale_t *scale, uint64_t time)
+{
+  if (!scale)
+    return;
+
+  pthread_mutex_lock (&scale->mutex);
+  /* moving average, the last entry has a weight of 1/8 */
+  scale->service =
+    scale->service ? (scale->service * 7 + time) / 8 : time;
+  pthread_mutex_unlock (&scale->mutex);
+}
+
+void
+vh_thread_scale_grow (thread_scale_t *scale, unsigned int depth)
+{
+  int grow;
+
+  if (!scale)
+    return;
+
+  pthread_mutex_lock (&scale->mutex);
+
+  if (scale->frozen || scale->stop || scale->nb >= scale->max)
+    goto out;
+
+  /* no sample, the backlog is unknown */
+  if (!scale->service)
+    grow = depth > scale->nb;
+  else
+    grow = depth * scale->service > scale->nb * THREAD_SCALE_BACKLOG;
+
+  if (grow)
+    thread_scale_spawn (scale);
+
+ out:
+  pthread_mutex_unlock (&scale->mutex);
+}
+
+int
+vh_thread_scale_retire (thread_scale_t *scale,
+                        unsigned int id, unsigned int depth)
+{
+  int retire = 0;
+
+  if (!scale || id >= scale->max)
+    return 0;
+
+  pthread_mutex_lock (&scale->mutex);
+
+  if (!scale->frozen && !scale->stop && !depth && scale->nb > scale->min)
+  {
+    scale->slot[id].state = THREAD_SCALE_EXIT;
+    scale->nb--;
+    retire = 1;
+  }
+
+  pthread_mutex_unlock (&scale->mutex);
+  return retire;
+}
+
+/*
+ * The number of threads can not change while the scaling is frozen. It
+ * returns the number of running threads.
+ */
+unsigned int
+vh_thread_scale_freeze (thread_scale_t *scale, int freeze)
+{
+  unsigned int nb;
+
+  if (!scale)
+    return 0;
+
+  pthread_mutex_lock (&scale->mutex);
+  scale->frozen = freeze;
+  nb = scale->nb;
+  pthread_mutex_unlock (&scale->mutex);
+
+  return nb;
+}
+
+int
+vh_thread_scale_start (thread_scale_t *scale)
+{
+  int res = 0;
+  unsigned int i;
+
+  if (!scale)
+    return -1;
+
+  pthread_mutex_lock (&scale->mutex);
+
+  for (i = 0; i < scale->min && !res; i++)
+    res = thread_scale_spawn (scale);
+  scale->frozen = 0;
+
+  pthread_mutex_unlock (&scale->mutex);
+  return res;
+}
+
+unsigned int
+vh_thread_scale_stop (thread_scale_t *scale)
+{
+  unsigned int nb;
+
+  if (!scale)
+    return 0;
+
+  pthread_mutex_lock (&scale->mutex);
+  scale->stop = 1;
+  nb = scale->nb;
+  pthread_mutex_unlock (&scale->mutex);
+
+  return nb;
+}
+
+void
+vh_thread_scale_join (thread_scale_t *scale)
+{
+  unsigned int i;
+
+  if (!scale)
+    return;
+
+  /* no thread can be started after vh_thread_scale_stop() */
+  for (i = 0; i < scale->max; i++)
+    if (scale->slot[i].state != THREAD_SCALE_FREE)
+    {
+      pthread_join (scale->slot[i].thread, NULL);
+      scale->slot[i].state = THREAD_SCALE_FREE;
+    }
+
+  scale->nb = 0;
+}
+
+void
+vh_thread_scale_free (thread_scale_t *scale)
+{
+  if (!scale)
+    return;
+
+  pthread_mutex_destroy (&scale->mutex);
+  free (scale);
+}
+
+thread_scale_t *
+vh_thread_scale_new (unsigned int min, unsigned int max, size_t stack,
+                     void *(*fct) (void *arg), void *data)
+{
+  unsigned int i;
+  thread_scale_t *scale;
+
+  if (!fct || !max || max > THREAD_SCALE_NB_MAX)
+    return NULL;
+
+  scale = calloc (1, sizeof (thread_scale_t));
+  if (!scale)
+    return NULL;
+
+  scale->min    = min && min < max ? min : max;
+  scale->max    = max;
+  scale->stack  = stack;
+  scale->fct    = fct;
+  scale->data   = data;
+  scale->frozen = 1; /* until vh_thread_scale_start() */
+
+  for (i = 0; i < max; i++)
+  {
+    scale->slot[i].scale = scale;
+    scale->slot[i].id    = i;
+  }
+
+  pthread_mutex_init (&scale->mutex, NULL);
+
+  return scale;
+}
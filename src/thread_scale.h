@@ -0,0 +1,44 @@
+/*
+ * GeeXboX Valhalla: tiny media scanner API.
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of libvalhalla.
+ *
+ * libvalhalla is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libvalhalla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libvalhalla; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef VALHALLA_THREAD_SCALE_H
+#define VALHALLA_THREAD_SCALE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+typedef struct thread_scale_s thread_scale_t;
+
+void *vh_thread_scale_data (void *arg, unsigned int *id);
+void vh_thread_scale_sample (thread_scale_t *scale, uint64_t time);
+void vh_thread_scale_grow (thread_scale_t *scale, unsigned int depth);
+int vh_thread_scale_retire (thread_scale_t *scale,
+                            unsigned int id, unsigned int depth);
+unsigned int vh_thread_scale_freeze (thread_scale_t *scale, int freeze);
+int vh_thread_scale_start (thread_scale_t *scale);
+unsigned int vh_thread_scale_stop (thread_scale_t *scale);
+void vh_thread_scale_join (thread_scale_t *scale);
+void vh_thread_scale_free (thread_scale_t *scale);
+thread_scale_t *vh_thread_scale_new (unsigned int min, unsigned int max,
+                                     size_t stack,
+                                     void *(*fct) (void *arg), void *data);
+
+#endif /* VALHALLA_THREAD_SCALE_H */
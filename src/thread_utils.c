@@ -19,6 +19,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <limits.h>
 #include <unistd.h>
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -87,3 +88,35 @@ vh_setpriority (int prio)
   return (int) pid;
 #endif /* !_WIN32 */
 }
+
+int
+vh_setioprio_idle (void)
+{
+#if defined (__linux__) && defined (SYS_ioprio_set)
+  /*
+   * The I/O scheduler (CFQ) of Linux serves the idle class only when no
+   * other process is using the disk. There is no wrapper in glibc; the
+   * values are from linux/ioprio.h.
+   *  IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_IDLE = 3, IOPRIO_CLASS_SHIFT = 13
+   * A PID of 0 is the calling thread.
+   */
+  return (int) syscall (SYS_ioprio_set, 1, 0, 3 << 13);
+#else /* __linux__ && SYS_ioprio_set */
+  return -1;
+#endif /* !(__linux__ && SYS_ioprio_set) */
+}
+
+void
+vh_thread_stack_set (pthread_attr_t *attr, size_t size)
+{
+  /* 0 for the default size of the system */
+  if (!attr || !size)
+    return;
+
+#ifdef PTHREAD_STACK_MIN
+  if (size < PTHREAD_STACK_MIN)
+    size = PTHREAD_STACK_MIN;
+#endif /* PTHREAD_STACK_MIN */
+
+  pthread_attr_setstacksize (attr, size);
+}
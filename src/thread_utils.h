@@ -22,6 +22,11 @@
 #ifndef VALHALLA_THREAD_UTILS_H
 #define VALHALLA_THREAD_UTILS_H
 
+#include <pthread.h>
+#include <stddef.h>
+
 int vh_setpriority (int prio);
+int vh_setioprio_idle (void);
+void vh_thread_stack_set (pthread_attr_t *attr, size_t size);
 
 #endif /* VALHALLA_THREAD_UTILS_H */
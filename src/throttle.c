@@ -0,0 +1,189 @@
+/*
+ * GeeXboX Valhalla: tiny media scanner API.
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of libvalhalla.
+ *
+ * libvalhalla is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libvalhalla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libvalhalla; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "throttle.h"
+
+/*
+ * Token buckets shared by all threads which are reading the disks. The
+ * bucket is refilled with \p rate tokens per second and it can contain at
+ * most one second of tokens. A thread can take more tokens than available,
+ * then the bucket is in debt and the thread sleeps until that the debt is
+ * refunded. The next threads see the debt and sleep longer.
+ */
+struct throttle_bucket_s {
+  unsigned int   rate;   /* tokens per second, 0 for unlimited */
+  double         tokens;
+  struct timeval last;
+  int            abort;  /* the users are stopping */
+};
+
+struct throttle_s {
+  struct throttle_bucket_s bucket[THROTTLE_TYPE_LAST];
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+};
+
+
+static void
+throttle_refill (struct throttle_bucket_s *bucket, const struct timeval *now)
+{
+  double elapsed;
+
+  elapsed = (double) (now->tv_sec - bucket->last.tv_sec)
+          + (double) (now->tv_usec - bucket->last.tv_usec) / 1000000.0;
+  if (elapsed > 0.0)
+    bucket->tokens += elapsed * bucket->rate;
+
+  if (bucket->tokens > bucket->rate)
+    bucket->tokens = bucket->rate;
+
+  bucket->last = *now;
+}
+
+void
+vh_throttle_take (throttle_t *throttle,
+                  throttle_type_t type, unsigned long amount)
+{
+  struct throttle_bucket_s *bucket;
+  struct timeval now;
+  struct timespec ts;
+  double wait;
+
+  if (!throttle || type >= THROTTLE_TYPE_LAST || !amount)
+    return;
+
+  bucket = &throttle->bucket[type];
+
+  pthread_mutex_lock (&throttle->mutex);
+
+  if (!bucket->rate || bucket->abort)
+    goto out;
+
+  gettimeofday (&now, NULL);
+  throttle_refill (bucket, &now);
+
+  bucket->tokens -= amount;
+  if (bucket->tokens >= 0.0)
+    goto out;
+
+  /* wait until that the debt is refunded */
+  wait = -bucket->tokens / bucket->rate;
+  ts.tv_sec  = now.tv_sec + (time_t) wait;
+  ts.tv_nsec = now.tv_usec * 1000
+             + (long) ((wait - (time_t) wait) * 1000000000.0);
+  if (ts.tv_nsec >= 1000000000)
+  {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+
+  while (!bucket->abort)
+    if (pthread_cond_timedwait (&throttle->cond,
+                                &throttle->mutex, &ts) == ETIMEDOUT)
+      break;
+
+ out:
+  pthread_mutex_unlock (&throttle->mutex);
+}
+
+int
+vh_throttle_enabled (throttle_t *throttle, throttle_type_t type)
+{
+  int res;
+
+  if (!throttle || type >= THROTTLE_TYPE_LAST)
+    return 0;
+
+  pthread_mutex_lock (&throttle->mutex);
+  res = throttle->bucket[type].rate && !throttle->bucket[type].abort;
+  pthread_mutex_unlock (&throttle->mutex);
+
+  return res;
+}
+
+void
+vh_throttle_rate_set (throttle_t *throttle,
+                      throttle_type_t type, unsigned int rate)
+{
+  struct throttle_bucket_s *bucket;
+
+  if (!throttle || type >= THROTTLE_TYPE_LAST)
+    return;
+
+  bucket = &throttle->bucket[type];
+
+  pthread_mutex_lock (&throttle->mutex);
+  bucket->rate   = rate;
+  bucket->tokens = rate;
+  gettimeofday (&bucket->last, NULL);
+  pthread_mutex_unlock (&throttle->mutex);
+}
+
+/*
+ * Wake up the threads sleeping on the bucket \p type (or on all buckets with
+ * THROTTLE_TYPE_LAST), this rate is no longer respected.
+ */
+void
+vh_throttle_abort (throttle_t *throttle, throttle_type_t type)
+{
+  int i;
+
+  if (!throttle || type > THROTTLE_TYPE_LAST)
+    return;
+
+  pthread_mutex_lock (&throttle->mutex);
+  for (i = 0; i < THROTTLE_TYPE_LAST; i++)
+    if (type == THROTTLE_TYPE_LAST || type == (throttle_type_t) i)
+      throttle->bucket[i].abort = 1;
+  pthread_cond_broadcast (&throttle->cond);
+  pthread_mutex_unlock (&throttle->mutex);
+}
+
+throttle_t *
+vh_throttle_new (void)
+{
+  throttle_t *throttle;
+
+  throttle = calloc (1, sizeof (throttle_t));
+  if (!throttle)
+    return NULL;
+
+  pthread_mutex_init (&throttle->mutex, NULL);
+  pthread_cond_init (&throttle->cond, NULL);
+  return throttle;
+}
+
+void
+vh_throttle_free (throttle_t *throttle)
+{
+  if (!throttle)
+    return;
+
+  pthread_mutex_destroy (&throttle->mutex);
+  pthread_cond_destroy (&throttle->cond);
+  free (throttle);
+}
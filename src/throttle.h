@@ -0,0 +1,44 @@
+/*
+ * GeeXboX Valhalla: tiny media scanner API.
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This file is part of libvalhalla.
+ *
+ * libvalhalla is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libvalhalla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libvalhalla; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef VALHALLA_THROTTLE_H
+#define VALHALLA_THROTTLE_H
+
+typedef struct throttle_s throttle_t;
+
+typedef enum throttle_type {
+  THROTTLE_BYTES = 0,   /* bytes read in the files               */
+  THROTTLE_OPS,         /* file system operations (stat, opendir) */
+
+  THROTTLE_TYPE_LAST
+} throttle_type_t;
+
+
+throttle_t *vh_throttle_new (void);
+void vh_throttle_free (throttle_t *throttle);
+void vh_throttle_abort (throttle_t *throttle, throttle_type_t type);
+void vh_throttle_rate_set (throttle_t *throttle,
+                           throttle_type_t type, unsigned int rate);
+int vh_throttle_enabled (throttle_t *throttle, throttle_type_t type);
+void vh_throttle_take (throttle_t *throttle,
+                       throttle_type_t type, unsigned long amount);
+
+#endif /* VALHALLA_THROTTLE_H */
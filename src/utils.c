@@ -125,6 +125,89 @@ vh_file_copy (const char *src, const char *dst)
   return res;
 }
 
+static ssize_t
+file_signature_pread (void *handle, unsigned char *buf, size_t size,
+                      int64_t offset)
+{
+  return pread (*(int *) handle, buf, size, (off_t) offset);
+}
+
+static uint64_t
+file_signature_block (vh_signature_read_t read_fct, void *handle,
+                      int64_t offset, size_t size, uint64_t hash)
+{
+  ssize_t r;
+  unsigned char b[BUFFER_SIZE];
+
+  while (size && (r = read_fct (handle, b, size < sizeof (b) ? size
+                                                             : sizeof (b),
+                                offset)) > 0)
+  {
+    ssize_t i;
+
+    /* FNV-1a */
+    for (i = 0; i < r; i++)
+    {
+      hash ^= b[i];
+      hash *= 1099511628211ULL;
+    }
+
+    offset += r;
+    size   -= r;
+  }
+
+  return hash;
+}
+
+/*
+ * Cheap signature of the content of a file (the size and a hash of the first
+ * and the last blocks). It is used to recognize a file which is moved or
+ * renamed. The blocks are read with \p read_fct on an already opened file.
+ * The return value is 0 on error.
+ */
+int64_t
+vh_file_signature_read (vh_signature_read_t read_fct, void *handle,
+                        int64_t size)
+{
+  uint64_t hash = 14695981039346656037ULL ^ (uint64_t) size;
+
+  if (!read_fct || size <= 0)
+    return 0;
+
+  if (size <= 2 * VH_SIGNATURE_BLOCK)
+    hash = file_signature_block (read_fct, handle, 0, (size_t) size, hash);
+  else
+  {
+    hash = file_signature_block (read_fct, handle,
+                                 0, VH_SIGNATURE_BLOCK, hash);
+    hash = file_signature_block (read_fct, handle,
+                                 size - VH_SIGNATURE_BLOCK,
+                                 VH_SIGNATURE_BLOCK, hash);
+  }
+
+  return hash ? (int64_t) hash : 1;
+}
+
+/* Same as vh_file_signature_read() but the file is opened here. */
+int64_t
+vh_file_signature (const char *file, int64_t size)
+{
+  int fd;
+  int64_t sign;
+
+  if (!file || size <= 0)
+    return 0;
+
+  fd = open (file, O_RDONLY | O_BINARY);
+  if (fd == -1)
+    return 0;
+
+  sign = vh_file_signature_read (file_signature_pread, &fd, size);
+
+  close (fd);
+  return sign;
+}
+
 void
 vh_file_dl_add (file_dl_t **dl,
                 const char *url, const char *name, valhalla_dl_t dst)
@@ -211,9 +294,12 @@ vh_file_data_new (const char *file, struct stat *st, int outofpath,
   fdata->file.path    = strdup (file);
   fdata->file.mtime   = (int64_t) st->st_mtime;
   fdata->file.size    = (int64_t) st->st_size;
+  fdata->dev          = (int64_t) st->st_dev;
+  fdata->ino          = (int64_t) st->st_ino;
   fdata->outofpath    = outofpath;
   fdata->od           = od;
   fdata->priority     = prio;
+  fdata->priority_db  = FIFO_QUEUE_PRIORITY_HIGH;
   fdata->step         = step;
   fdata->grabber_list = vh_list_new (0, NULL);
 
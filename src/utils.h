@@ -50,8 +50,13 @@ typedef struct file_dl_s {
 typedef struct file_data_s {
   valhalla_file_t      file;
   int                  outofpath;
+  /* identity of the file (hard links, bind mounts, ...) */
+  int64_t              dev;
+  int64_t              ino;
+  int64_t              sign;  /* content signature, set by the parser */
   od_type_t            od;
   fifo_queue_prio_t    priority;
+  fifo_queue_prio_t    priority_db; /* lowest one sent to the dbmanager */
   metadata_t          *meta_parser;
   processing_step_t    step;
 
@@ -74,6 +79,11 @@ void vh_strtolower (char *str);
 char *vh_strrcasestr (const char *buf, const char *str);
 int vh_file_exists (const char *file);
 int vh_file_copy (const char *src, const char *dst);
+typedef ssize_t (*vh_signature_read_t) (void *handle, unsigned char *buf,
+                                        size_t size, int64_t offset);
+int64_t vh_file_signature_read (vh_signature_read_t read_fct, void *handle,
+                                int64_t size);
+int64_t vh_file_signature (const char *file, int64_t size);
 void vh_file_dl_add (file_dl_t **dl,
                      const char *url, const char *name, valhalla_dl_t dst);
 void vh_file_data_free (file_data_t *data);
@@ -84,6 +94,8 @@ void vh_file_data_step_increase (file_data_t *data, action_list_t *action);
 void vh_file_data_step_continue (file_data_t *data, action_list_t *action);
 int vh_get_list_length (void *list);
 
+#define VH_SIGNATURE_BLOCK (64 * 1024)
+
 #define ARRAY_NB_ELEMENTS(array) (sizeof (array) / sizeof (array[0]))
 
 #define VH_ISALNUM(c) isalnum ((int) (unsigned char) (c))
@@ -22,6 +22,7 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef USE_LAVC
 #include <libavcodec/avcodec.h>
@@ -36,9 +37,11 @@
 #include "dispatcher.h"
 #include "ondemand.h"
 #include "event_handler.h"
+#include "executor.h"
 #include "utils.h"
 #include "osdep.h"
 #include "stats.h"
+#include "throttle.h"
 #include "metadata.h"
 #include "logs.h"
 
@@ -102,12 +105,34 @@ queue_cleanup (fifo_queue_t *queue)
         vh_dbmanager_extmd_free (data);
       break;
 
+    case ACTION_DB_NEWFILES:
+      if (data)
+        vh_dbmanager_files_free (data);
+      break;
+
+    case ACTION_DB_DIRECTORY:
+      if (data)
+        vh_dbmanager_dir_free (data);
+      break;
+
+    case ACTION_DB_DELFILE:
+    case ACTION_DB_CHECKPOINT:
     case ACTION_OD_ENGAGE:
     case ACTION_EH_EVENTGL:
       if (data)
         free (data);
       break;
 
+    case ACTION_OD_ENGAGE_MANY:
+      if (data)
+        vh_ondemand_files_free (data);
+      break;
+
+    case ACTION_OD_HINT:
+      if (data)
+        vh_ondemand_hint_free (data);
+      break;
+
     case ACTION_EH_EVENTOD:
       if (data)
         vh_event_handler_od_free (data);
@@ -203,6 +228,10 @@ valhalla_mrproper (valhalla_t *handle)
         break;
       }
 
+      case ACTION_DB_NEWFILES:
+      case ACTION_DB_DELFILE:
+      case ACTION_DB_DIRECTORY:
+      case ACTION_DB_CHECKPOINT:
       case ACTION_DB_EXT_INSERT:
       case ACTION_DB_EXT_UPDATE:
       case ACTION_DB_EXT_DELETE:
@@ -290,21 +319,75 @@ valhalla_config_set_orig (valhalla_t *handle, valhalla_cfg_t conf, ...)
     break;
 #endif /* USE_GRABBER */
 
+  case VALHALLA_CFG_IO_BANDWIDTH:
+    vh_throttle_rate_set (handle->throttle,
+                          THROTTLE_BYTES, i > 0 ? (unsigned int) i : 0);
+    break;
+
+  case VALHALLA_CFG_IO_IDLE:
+    handle->ioidle = !!i;
+    break;
+
+  case VALHALLA_CFG_IO_OPERATIONS:
+    vh_throttle_rate_set (handle->throttle,
+                          THROTTLE_OPS, i > 0 ? (unsigned int) i : 0);
+    break;
+
   case VALHALLA_CFG_PARSER_KEYWORD:
     if (p1)
       vh_parser_bl_keyword_add (handle->parser, p1);
     break;
 
+  case VALHALLA_CFG_QUEUE_LIMIT:
+  {
+    unsigned int limit = i > 0 ? (unsigned int) i : 0;
+
+    vh_fifo_queue_limit_set (vh_dbmanager_fifo_get (handle->dbmanager), limit);
+    vh_fifo_queue_limit_set (vh_dispatcher_fifo_get (handle->dispatcher),
+                             limit);
+    vh_fifo_queue_limit_set (vh_parser_fifo_get (handle->parser), limit);
+    break;
+  }
+
+  case VALHALLA_CFG_QUEUE_SPILL:
+    vh_dbmanager_spill_set (handle->dbmanager, i);
+    break;
+
+  case VALHALLA_CFG_SCANNER_CHECKPOINT:
+    vh_scanner_checkpoint_set (handle->scanner, i);
+    break;
+
+  case VALHALLA_CFG_SCANNER_EXCLUDE:
+    if (p2)
+      vh_scanner_exclude_add (handle->scanner, p1, p2);
+    break;
+
+  case VALHALLA_CFG_SCANNER_OFFLINE:
+    vh_scanner_offline_set (handle->scanner, i);
+    break;
+
   case VALHALLA_CFG_SCANNER_PATH:
     if (p1)
       vh_scanner_path_add (handle->scanner, p1, i);
     break;
 
+  case VALHALLA_CFG_SCANNER_PRUNING:
+    vh_scanner_pruning_set (handle->scanner, i);
+    break;
+
   case VALHALLA_CFG_SCANNER_SUFFIX:
     if (p1)
       vh_scanner_suffix_add (handle->scanner, p1);
     break;
 
+  case VALHALLA_CFG_SCANNER_THREADS:
+    vh_scanner_walker_set (handle->scanner, i > 0 ? (unsigned int) i : 0);
+    break;
+
+  case VALHALLA_CFG_SCANNER_WATCH:
+    vh_scanner_watch_set (handle->scanner, i);
+    break;
+
   default:
     vh_log (VALHALLA_MSG_WARNING,
             "%s: unsupported option %#x", __FUNCTION__, conf);
@@ -335,6 +418,7 @@ valhalla_wait (valhalla_t *handle)
   vh_grabber_stop (handle->grabber, f);
   vh_downloader_stop (handle->downloader, f);
 #endif /* USE_GRABBER */
+  vh_executor_stop (handle->executor, f);
   vh_event_handler_stop (handle->event_handler, f);
 
   handle->fstop = 1;
@@ -348,6 +432,9 @@ valhalla_force_stop (valhalla_t *handle)
   vh_log (VALHALLA_MSG_WARNING,
           "%s: This can take a time, please be patient", __FUNCTION__);
 
+  /* the threads must not sleep for the I/O budget */
+  vh_throttle_abort (handle->throttle, THROTTLE_TYPE_LAST);
+
   for (i = 0; i < 2; i++)
   {
     int f = !i ? STOP_FLAG_REQUEST : STOP_FLAG_WAIT;
@@ -362,6 +449,7 @@ valhalla_force_stop (valhalla_t *handle)
     vh_grabber_stop (handle->grabber, f);
     vh_downloader_stop (handle->downloader, f);
 #endif /* USE_GRABBER */
+    vh_executor_stop (handle->executor, f);
     vh_event_handler_stop (handle->event_handler, f);
 
 #ifdef USE_GRABBER
@@ -406,6 +494,7 @@ valhalla_uninit (valhalla_t *handle)
   vh_grabber_uninit (handle->grabber);
   vh_downloader_uninit (handle->downloader);
 #endif /* USE_GRABBER */
+  vh_executor_uninit (handle->executor);
   vh_event_handler_uninit (handle->event_handler);
 
 #if USE_GRABBER
@@ -419,6 +508,7 @@ valhalla_uninit (valhalla_t *handle)
 #endif /* USE_LAVC */
 
   vh_stats_free (handle->stats);
+  vh_throttle_free (handle->throttle);
 
   vh_log (VALHALLA_MSG_VERBOSE, "%s: end", __FUNCTION__);
 
@@ -482,6 +572,13 @@ valhalla_run (valhalla_t *handle,
     return VALHALLA_ERROR_THREAD;
 #endif /* USE_GRABBER */
 
+  if (handle->executor)
+  {
+    res = vh_executor_run (handle->executor, priority);
+    if (res)
+      return VALHALLA_ERROR_THREAD;
+  }
+
   res = vh_ondemand_run (handle->ondemand, priority);
   if (res)
     return VALHALLA_ERROR_THREAD;
@@ -618,6 +715,8 @@ valhalla_init (const char *db, valhalla_init_param_t *param)
   if (!handle)
     return NULL;
 
+  handle->stack_size = pp->stack_size;
+
 #ifdef USE_GRABBER
   handle->url_ctl = vh_url_ctl_new ();
   if (!handle->url_ctl)
@@ -630,6 +729,10 @@ valhalla_init (const char *db, valhalla_init_param_t *param)
   if (!handle->stats)
     goto err;
 
+  handle->throttle = vh_throttle_new ();
+  if (!handle->throttle)
+    goto err;
+
   if (pp->od_cb || pp->gl_cb || pp->md_cb)
   {
     event_handler_cb_t cb;
@@ -650,12 +753,20 @@ valhalla_init (const char *db, valhalla_init_param_t *param)
   if (!handle->dispatcher)
     goto err;
 
-  handle->parser = vh_parser_init (handle, pp->parser_nb, pp->decrapifier);
+  if (pp->pool)
+  {
+    handle->executor = vh_executor_init (handle, 0);
+    if (!handle->executor)
+      goto err;
+  }
+
+  handle->parser = vh_parser_init (handle, pp->parser_nb,
+                                   pp->parser_min, pp->decrapifier);
   if (!handle->parser)
     goto err;
 
 #ifdef USE_GRABBER
-  handle->grabber = vh_grabber_init (handle, pp->grabber_nb);
+  handle->grabber = vh_grabber_init (handle, pp->grabber_nb, pp->grabber_min);
   if (!handle->grabber)
     goto err;
 
@@ -726,6 +837,76 @@ valhalla_ondemand (valhalla_t *handle, const char *file)
                            ACTION_OD_ENGAGE, odfile);
 }
 
+void
+valhalla_ondemand_many (valhalla_t *handle,
+                        const char **files, unsigned int nb)
+{
+  unsigned int i;
+  ondemand_files_t *odfiles;
+
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!handle || !files || !nb)
+    return;
+
+  odfiles = calloc (1, sizeof (ondemand_files_t) + nb * sizeof (char *));
+  if (!odfiles)
+    return;
+
+  for (i = 0; i < nb; i++)
+  {
+    if (!files[i])
+      continue;
+
+    odfiles->files[odfiles->nb] = strdup (files[i]);
+    if (odfiles->files[odfiles->nb])
+      odfiles->nb++;
+  }
+
+  if (!odfiles->nb)
+  {
+    vh_ondemand_files_free (odfiles);
+    return;
+  }
+
+  vh_ondemand_action_send (handle->ondemand, FIFO_QUEUE_PRIORITY_HIGH,
+                           ACTION_OD_ENGAGE_MANY, odfiles);
+}
+
+void
+valhalla_priority_hint_dir (valhalla_t *handle,
+                            const char *path, unsigned int ttl)
+{
+  size_t len;
+  ondemand_hint_t *hint;
+
+  vh_log (VALHALLA_MSG_VERBOSE, __FUNCTION__);
+
+  if (!handle || !path || !*path)
+    return;
+
+  hint = calloc (1, sizeof (ondemand_hint_t));
+  if (!hint)
+    return;
+
+  hint->path = strdup (path);
+  if (!hint->path)
+  {
+    free (hint);
+    return;
+  }
+
+  /* the trailing slashes are ignored (except for the root) */
+  len = strlen (hint->path);
+  while (len > 1 && hint->path[len - 1] == '/')
+    hint->path[--len] = '\0';
+
+  hint->expire = ttl ? time (NULL) + ttl : 0;
+
+  vh_ondemand_action_send (handle->ondemand, FIFO_QUEUE_PRIORITY_HIGH,
+                           ACTION_OD_HINT, hint);
+}
+
 const char *
 valhalla_ondemand_cb_meta (valhalla_t *handle, const char *meta)
 {
@@ -40,10 +40,10 @@ extern "C" {
 #define VH_VERSION(a, b, c) VH_VERSION_DOT(a, b, c)
 
 #define LIBVALHALLA_VERSION_MAJOR  2
-#define LIBVALHALLA_VERSION_MINOR  1
+#define LIBVALHALLA_VERSION_MINOR  2
 #define LIBVALHALLA_VERSION_MICRO  0
 
-#define LIBVALHALLA_DB_VERSION     2
+#define LIBVALHALLA_DB_VERSION     5
 
 #define LIBVALHALLA_VERSION_INT VH_VERSION_INT(LIBVALHALLA_VERSION_MAJOR, \
                                                LIBVALHALLA_VERSION_MINOR, \
@@ -374,9 +374,11 @@ typedef struct valhalla_file_s {
  *
  * Next \p num for the current combinations :
  * <pre>
+ * VH_INT_T                             : 10
  * VH_VOIDP_T                           : 2
  * VH_VOIDP_T | VH_INT_T                : 3
  * VH_VOIDP_T | VH_INT_T | VH_VOIDP_2_T : 1
+ * VH_VOIDP_T | VH_VOIDP_2_T            : 1
  * </pre>
  *
  * \see VH_CFG_INIT().
@@ -425,6 +427,38 @@ typedef enum valhalla_cfg {
    */
   VH_CFG_INIT (GRABBER_STATE, VH_VOIDP_T | VH_INT_T, 0),
 
+  /**
+   * Limit the bandwidth used to read the files. The parsers (probing and
+   * FFmpeg demuxers) share this budget of bytes per second. It is useful
+   * when an other application (a media player for example) is reading the
+   * same disk, then the scan can not cause stutters. The default value is
+   * 0 (unlimited).
+   *
+   * \param[in] arg1 ::VH_INT_T     Bytes per second, 0 for unlimited.
+   */
+  VH_CFG_INIT (IO_BANDWIDTH, VH_INT_T, 3),
+
+  /**
+   * Set the idle I/O class (ioprio) to the scanner and the parser threads.
+   * With this class, the disk is used by these threads only when no other
+   * process is using it. Only the Linux I/O schedulers which are supporting
+   * the priorities (like CFQ) are concerned.
+   *
+   * \warning There is no effect on an other OS than Linux.
+   * \param[in] arg1 ::VH_INT_T     0 to disable, !=0 to enable.
+   */
+  VH_CFG_INIT (IO_IDLE, VH_INT_T, 4),
+
+  /**
+   * Limit the number of operations on the file systems (stat, opendir, ...)
+   * done by the scanner. The walker threads share this budget of operations
+   * per second. It is useful mainly with the slow disks and the network
+   * shares. The default value is 0 (unlimited).
+   *
+   * \param[in] arg1 ::VH_INT_T     Operations per second, 0 for unlimited.
+   */
+  VH_CFG_INIT (IO_OPERATIONS, VH_INT_T, 5),
+
   /**
    * This parameter is useful only if the decrapifier is enabled with
    * valhalla_init().
@@ -466,6 +500,83 @@ typedef enum valhalla_cfg {
    */
   VH_CFG_INIT (PARSER_KEYWORD, VH_VOIDP_T, 0),
 
+  /**
+   * Limit the number of entries in the queues of the dbmanager, the
+   * dispatcher and the parser. When a queue is full, the scanner (or the
+   * stage before) waits, then the memory used by a big scan is bounded.
+   * The entries of the ondemand queries are never limited. It is a soft
+   * limit, it can be exceeded a bit when several threads are sending at
+   * the same time. The default value is 0 (unlimited).
+   *
+   * \param[in] arg1 ::VH_INT_T     Number of entries, 0 for unlimited.
+   */
+  VH_CFG_INIT (QUEUE_LIMIT, VH_INT_T, 8),
+
+  /**
+   * Save the entries of the scanner in a temporary table of the database
+   * instead of waiting, when the queue of the dispatcher is full. This
+   * option is useful only with ::VALHALLA_CFG_QUEUE_LIMIT. The scan is not
+   * slowed down by the parsers, and the backlog is kept on the disk instead
+   * of the memory. The table is lost when the application is stopped; the
+   * files not yet handled are found again with the next scan.
+   *
+   * \param[in] arg1 ::VH_INT_T     0 to disable, !=0 to enable.
+   */
+  VH_CFG_INIT (QUEUE_SPILL, VH_INT_T, 9),
+
+  /**
+   * Save periodically the position of the scanner in the database. When
+   * the application is stopped (or killed) during a scan, the next first
+   * loop resumes the scan at this position. The directories already
+   * handled are skipped, only their files whose parsing or grabbing was
+   * interrupted are handled again. The changes in these directories are
+   * detected only with the next loop.
+   *
+   * The position is not used when the suffixes or the exclusions have
+   * changed. There is no effect with the watch mode.
+   *
+   * \param[in] arg1 ::VH_INT_T     Interval in seconds, 0 to disable.
+   */
+  VH_CFG_INIT (SCANNER_CHECKPOINT, VH_INT_T, 6),
+
+  /**
+   * Exclude some files and directories from the scanning. The excluded
+   * directories are never read, and the excluded files already in the
+   * database are removed with the next loop.
+   *
+   * The wildcards *, ? and [...] are supported. A pattern without '/' is
+   * compared with the name of each file and directory (like "@eaDir",
+   * ".snapshot" or "*sample*"). A pattern with '/' is compared with the
+   * path relative to the scanner path (like "Movies/Trailers").
+   *
+   * The scanner path must be added with ::VALHALLA_CFG_SCANNER_PATH before
+   * its exclusions. If \p arg1 is NULL, the pattern is used for all paths.
+   *
+   * \p arg1 and \p arg3 must be null-terminated strings.
+   *
+   * \param[in] arg1 ::VH_VOIDP_T   Scanner path or NULL.
+   * \param[in] arg3 ::VH_VOIDP_2_T Pattern to exclude.
+   */
+  VH_CFG_INIT (SCANNER_EXCLUDE, VH_VOIDP_T | VH_VOIDP_2_T, 0),
+
+  /**
+   * Keep the files of the unreachable paths in the database. It is useful
+   * with the removable media and the network shares. A path is unreachable
+   * when its directory does not exist, or when it is no longer a mount point
+   * (the device has changed since the previous loop), or when it is a mount
+   * point of /etc/fstab which is not mounted (on the same device than its
+   * parent). An empty local directory is reachable.
+   *
+   * The files of an unreachable path are marked offline instead of being
+   * removed from the database. When the path is available again, the files
+   * where the mtime has not changed are not parsed and grabbed again. The
+   * application can use valhalla_scanner_wakeup() to scan the paths as soon
+   * as a media or a share is mounted.
+   *
+   * \param[in] arg1 ::VH_INT_T     0 to disable, !=0 to enable.
+   */
+  VH_CFG_INIT (SCANNER_OFFLINE, VH_INT_T, 7),
+
   /**
    * Add a path to the scanner. If the same path is added several times,
    * only one is saved in the scanner.
@@ -477,6 +588,22 @@ typedef enum valhalla_cfg {
    */
   VH_CFG_INIT (SCANNER_PATH, VH_VOIDP_T | VH_INT_T, 1),
 
+  /**
+   * Enable the pruning of the unchanged directories. The state of each
+   * directory (mtime and a hash of the list of the entries) is saved in the
+   * database. With the next loops, the files of a directory are not handled
+   * again when its state has not changed; only the sub-directories are
+   * walked.
+   *
+   * The mtime of a directory is not changed when a file is only modified
+   * in place (without rename). Then these modifications are not detected
+   * with this mode; the watch mode or a loop without pruning must be used
+   * in this case.
+   *
+   * \param[in] arg1 ::VH_INT_T     0 to disable, !=0 to enable.
+   */
+  VH_CFG_INIT (SCANNER_PRUNING, VH_INT_T, 2),
+
   /**
    * If no suffix is added to the scanner, then all files will be parsed by
    * FFmpeg without exception and it can be very slow. It is highly recommanded
@@ -490,6 +617,33 @@ typedef enum valhalla_cfg {
    */
   VH_CFG_INIT (SCANNER_SUFFIX, VH_VOIDP_T, 1),
 
+  /**
+   * Number of threads for walking the directories (max 16). The default
+   * number of threads is 1. The directories are shared between the threads
+   * and all paths are scanned concurrently. It is useful mainly with the
+   * network shares (NFS, SMB, ...) where each access on a file is slow.
+   *
+   * \param[in] arg1 ::VH_INT_T     Number of threads.
+   */
+  VH_CFG_INIT (SCANNER_THREADS, VH_INT_T, 1),
+
+  /**
+   * Enable the watch mode of the scanner. When enabled, only the first loop
+   * is a full scan of the paths. Then the scanner waits for the changes
+   * notified by the kernel (inotify) and only the files created, modified,
+   * moved or deleted are handled. The parameters \p loop and \p timeout of
+   * valhalla_run() are ignored in this mode, and valhalla_wait() never
+   * returns because the scanner never ends. When a notification queue
+   * overflows, only the path where the overflow occurs is scanned again.
+   *
+   * If the watch mode can not be initialized, the scanner falls back to the
+   * usual loops.
+   *
+   * \warning There is no effect if the inotify support is not compiled.
+   * \param[in] arg1 ::VH_INT_T     0 to disable, !=0 to enable.
+   */
+  VH_CFG_INIT (SCANNER_WATCH, VH_INT_T, 0),
+
 } valhalla_cfg_t;
 
 /** \brief Parameters for valhalla_init(). */
@@ -528,6 +682,13 @@ typedef struct valhalla_init_param_s {
    * ondemand callback by using the function valhalla_ondemand_cb_meta().
    */
   unsigned int od_meta     : 1;
+  /**
+   * If the attribute is set, then the parsers, the grabbers and the
+   * downloader share a pool of threads (one by core) instead of to have
+   * their own threads. \p parser_nb and \p grabber_nb are then the maximum
+   * of files which can be parsed or grabbed at the same time.
+   */
+  unsigned int pool        : 1;
 
   /**
    * When \p od_cb is defined, an event is sent for each step with an on demand
@@ -569,6 +730,25 @@ typedef struct valhalla_init_param_s {
   /** User data for metadata event callback. */
   void *md_data;
 
+  /**
+   * Minimum number of threads for parsing. The number of threads grows
+   * up to \p parser_nb according to the queue of files and the time to
+   * parse one file, and it shrinks when the queue is empty. By default (0)
+   * the number is fixed to \p parser_nb.
+   */
+  unsigned int parser_min;
+  /**
+   * Minimum number of threads for grabbing, like \p parser_min but up to
+   * \p grabber_nb. By default (0) the number is fixed to \p grabber_nb.
+   */
+  unsigned int grabber_min;
+  /**
+   * Stack size (in bytes) of the threads. A small value saves memory on
+   * the embedded systems, but the grabbers and the parsers (libavformat)
+   * need a few hundred KiB. By default (0) the size of the system is used.
+   */
+  unsigned int stack_size;
+
 } valhalla_init_param_t;
 
 /**
@@ -790,6 +970,41 @@ void valhalla_scanner_wakeup (valhalla_t *handle);
  */
 void valhalla_ondemand (valhalla_t *handle, const char *file);
 
+/**
+ * \brief Force Valhalla to retrieve metadata on-demand for a set of files.
+ *
+ * It is the same as valhalla_ondemand() but all files are handled together.
+ * The database is checked and the files are promoted in the same pass, then
+ * it is faster than one call by file (for example with the entries of a
+ * folder view or a playlist). An event is sent for each file.
+ *
+ * \warning This function can be used only after valhalla_run()!
+ * \param[in] handle      Handle on the scanner.
+ * \param[in] files       Array of targets (NULL entries are ignored).
+ * \param[in] nb          Number of entries in \p files.
+ */
+void valhalla_ondemand_many (valhalla_t *handle,
+                             const char **files, unsigned int nb);
+
+/**
+ * \brief Give the priority to the files of a directory.
+ *
+ * The files in the tree of \p path (browsed by the user for example) are
+ * handled before the rest of the scanned files, but after the files
+ * requested with valhalla_ondemand(). The files already in the queues are
+ * raised too, and the scanner reads this directory first with the next
+ * loop. No event is sent for these files.
+ *
+ * A new hint for the same directory replaces the previous one.
+ *
+ * \warning This function can be used only after valhalla_run()!
+ * \param[in] handle      Handle on the scanner.
+ * \param[in] path        Directory.
+ * \param[in] ttl         Lifetime of the hint [sec], 0 to cancel.
+ */
+void valhalla_priority_hint_dir (valhalla_t *handle,
+                                 const char *path, unsigned int ttl);
+
 /**
  * \brief Retrieve the meta key when running in the ondemand callback.
  *
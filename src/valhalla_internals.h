@@ -32,13 +32,19 @@ typedef enum action_list {
   ACTION_DB_UPDATE_G,       /* dispatcher: grabber metadata ok, update in DB */
   ACTION_DB_END,            /* dispatcher: end metadata */
   ACTION_DB_NEWFILE,        /* scanner: new file to handle */
+  ACTION_DB_NEWFILES,       /* scanner: new files (same directory) */
   ACTION_DB_NEXT_LOOP,      /* scanner: stop db manage queue for next loop */
+  ACTION_DB_DELFILE,        /* scanner: file or directory removed (watch) */
+  ACTION_DB_DIRECTORY,      /* scanner: directory state for the pruning */
+  ACTION_DB_CHECKPOINT,     /* scanner: position to resume the scan */
+  ACTION_DB_SPILL,          /* dbmanager: next entry of the spill table */
   ACTION_DB_EXT_INSERT,     /* external metadata to insert */
   ACTION_DB_EXT_UPDATE,     /* external metadata to update */
   ACTION_DB_EXT_DELETE,     /* external metadata to delete */
   ACTION_DB_EXT_PRIORITY,   /* new priority for one or more metadata */
-  ACTION_ACKNOWLEDGE,       /* dbmanager: ack scanner for each file handled */
   ACTION_OD_ENGAGE,         /* engage ondemand procedure */
+  ACTION_OD_ENGAGE_MANY,    /* engage ondemand procedure for a set of files */
+  ACTION_OD_HINT,           /* priority hint for a directory */
   ACTION_EH_EVENTOD,        /* ondemand event for the user */
   ACTION_EH_EVENTMD,        /* metadata event when a set is completed */
   ACTION_EH_EVENTGL,        /* global event for the user */
@@ -65,16 +71,21 @@ struct valhalla_s {
 #endif /* USE_GRABBER */
   struct dbmanager_s     *dbmanager;
   struct event_handler_s *event_handler;
+  struct executor_s      *executor;
 
   struct vh_stats_s *stats;
+  struct throttle_s *throttle;
 
 #ifdef USE_GRABBER
   struct url_ctl_s *url_ctl;
 #endif /* USE_GRABBER */
 
+  unsigned int stack_size;  /* stack size for the threads, 0 for default */
+
   unsigned int run    : 1;  /* check if valhalla_run() is called two times */
   unsigned int noscan : 1;  /* only ondemand, scanner disabled */
   unsigned int fstop  : 1;  /* check if stop was called */
+  unsigned int ioidle : 1;  /* idle I/O class for the scanner and parsers */
 };
 
 /* this is required on windows */
@@ -115,6 +126,7 @@ struct valhalla_s {
 #define VH_THREAD_PAUSE_FORCESTOP(handle, nb)                       \
   {                                                                 \
     unsigned int i;                                                 \
+    vh_fifo_queue_limit_suspend (handle->fifo, 1);                  \
     for (i = 0; i < nb; i++)                                        \
     {                                                               \
       sem_post (&handle->sem_pause);                                \
@@ -128,11 +140,14 @@ struct valhalla_s {
     if (handle->paused)                                             \
     {                                                               \
       handle->paused = 0;                                           \
+      vh_fifo_queue_limit_suspend (handle->fifo, 0);                \
       for (i = 0; i < nb; i++)                                      \
         sem_post (&handle->sem_pause);                              \
     }                                                               \
     else                                                            \
     {                                                               \
+      /* no producer must wait on a paused thread */                \
+      vh_fifo_queue_limit_suspend (handle->fifo, 1);                \
       for (i = 0; i < nb; i++)                                      \
         vh_fifo_queue_push (handle->fifo, FIFO_QUEUE_PRIORITY_HIGH, \
                             ACTION_PAUSE_THREAD, NULL);             \
@@ -32,6 +32,7 @@ static const vh_test_case_t vtc[] = {
   { "osdep",        vh_test_osdep },
   { "parser",       vh_test_parser },
   { "json_utils",   vh_test_json_utils },
+  { "fifo_queue",   vh_test_fifo_queue },
 };
 
 
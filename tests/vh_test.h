@@ -25,5 +25,6 @@
 void vh_test_osdep (TCase *tc);
 void vh_test_parser (TCase *tc);
 void vh_test_json_utils (TCase *tc);
+void vh_test_fifo_queue (TCase *tc);
 
 #endif /* VH_TEST_H */
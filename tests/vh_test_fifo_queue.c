@@ -0,0 +1,525 @@
+/*
+ * GeeXboX Valhalla: tiny media scanner API.
+ * Copyright (C) 2010 Mathieu Schroeter <mathieu@schroetersa.ch>
+ *
+ * This file is part of libvalhalla.
+ *
+ * libvalhalla is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * libvalhalla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with libvalhalla; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include <check.h>
+
+#include "fifo_queue.h"
+#include "vh_test.h"
+
+#define BENCH_ITEMS (1 << 18)
+
+typedef struct bench_producer_s {
+  fifo_queue_t *queue;
+  unsigned int  nb;
+} bench_producer_t;
+
+
+static int
+fifo_cmp (const void *tocmp, int id, const void *data)
+{
+  (void) id;
+  return tocmp != data;
+}
+
+START_TEST (test_fifo_queue_order)
+{
+  int i, id;
+  void *data;
+  fifo_queue_t *queue;
+
+  queue = vh_fifo_queue_new ();
+  fail_if (!queue, "malloc error");
+
+  /* several rounds in order to use the items of the pool */
+  for (i = 0; i < 3; i++)
+  {
+    int j;
+
+    for (j = 1; j <= 4; j++)
+      vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL,
+                          j, (void *) (intptr_t) j);
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_HIGH, 5, (void *) 5);
+
+    data = vh_fifo_queue_search (queue, &id, (void *) 3, fifo_cmp);
+    fail_unless (data == (void *) 3 && id == 3,
+                 "search has returned %p (id %i)", data, id);
+    vh_fifo_queue_moveup (queue, (void *) 4, fifo_cmp);
+
+    {
+      static const int expected[] = { 4, 5, 1, 2, 3 };
+
+      for (j = 0; j < 5; j++)
+      {
+        fail_if (vh_fifo_queue_pop (queue, &id, &data) != FIFO_QUEUE_SUCCESS,
+                 "pop has failed");
+        fail_unless (id == expected[j] && data == (void *) (intptr_t) id,
+                     "expected %i but id was %i", expected[j], id);
+      }
+    }
+  }
+
+  /* the pool can be reduced or disabled at any time */
+  vh_fifo_queue_pool_set (queue, 0);
+  vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, 6, NULL);
+  fail_if (vh_fifo_queue_pop (queue, &id, NULL) != FIFO_QUEUE_SUCCESS
+           || id != 6, "pop has failed without pool");
+
+  vh_fifo_queue_free (queue);
+}
+END_TEST
+
+/*
+ * The HIGH entries are LIFO, with an empty HIGH list (previously the ring),
+ * with a moved up entry on the top and beyond the size of a ring.
+ */
+START_TEST (test_fifo_queue_high)
+{
+  int i, id;
+  void *data;
+  fifo_queue_t *queue;
+
+  queue = vh_fifo_queue_new ();
+  fail_if (!queue, "malloc error");
+
+  vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, 1000, (void *) 1000);
+  for (i = 1; i <= 300; i++)
+  {
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_HIGH,
+                        i, (void *) (intptr_t) i);
+    if (i == 150)
+      vh_fifo_queue_moveup (queue, (void *) 1000, fifo_cmp);
+  }
+
+  for (i = 300; i >= 0; i--)
+  {
+    int expected = i == 150 ? 1000 : (i > 150 ? i : i + 1);
+
+    fail_if (vh_fifo_queue_pop (queue, &id, &data) != FIFO_QUEUE_SUCCESS,
+             "pop has failed");
+    fail_unless (id == expected && data == (void *) (intptr_t) id,
+                 "expected %i but id was %i", expected, id);
+  }
+
+  vh_fifo_queue_free (queue);
+}
+END_TEST
+
+START_TEST (test_fifo_queue_aging)
+{
+  int i, j, id;
+  fifo_queue_t *queue;
+  static const struct {
+    unsigned int aging;
+    int expected[7];
+  } rounds[] = {
+    { 0, { 7, 6, 3, 4, 5, 1, 2 } }, /* strict priorities */
+    { 2, { 7, 6, 3, 1, 4, 5, 2 } }, /* the oldest after 2 bypasses */
+  };
+
+  queue = vh_fifo_queue_new ();
+  fail_if (!queue, "malloc error");
+
+  for (i = 0; i < 2; i++)
+  {
+    vh_fifo_queue_aging_set (queue, rounds[i].aging);
+
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL,  1, NULL);
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL,  2, NULL);
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_RECENT,  3, NULL);
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_RECENT,  4, NULL);
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_RECENT,  5, NULL);
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_BROWSED, 6, NULL);
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_HIGH,    7, NULL);
+
+    for (j = 0; j < 7; j++)
+    {
+      fail_if (vh_fifo_queue_pop (queue, &id, NULL) != FIFO_QUEUE_SUCCESS,
+               "pop has failed");
+      fail_unless (id == rounds[i].expected[j], "expected %i but id was %i",
+                   rounds[i].expected[j], id);
+    }
+  }
+
+  vh_fifo_queue_free (queue);
+}
+END_TEST
+
+START_TEST (test_fifo_queue_pop_many)
+{
+  int i, nb;
+  fifo_queue_t *queue;
+  fifo_queue_entry_t out[8];
+  static const struct {
+    unsigned int max;
+    int nb;
+    int first;
+  } pops[] = {
+    { 8, 1, 4 }, /* a HIGH entry is returned alone */
+    { 2, 2, 1 },
+    { 8, 1, 3 },
+  };
+
+  queue = vh_fifo_queue_new ();
+  fail_if (!queue, "malloc error");
+
+  for (i = 1; i <= 3; i++)
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, i, NULL);
+  vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_HIGH, 4, NULL);
+
+  for (i = 0; i < 3; i++)
+  {
+    nb = vh_fifo_queue_pop_many (queue, pops[i].max, out);
+    fail_unless (nb == pops[i].nb && out[0].id == pops[i].first,
+                 "expected %i entries from %i but %i from %i",
+                 pops[i].nb, pops[i].first, nb, out[0].id);
+  }
+
+  vh_fifo_queue_free (queue);
+}
+END_TEST
+
+static int
+index_cmp (const void *tocmp, int id, const void *data)
+{
+  (void) id;
+  return strcmp (tocmp, data);
+}
+
+static const char *
+index_key (int id, const void *data)
+{
+  return id ? data : NULL;
+}
+
+START_TEST (test_fifo_queue_index)
+{
+  int i, id;
+  void *data;
+  fifo_queue_t *queue;
+  static const char *keys[] = { "a", "b", "c", "d" };
+
+  queue = vh_fifo_queue_new ();
+  fail_if (!queue, "malloc error");
+
+  /* the entries already queued are indexed too */
+  vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, 1, (void *) keys[0]);
+  fail_if (vh_fifo_queue_index_set (queue, index_key), "index_set has failed");
+
+  for (i = 1; i < 4; i++)
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL,
+                        i + 1, (void *) keys[i]);
+  vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, 0, (void *) "e");
+
+  data = vh_fifo_queue_search (queue, &id, "c", index_cmp);
+  fail_unless (data == keys[2] && id == 3,
+               "search has returned %p (id %i)", data, id);
+
+  /* not indexed (no key) */
+  data = vh_fifo_queue_search (queue, &id, "e", index_cmp);
+  fail_if (data, "search has returned an entry without key");
+
+  vh_fifo_queue_moveup (queue, "d", index_cmp);
+  vh_fifo_queue_moveup (queue, "b", index_cmp);
+
+  {
+    static const int expected[] = { 2, 4, 1, 3, 0 };
+
+    for (i = 0; i < 5; i++)
+    {
+      fail_if (vh_fifo_queue_pop (queue, &id, NULL) != FIFO_QUEUE_SUCCESS,
+               "pop has failed");
+      fail_unless (id == expected[i],
+                   "expected %i but id was %i", expected[i], id);
+    }
+  }
+
+  /* the popped entries are no longer indexed */
+  data = vh_fifo_queue_search (queue, &id, "a", index_cmp);
+  fail_if (data, "search has returned a popped entry");
+
+  vh_fifo_queue_free (queue);
+}
+END_TEST
+
+/* The oldest entry of a key is found first, with and without the index. */
+START_TEST (test_fifo_queue_oldest)
+{
+  int i, k, id;
+  void *data;
+  fifo_queue_t *queue;
+
+  for (k = 0; k < 2; k++)
+  {
+    queue = vh_fifo_queue_new ();
+    fail_if (!queue, "malloc error");
+
+    if (k)
+      fail_if (vh_fifo_queue_index_set (queue, index_key),
+               "index_set has failed");
+
+    /* beyond the size of a ring */
+    for (i = 0; i < 300; i++)
+      vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, 10, "x");
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, 1, "k");
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_RECENT, 2, "k");
+
+    data = vh_fifo_queue_search (queue, &id, "k", index_cmp);
+    fail_unless (data && id == 1, "search has returned the id %i", id);
+
+    vh_fifo_queue_moveup (queue, "k", index_cmp);
+    fail_if (vh_fifo_queue_pop (queue, &id, NULL) != FIFO_QUEUE_SUCCESS,
+             "pop has failed");
+    fail_unless (id == 1, "expected 1 but id was %i", id);
+    fail_if (vh_fifo_queue_pop (queue, &id, NULL) != FIFO_QUEUE_SUCCESS,
+             "pop has failed");
+    fail_unless (id == 2, "expected 2 but id was %i", id);
+
+    vh_fifo_queue_free (queue);
+  }
+}
+END_TEST
+
+/* the entries with the id 9 (like ACTION_DB_END) are never moved up */
+static int
+moveup_cmp (const void *tocmp, int id, const void *data)
+{
+  return id == 9 ? -1 : strcmp (tocmp, data);
+}
+
+/*
+ * All entries of a key are moved up in the order of their pushes, and an
+ * entry refused by the comparison stays behind them.
+ */
+START_TEST (test_fifo_queue_moveup)
+{
+  int i, k, id;
+  fifo_queue_t *queue;
+  static const int expected[] = { 1, 2, 3 };
+
+  for (k = 0; k < 2; k++)
+  {
+    queue = vh_fifo_queue_new ();
+    fail_if (!queue, "malloc error");
+
+    if (k)
+      fail_if (vh_fifo_queue_index_set (queue, index_key),
+               "index_set has failed");
+
+    for (i = 0; i < 1000; i++)
+      vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, 10, "x");
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, 1, "k");
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_RECENT, 2, "k");
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, 3, "k");
+    vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL, 9, "k");
+
+    fail_unless (vh_fifo_queue_moveup (queue, "k", moveup_cmp) == 3,
+                 "moveup has not moved 3 entries");
+
+    for (i = 0; i < 3; i++)
+    {
+      fail_if (vh_fifo_queue_pop (queue, &id, NULL) != FIFO_QUEUE_SUCCESS,
+               "pop has failed");
+      fail_unless (id == expected[i],
+                   "expected %i but id was %i", expected[i], id);
+    }
+
+    /* the last entry is not moved */
+    for (i = 0; i < 1001; i++)
+    {
+      fail_if (vh_fifo_queue_pop (queue, &id, NULL) != FIFO_QUEUE_SUCCESS,
+               "pop has failed");
+      fail_unless (id == (i < 1000 ? 10 : 9), "unexpected id %i", id);
+    }
+
+    vh_fifo_queue_free (queue);
+  }
+}
+END_TEST
+
+static int
+raise_cmp (const void *tocmp, int id, const void *data)
+{
+  (void) id;
+  return strncmp (tocmp, data, strlen (tocmp));
+}
+
+START_TEST (test_fifo_queue_raise)
+{
+  int i, id;
+  unsigned int nb;
+  fifo_queue_t *queue;
+
+  queue = vh_fifo_queue_new ();
+  fail_if (!queue, "malloc error");
+
+  /* strict priorities */
+  vh_fifo_queue_aging_set (queue, 0);
+
+  vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL,  1, "/a/1");
+  vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL,  2, "/b/2");
+  vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_NORMAL,  3, "/a/3");
+  vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_RECENT,  4, "/a/4");
+  vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_BROWSED, 5, "/c/5");
+  vh_fifo_queue_push (queue, FIFO_QUEUE_PRIORITY_HIGH,    6, "/a/6");
+
+  /* the entries already at this level (or above) are not moved */
+  nb = vh_fifo_queue_raise (queue, FIFO_QUEUE_PRIORITY_BROWSED,
+                            "/a/", raise_cmp);
+  fail_unless (nb == 3, "raise has moved %u entries", nb);
+
+  {
+    static const int expected[] = { 6, 5, 1, 3, 4, 2 };
+
+    for (i = 0; i < 6; i++)
+    {
+      fail_if (vh_fifo_queue_pop (queue, &id, NULL) != FIFO_QUEUE_SUCCESS,
+               "pop has failed");
+      fail_unless (id == expected[i],
+                   "expected %i but id was %i", expected[i], id);
+    }
+  }
+
+  vh_fifo_queue_free (queue);
+}
+END_TEST
+
+static void *
+limit_producer (void *arg)
+{
+  vh_fifo_queue_push_wait (arg, FIFO_QUEUE_PRIORITY_NORMAL, 3, NULL);
+  return NULL;
+}
+
+START_TEST (test_fifo_queue_limit)
+{
+  int i, id;
+  pthread_t th;
+  fifo_queue_t *queue;
+
+  queue = vh_fifo_queue_new ();
+  fail_if (!queue, "malloc error");
+
+  vh_fifo_queue_limit_set (queue, 2);
+  vh_fifo_queue_push_wait (queue, FIFO_QUEUE_PRIORITY_NORMAL, 1, NULL);
+  vh_fifo_queue_push_wait (queue, FIFO_QUEUE_PRIORITY_NORMAL, 2, NULL);
+  fail_unless (vh_fifo_queue_full (queue), "the queue must be full");
+
+  /* the HIGH entries are never limited */
+  vh_fifo_queue_push_wait (queue, FIFO_QUEUE_PRIORITY_HIGH, 0, NULL);
+
+  /* the producer waits until that an entry is popped */
+  pthread_create (&th, NULL, limit_producer, queue);
+  for (i = 0; i < 4; i++)
+  {
+    fail_if (vh_fifo_queue_pop (queue, &id, NULL) != FIFO_QUEUE_SUCCESS
+             || id != i, "expected %i but id was %i", i, id);
+  }
+  pthread_join (th, NULL);
+
+  /* a suspended limit releases the producers */
+  vh_fifo_queue_limit_set (queue, 1);
+  vh_fifo_queue_push_wait (queue, FIFO_QUEUE_PRIORITY_NORMAL, 4, NULL);
+  vh_fifo_queue_limit_suspend (queue, 1);
+  fail_if (vh_fifo_queue_full (queue), "the limit must be suspended");
+  vh_fifo_queue_push_wait (queue, FIFO_QUEUE_PRIORITY_NORMAL, 5, NULL);
+
+  vh_fifo_queue_free (queue);
+}
+END_TEST
+
+static void *
+bench_producer (void *arg)
+{
+  unsigned int i;
+  bench_producer_t *p = arg;
+
+  for (i = 0; i < p->nb; i++)
+    vh_fifo_queue_push (p->queue, FIFO_QUEUE_PRIORITY_NORMAL, (int) i, p);
+
+  return NULL;
+}
+
+/*
+ * Microbenchmark of push/pop with 1, 4 and 16 producers and one consumer.
+ * The throughput is only printed; the test fails if an item is lost.
+ */
+START_TEST (test_fifo_queue_bench)
+{
+  static const unsigned int producers[] = { 1, 4, 16 };
+  unsigned int i;
+
+  for (i = 0; i < sizeof (producers) / sizeof (*producers); i++)
+  {
+    unsigned int j, nb = producers[i];
+    unsigned int total = BENCH_ITEMS / nb * nb;
+    pthread_t th[16];
+    bench_producer_t p;
+    struct timespec t0, t1;
+    double elapsed;
+
+    p.queue = vh_fifo_queue_new ();
+    p.nb    = BENCH_ITEMS / nb;
+    fail_if (!p.queue, "malloc error");
+
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+
+    for (j = 0; j < nb; j++)
+      pthread_create (&th[j], NULL, bench_producer, &p);
+
+    for (j = 0; j < total; j++)
+      fail_if (vh_fifo_queue_pop (p.queue, NULL, NULL) != FIFO_QUEUE_SUCCESS,
+               "pop has failed after %u items", j);
+
+    for (j = 0; j < nb; j++)
+      pthread_join (th[j], NULL);
+
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf ("fifo_queue: %2u producer(s), %u items, %.0f push/pop per sec\n",
+            nb, total, elapsed > 0 ? total / elapsed : 0);
+
+    vh_fifo_queue_free (p.queue);
+  }
+}
+END_TEST
+
+void
+vh_test_fifo_queue (TCase *tc)
+{
+  tcase_add_test (tc, test_fifo_queue_order);
+  tcase_add_test (tc, test_fifo_queue_high);
+  tcase_add_test (tc, test_fifo_queue_aging);
+  tcase_add_test (tc, test_fifo_queue_pop_many);
+  tcase_add_test (tc, test_fifo_queue_index);
+  tcase_add_test (tc, test_fifo_queue_oldest);
+  tcase_add_test (tc, test_fifo_queue_moveup);
+  tcase_add_test (tc, test_fifo_queue_raise);
+  tcase_add_test (tc, test_fifo_queue_limit);
+  tcase_add_test (tc, test_fifo_queue_bench);
+}